@@ -21,22 +21,49 @@
 
 #include "cifsd.h"
 #include "netlink.h"
+#include "workq.h"
+#include "trace.h"
+#include "stats.h"
 #include <pwd.h>
+#include <limits.h>
 
 struct list_head cifsd_share_list;
 int cifsd_num_shares;
+unsigned int cifsd_share_generation;
 
 char workgroup[MAX_SERVER_WRKGRP_LEN];
 char server_string[MAX_SERVER_NAME_LEN];
 
+/* where the cifsd module exposes its control files */
+static char *sysfs_root = PATH_CIFSD_SYSFS;
+
 void usage(void)
 {
 	fprintf(stderr,
 		"Usage: cifsd [-h|--help] [-v|--version] [-d |--debug]\n"
-		"       [-c smb.conf|--configure=smb.conf] [-i usrs-db|--import-users=cifspwd.db\n");
+		"       [-c smb.conf|--configure=smb.conf] [-i usrs-db|--import-users=cifspwd.db\n"
+		"       [-t threads|--threads=N] (0 handles events on the netlink thread)\n"
+		"       [-s sysfs-dir] [-u socket] (talk to a kernel stand-in, e.g. cifsd-kmock)\n"
+		"       [-R trace] (record kernel events) [-P trace [-p]] (replay, -p keeps pacing)\n"
+		"       [-S stats-file] (event latency statistics for cifsstat -l, \"\" disables)\n"
+		"       [-I secs] (free clients without pipes idle this long, 0 never)\n"
+		"       [-E secs] (free pipes unused this long, 0 never)\n");
 	exit(0);
 }
 
+/**
+ * sysfs_path() - build the path of a cifsd control file
+ * @buf:	destination buffer, PATH_MAX bytes
+ * @name:	control file name
+ *
+ * Return:	@buf
+ */
+static char *sysfs_path(char *buf, const char *name)
+{
+	snprintf(buf, PATH_MAX, "%s/%s", sysfs_root, name);
+	return buf;
+}
+
 /**
  * config_users() - function to configure cifsd with user accounts from
  *		local database file. cifsd should be live in kernel
@@ -49,6 +76,7 @@ int config_users(char *dbpath)
 {
 	int eof = 0;
 	char *lstr, *usr, *pwd, *construct = NULL;
+	char path[PATH_MAX];
 	int len;
 	int fd_usr, fd_db;
 
@@ -59,7 +87,7 @@ int config_users(char *dbpath)
 		return CIFS_FAIL;
 	}
 
-	fd_usr = open(PATH_CIFSD_USR, O_WRONLY);
+	fd_usr = open(sysfs_path(path, "user"), O_WRONLY);
 	if (!fd_usr) {
 		cifsd_err("cifsd is not available\n");
 		return CIFS_FAIL;
@@ -132,56 +160,37 @@ out2:
 }
 
 /**
- * alloc_new_share() - allocate new share
- *
- * Return:	success: allocated share; fail: NULL
- */
-static struct cifsd_share *alloc_new_share(void)
-{
-	struct cifsd_share *share = NULL;
-	share = (struct cifsd_share *) calloc(1,
-			sizeof(struct cifsd_share));
-	if (!share)
-		return NULL;
-
-	share->sharename = (char *) calloc(1, SHARE_MAX_NAME_LEN);
-	if (!share->sharename) {
-		free(share);
-		return NULL;
-	}
-
-	share->config.comment = (char *) calloc(1, SHARE_MAX_COMMENT_LEN);
-	if (!share->config.comment) {
-		free(share);
-		free(share->sharename);
-		return NULL;
-	}
-
-	INIT_LIST_HEAD(&share->list);
-	return share;
-}
-
-/**
- * add_new_share() - add newly allocated share in global share list
+ * add_new_share() - add a share to the global share list
  * @sharename:	share name string
- * @comment:	comment decribing share
+ * @comment:	comment decribing share, may be NULL
+ * @path:	local path of the share, may be NULL
  */
-static void add_new_share(char *sharename, char *comment)
+static void add_new_share(char *sharename, char *comment, char *path)
 {
 	struct cifsd_share *share;
 
-	share = (struct cifsd_share *)alloc_new_share();
+	share = calloc(1, sizeof(struct cifsd_share));
 	if (!share)
 		return;
 
-	if (sharename)
-		memcpy(share->sharename, sharename, strlen(sharename));
-
-	if (share->config.comment)
-		memcpy(share->config.comment, comment, strlen(comment));
+	share->sharename = strdup(sharename);
+	if (comment)
+		share->config.comment = strdup(comment);
+	if (path)
+		share->path = strdup(path);
+	if (!share->sharename || (comment && !share->config.comment) ||
+			(path && !share->path)) {
+		cifsd_err("failed to allocate share %s\n", sharename);
+		free(share->path);
+		free(share->config.comment);
+		free(share->sharename);
+		free(share);
+		return;
+	}
 
 	list_add(&share->list, &cifsd_share_list);
 	cifsd_num_shares++;
+	__atomic_add_fetch(&cifsd_share_generation, 1, __ATOMIC_RELEASE);
 }
 
 /**
@@ -196,10 +205,12 @@ static void exit_share_config(void)
 		share = list_entry(tmp, struct cifsd_share, list);
 		list_del(&share->list);
 		cifsd_num_shares--;
+		free(share->path);
 		free(share->config.comment);
 		free(share->sharename);
 		free(share);
 	}
+	__atomic_add_fetch(&cifsd_share_generation, 1, __ATOMIC_RELEASE);
 }
 
 /**
@@ -209,7 +220,7 @@ static void exit_share_config(void)
 static void init_share_config(void)
 {
 	INIT_LIST_HEAD(&cifsd_share_list);
-	add_new_share(STR_IPC, "IPC$ share");
+	add_new_share(STR_IPC, "IPC$ share", NULL);
 	strncpy(workgroup, STR_WRKGRP, strlen(STR_WRKGRP));
 	strncpy(server_string, STR_SRV_NAME, strlen(STR_SRV_NAME));
 }
@@ -260,8 +271,8 @@ out:
 }
 
 /**
- * parse_share_config() - parse share config entry for sharename and
- *			comment for dcerpc
+ * parse_share_config() - parse share config entry for sharename,
+ *			comment and path for dcerpc
  *
  * @src:	source string to be scanned
  */
@@ -273,6 +284,7 @@ static void parse_share_config(char *src)
 	char *val;
 	char *sharename = NULL;
 	char *comment = NULL;
+	char *path = NULL;
 
 	if (!src)
 		return;
@@ -300,10 +312,15 @@ static void parse_share_config(char *src)
 			if (val)
 				comment = val + 2;
 		}
+		else if (!strncasecmp("path =", conf, 6)) {
+			val = strchr(conf, '=');
+			if (val)
+				path = val + 2;
+		}
 	}while((conf = strtok(NULL, "<")));
 
 	if (sharename)
-		add_new_share(sharename, comment);
+		add_new_share(sharename, comment, path);
 
 out:
 	free(tmp);
@@ -327,9 +344,10 @@ void prefix_share_name(char *src, int *srclen)
 	}
 	share_name[j] = '\0';
 
-	strncpy(src, share_cfg,  strlen(share_cfg));
-	strncat(src, share_name, strlen(share_name));
-	*srclen = strlen(src);
+	/* @src is a PAGE_SZ buffer holding at least the bracketed name */
+	*srclen = snprintf(src, PAGE_SZ, "%s%s", share_cfg, share_name);
+	if (*srclen >= PAGE_SZ)
+		*srclen = PAGE_SZ - 1;
 }
 
 /**
@@ -447,6 +465,7 @@ int config_shares(char *conf_path)
 	char lshare[PAGE_SZ] = "";
 	char sharepath[PAGE_SZ] = "";
 	char tbuf[PAGE_SZ];
+	char path[PATH_MAX];
 	int sharepath_len = 0;
 	int cnt = 0, lssz = 0, limit = 0, eof = 0, sz;
 	int fd_conf;
@@ -459,7 +478,7 @@ int config_shares(char *conf_path)
 		return CIFS_FAIL;
 	}
 
-	fd_conf = open(PATH_CIFSD_CONFIG, O_WRONLY);
+	fd_conf = open(sysfs_path(path, "config"), O_WRONLY);
 	if (fd_conf < 0) {
 		cifsd_err("cifsd is not available, err %d\n", errno);
 		fclose(fd_share);
@@ -602,12 +621,14 @@ int main(int argc, char**argv)
 {
 	char *cifspwd = PATH_PWDDB;
 	char *cifsconf = PATH_SHARECONF;
+	char *record = NULL, *replay = NULL;
+	int paced = 0;
 	int c;
 	int ret;
 
 	/* Parse the command line options and arguments. */
 	opterr = 0;
-	while ((c = getopt(argc, argv, "c:i:vh")) != EOF)
+	while ((c = getopt(argc, argv, "c:i:t:s:u:R:P:pS:I:E:vh")) != EOF)
 		switch (c) {
 		case 'c':
 			cifsconf = strdup(optarg);
@@ -615,6 +636,39 @@ int main(int argc, char**argv)
 		case 'i':
 			cifspwd = strdup(optarg);
 			break;
+		case 't':
+			cifsd_nr_workers = atoi(optarg);
+			if (cifsd_nr_workers < 0)
+				usage();
+			break;
+		case 's':
+			sysfs_root = strdup(optarg);
+			break;
+		case 'u':
+			cifsd_transport_path = strdup(optarg);
+			break;
+		case 'R':
+			record = strdup(optarg);
+			break;
+		case 'P':
+			replay = strdup(optarg);
+			break;
+		case 'p':
+			paced = 1;
+			break;
+		case 'S':
+			cifsd_stats_path = *optarg ? strdup(optarg) : NULL;
+			break;
+		case 'I':
+			cifsd_client_idle = atoi(optarg);
+			if (cifsd_client_idle < 0)
+				usage();
+			break;
+		case 'E':
+			cifsd_pipe_idle = atoi(optarg);
+			if (cifsd_pipe_idle < 0)
+				usage();
+			break;
 		case 'v':
 			if (argc <= 2) {
 				printf("[option] needed with verbose\n");
@@ -642,8 +696,22 @@ int main(int argc, char**argv)
 
 	//cifsd_debug("cifsd version : %d\n", cifsd_version);
 
+	cifsd_stats_init();
+
+	if (replay) {
+		cifsd_trace_replay(replay, paced);
+		cifsd_stats_exit();
+		exit_share_config();
+		goto out;
+	}
+
+	if (record && cifsd_trace_open(record))
+		goto out;
+
 	/* netlink communication loop */
 	cifsd_netlink_setup();
+	cifsd_trace_close();
+	cifsd_stats_exit();
 
 	exit_share_config();
 
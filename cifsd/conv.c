@@ -134,6 +134,16 @@ char *smb_strndup_from_utf16(char *src, const int maxlen,
 	return dst;
 }
 
+/**
+ * smbConvertToUTF16() - convert a string to UTF-16LE
+ * @target:	output buffer
+ * @source:	string in @codepage
+ * @slen:	bytes of @source to convert
+ * @targetlen:	size of @target in bytes
+ * @codepage:	encoding of @source
+ *
+ * Return:	bytes written to @target, or -EINVAL
+ */
 int smbConvertToUTF16(__le16 *target, char *source, int slen,
 		int targetlen, const char *codepage)
 {
@@ -156,7 +166,37 @@ int smbConvertToUTF16(__le16 *target, char *source, int slen,
 		return -EINVAL;
 	}
 	close_conversion(conv);	
-	return 0;
+	return targetlen - dstlen;
+}
+
+/**
+ * smbConvertFromUTF16() - convert a UTF-16LE string to a codepage
+ * @target:	output buffer
+ * @source:	UTF-16LE string
+ * @slen:	bytes of @source to convert
+ * @targetlen:	size of @target in bytes
+ * @codepage:	encoding to convert to
+ *
+ * Return:	bytes written to @target, or -EINVAL
+ */
+int smbConvertFromUTF16(char *target, char *source, int slen,
+		int targetlen, const char *codepage)
+{
+	iconv_t conv;
+	size_t ret;
+	size_t srclen = slen, dstlen = targetlen;
+
+	conv = init_conversion(codepage, 1);
+	if (conv == (iconv_t) -1)
+		return -EINVAL;
+
+	ret = iconv(conv, &source, &srclen, &target, &dstlen);
+	close_conversion(conv);
+	if (ret == -1) {
+		cifsd_err("Error in conversion of string\n");
+		return -EINVAL;
+	}
+	return targetlen - dstlen;
 }
 
 /**
@@ -19,9 +19,44 @@
  *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
  */
 
+#include <pthread.h>
 #include"dcerpc.h"
 #include"winreg.h"
 #include"ntlmssp.h"
+#include"stats.h"
+#include"pool.h"
+#include"ndr_srvsvc.h"
+#include"ndr_wkssvc.h"
+#include"ndr_winreg.h"
+
+#ifdef WINREG_SUPPORT
+/* the registry tree is shared by all clients */
+static pthread_mutex_t winreg_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Complete NetShareEnumAll replies only depend on the info level, the
+ * client codepage, whether a resume handle was passed and the share
+ * list. They are marshalled once and shared by all pipes until the share
+ * list generation moves on, a request only patches its call_id and
+ * context_id into its copy. Paged replies are built per request.
+ */
+#define SHARE_ENUM_CACHE_SIZE	8
+
+struct share_enum_rsp {
+	int		refcount;	/* cache slot and pipes using it */
+	unsigned int	generation;
+	int		level;
+	int		resume;		/* reply carries a resume handle */
+	char		codepage[CIFSD_CODEPAGE_LEN];
+	unsigned int	size;		/* max_buffer needed for all shares */
+	int		len;
+	char		*data;
+};
+
+static struct share_enum_rsp *share_enum_cache[SHARE_ENUM_CACHE_SIZE];
+static unsigned int share_enum_next;	/* slot to evict next */
+static pthread_mutex_t share_enum_lock = PTHREAD_MUTEX_INITIALIZER;
 
 struct cifsd_pipe_table cifsd_pipes[] = {
 	{"\\srvsvc", SRVSVC},
@@ -33,6 +68,159 @@ struct cifsd_pipe_table cifsd_pipes[] = {
 };
 unsigned int npipes = sizeof(cifsd_pipes)/sizeof(cifsd_pipes[0]);
 
+/* accepted context, NDR 8a885d04-1ceb-11c9-9fe8-08002b104860 version 2 */
+static const RPC_RESULT rpc_result_accept = {
+	.result = RPC_RESULT_ACCEPT,
+	.reason = RPC_REASON_NONE,
+	.transfer = {
+		.uuid = {0x8a885d04, 0x1ceb, 0x11c9, {0x9f, 0xe8},
+			{0x08, 0x00, 0x2b, 0x10, 0x48, 0x60}},
+		.version_maj = 2,
+		.version_min = 0,
+	},
+};
+
+/*
+ * Handler of one opnum. Requests with a stub outside of min_size and
+ * max_size, 0 for no limit, are rejected without being decoded.
+ */
+struct dcerpc_op {
+	const char	*name;
+	int		(*handler)(struct cifsd_pipe *pipe, struct ndr *ndr);
+	int		min_size;
+	int		max_size;
+};
+
+/* stub limit of the srvsvc and wkssvc calls, names are short */
+#define SRVSVC_STUB_MAX		1024
+
+static int srvsvc_net_share_enum_all(struct cifsd_pipe *pipe,
+		struct ndr *ndr);
+static int srvsvc_net_share_info(struct cifsd_pipe *pipe, struct ndr *ndr);
+static int wkkssvc_net_share_info(struct cifsd_pipe *pipe, struct ndr *ndr);
+
+static const struct dcerpc_op srvsvc_ops[] = {
+	[SRV_NET_SHARE_ENUM_ALL] = {"NetShareEnumAll",
+		srvsvc_net_share_enum_all, 24, SRVSVC_STUB_MAX},
+	[SRV_NET_SHARE_GETINFO] = {"NetShareGetInfo",
+		srvsvc_net_share_info, 24, SRVSVC_STUB_MAX},
+};
+
+static const struct dcerpc_op wkssvc_ops[] = {
+	[WKSSVC_NET_SHARE_GETINFO] = {"NetWkstaGetInfo",
+		wkkssvc_net_share_info, 8, SRVSVC_STUB_MAX},
+};
+
+/*
+ * The winreg calls not in idl/winreg.idl decode by hand, from the stub
+ * that follows the request header in both single and reassembled
+ * requests.
+ */
+#define WINREG_OP(fn)							\
+static int fn##_op(struct cifsd_pipe *pipe, struct ndr *ndr)		\
+{									\
+	return fn(pipe, (RPC_REQUEST_REQ *)ndr->data - 1, ndr->data);	\
+}
+
+WINREG_OP(winreg_delete_key)
+WINREG_OP(winreg_flush_key)
+WINREG_OP(winreg_create_key)
+WINREG_OP(winreg_enum_key)
+WINREG_OP(winreg_enum_value)
+WINREG_OP(winreg_query_info_key)
+WINREG_OP(winreg_notify_change_key_value)
+WINREG_OP(winreg_delete_value)
+
+/* calls other than OpenHK* start with a key handle */
+#define WINREG_HANDLE_SIZE	sizeof(KEY_HANDLE)
+
+static const struct dcerpc_op winreg_ops[] = {
+	[NDR_WINREG_OPENHKCR] = {"OpenHKCR", winreg_open_root_key, 8, 0},
+	[NDR_WINREG_OPENHKCU] = {"OpenHKCU", winreg_open_root_key, 8, 0},
+	[NDR_WINREG_OPENHKLM] = {"OpenHKLM", winreg_open_root_key, 8, 0},
+	[NDR_WINREG_OPENHKU] = {"OpenHKU", winreg_open_root_key, 8, 0},
+	[NDR_WINREG_CLOSEKEY] = {"CloseKey", winreg_close_key,
+		WINREG_HANDLE_SIZE, 0},
+	[WINREG_CREATEKEY] = {"CreateKey", winreg_create_key_op,
+		WINREG_HANDLE_SIZE, 0},
+	[WINREG_DELETEKEY] = {"DeleteKey", winreg_delete_key_op,
+		WINREG_HANDLE_SIZE, 0},
+	[WINREG_DELETEVALUE] = {"DeleteValue", winreg_delete_value_op,
+		WINREG_HANDLE_SIZE, 0},
+	[WINREG_ENUMKEY] = {"EnumKey", winreg_enum_key_op,
+		WINREG_HANDLE_SIZE, 0},
+	[WINREG_ENUMVALUE] = {"EnumValue", winreg_enum_value_op,
+		WINREG_HANDLE_SIZE, 0},
+	[WINREG_FLUSHKEY] = {"FlushKey", winreg_flush_key_op,
+		WINREG_HANDLE_SIZE, 0},
+	[WINREG_NOTIFYCHANGEKEYVALUE] = {"NotifyChangeKeyValue",
+		winreg_notify_change_key_value_op, WINREG_HANDLE_SIZE, 0},
+	[NDR_WINREG_OPENKEY] = {"OpenKey", winreg_open_key,
+		WINREG_HANDLE_SIZE, 0},
+	[WINREG_QUERYINFOKEY] = {"QueryInfoKey", winreg_query_info_key_op,
+		WINREG_HANDLE_SIZE, 0},
+	[NDR_WINREG_QUERYVALUE] = {"QueryValue", winreg_query_value,
+		WINREG_HANDLE_SIZE, 0},
+	[NDR_WINREG_SETVALUE] = {"SetValue", winreg_set_value,
+		WINREG_HANDLE_SIZE, 0},
+	[NDR_WINREG_GETVERSION] = {"GetVersion", winreg_get_version,
+		WINREG_HANDLE_SIZE, 0},
+};
+
+#define DCERPC_OPS(ops)	(ops), sizeof(ops) / sizeof((ops)[0])
+
+/* interfaces a client can bind to on each pipe type */
+static const struct dcerpc_iface {
+	unsigned int			pipe_type;
+	const struct ndr_interface	*table;
+	const char			*endpoint; /* secondary address */
+	int				stat; /* CIFSD_STAT_* interface */
+	const struct dcerpc_op		*ops; /* indexed by opnum */
+	int				nr_ops;
+} dcerpc_ifaces[] = {
+	{SRVSVC, &ndr_table_srvsvc, "\\PIPE\\srvsvc", CIFSD_STAT_SRVSVC,
+		DCERPC_OPS(srvsvc_ops)},
+	{SRVSVC, &ndr_table_wkssvc, "\\PIPE\\wkssvc", CIFSD_STAT_WKSSVC,
+		DCERPC_OPS(wkssvc_ops)},
+	{WINREG, &ndr_table_winreg, "\\PIPE\\winreg", CIFSD_STAT_WINREG,
+		DCERPC_OPS(winreg_ops)},
+};
+
+/*
+ * Rejected requests are logged the first time and then at most once per
+ * DCERPC_REJECT_LOG_SECS for each opnum, with the number left unlogged.
+ * Opnums beyond the statistics share the last slot.
+ */
+#define DCERPC_REJECT_LOG_SECS	60
+
+struct dcerpc_reject_log {
+	__u64		next;		/* monotonic seconds */
+	unsigned int	suppressed;
+};
+
+static struct dcerpc_reject_log
+	reject_log[CIFSD_STAT_NR_IFACES][CIFSD_STAT_MAX_OPNUM + 1];
+
+#define NR_DCERPC_IFACES	(sizeof(dcerpc_ifaces) / sizeof(dcerpc_ifaces[0]))
+
+/* last association group id handed out, ids are unique server wide */
+static __u32 assoc_gid_last;
+
+/*
+ * Bind replies up to their result list, built by dcerpc_init(). A bind
+ * ack names the endpoint of the interface bound first, there is one
+ * template per interface and one without endpoint for alter_context
+ * replies. Reads patch in the packet type, call_id, fragment sizes and
+ * association group, then append a result per context.
+ */
+struct rpc_bind_tmpl {
+	int	len;
+	char	data[64];
+};
+
+static struct rpc_bind_tmpl bind_ack_tmpl[NR_DCERPC_IFACES + 1];
+static struct rpc_bind_tmpl bind_nak_tmpl;
+
 /**
  * get_pipe_type() - get the type of the pipe from the string name
  * @name:      string name for representation of pipe, need to be searched
@@ -54,1518 +242,1731 @@ unsigned int get_pipe_type(char *pipename)
 	return pipetype;
 }
 
+static void share_enum_put(struct share_enum_rsp *rsp)
+{
+	if (__atomic_sub_fetch(&rsp->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(rsp->data);
+		free(rsp);
+	}
+}
+
 /**
- * process_rpc() - process a RPC request
- * @server:     TCP server instance of connection
- * @data:	RPC request packet - data
+ * share_enum_get() - find a cached NetShareEnumAll reply
+ * @level:	info level
+ * @codepage:	client codepage
+ * @resume:	whether the client passed a resume handle
+ * @max_buffer:	preferred maximum length from the request
  *
- * Return:      0 on success, error number on error
+ * Return:	reply with a reference taken, or NULL if not cached, stale
+ *		or too big for @max_buffer
  */
-int process_rpc(struct cifsd_pipe *pipe, char *data)
+static struct share_enum_rsp *share_enum_get(int level, char *codepage,
+		int resume, unsigned int max_buffer)
 {
-	RPC_HDR *rpc_hdr;
-	int ret = 0;
+	unsigned int gen = __atomic_load_n(&cifsd_share_generation,
+			__ATOMIC_ACQUIRE);
+	struct share_enum_rsp *rsp;
+	int i;
 
-	rpc_hdr = (RPC_HDR *)data;
+	pthread_mutex_lock(&share_enum_lock);
+	for (i = 0; i < SHARE_ENUM_CACHE_SIZE; i++) {
+		rsp = share_enum_cache[i];
+		if (rsp && rsp->generation == gen && rsp->level == level &&
+				rsp->resume == resume &&
+				rsp->size <= max_buffer &&
+				!strcmp(rsp->codepage, codepage)) {
+			__atomic_add_fetch(&rsp->refcount, 1,
+					__ATOMIC_RELAXED);
+			pthread_mutex_unlock(&share_enum_lock);
+			return rsp;
+		}
+	}
+	pthread_mutex_unlock(&share_enum_lock);
+	return NULL;
+}
 
-	cifsd_debug("DCERPC pktype = %u\n", rpc_hdr->pkt_type);
+/**
+ * share_enum_add() - cache a marshalled NetShareEnumAll reply
+ * @level:	info level
+ * @codepage:	client codepage
+ * @resume:	whether the reply carries a resume handle
+ * @size:	max_buffer needed for the reply to list all shares
+ * @gen:	share list generation the reply was built from
+ * @data:	reply, owned by the cache from here on
+ * @len:	reply length
+ *
+ * Replaces a stale entry for the same key, or else the oldest one.
+ *
+ * Return:	cached reply with a reference taken, or NULL on failure
+ */
+static struct share_enum_rsp *share_enum_add(int level, char *codepage,
+		int resume, unsigned int size, unsigned int gen, char *data,
+		int len)
+{
+	struct share_enum_rsp *rsp, *old;
+	int i, slot = -1;
 
-	switch (rpc_hdr->pkt_type) {
-	case RPC_REQUEST:
-		cifsd_debug("GOT RPC_REQUEST\n");
-		ret = rpc_request(pipe, data);
-		break;
-	case RPC_BIND:
-		cifsd_debug("GOT RPC_BIND\n");
-		ret = rpc_bind(pipe, data);
-		break;
-	default:
-		cifsd_debug("rpc type = %d Not Implemented\n",
-				rpc_hdr->pkt_type);
-		ret = -EOPNOTSUPP;
+	rsp = malloc(sizeof(*rsp));
+	if (!rsp) {
+		free(data);
+		return NULL;
 	}
 
-	if (!ret)
-		pipe->pkt_type = rpc_hdr->pkt_type;
+	rsp->refcount = 2;
+	rsp->generation = gen;
+	rsp->level = level;
+	rsp->resume = resume;
+	strncpy(rsp->codepage, codepage, CIFSD_CODEPAGE_LEN - 1);
+	rsp->codepage[CIFSD_CODEPAGE_LEN - 1] = '\0';
+	rsp->size = size;
+	rsp->len = len;
+	rsp->data = data;
+
+	pthread_mutex_lock(&share_enum_lock);
+	for (i = 0; i < SHARE_ENUM_CACHE_SIZE && slot < 0; i++) {
+		old = share_enum_cache[i];
+		if (!old || (old->level == level && old->resume == resume &&
+				!strcmp(old->codepage, codepage)))
+			slot = i;
+	}
+	if (slot < 0)
+		slot = share_enum_next++ % SHARE_ENUM_CACHE_SIZE;
 
-	return ret;
+	old = share_enum_cache[slot];
+	share_enum_cache[slot] = rsp;
+	pthread_mutex_unlock(&share_enum_lock);
+
+	if (old)
+		share_enum_put(old);
+	return rsp;
+}
+
+/* drop what a queued reply holds */
+static void rpc_rsp_free(struct cifsd_rpc_rsp *rsp)
+{
+	if (rsp->rsp_cache)
+		share_enum_put(rsp->rsp_cache);
+	else
+		free(rsp->buf);
+	memset(rsp, 0, sizeof(*rsp));
+}
+
+/* oldest reply of a pipe, NULL if none is queued */
+static struct cifsd_rpc_rsp *rpc_rsp_head(struct cifsd_pipe *pipe)
+{
+	if (!pipe->nr_rsp)
+		return NULL;
+	return &pipe->rsp[pipe->rsp_head];
+}
+
+/* slot the next reply is queued in, valid while the queue is not full */
+static struct cifsd_rpc_rsp *rpc_rsp_tail(struct cifsd_pipe *pipe)
+{
+	return &pipe->rsp[(pipe->rsp_head + pipe->nr_rsp) % CIFSD_PIPE_RSP_MAX];
 }
 
 /**
- * process_rpc_rsp() - create RPC response buffer
- * @server:     TCP server instance of connection
- * @data_buf:	RPC response out buffer
- * @size:	response buffer size
+ * rpc_rsp_queue() - reserve the slot of a reply
+ * @pipe:	pipe the request came in on
+ * @call_id:	call the reply answers
+ *
+ * The slot is filled in by the caller and only queued by
+ * rpc_rsp_commit().
  *
- * Return:      response length on success, otherwise error number
+ * Return:	empty slot, or ERR_PTR on error
  */
-int process_rpc_rsp(struct cifsd_pipe *pipe, char *data_buf, int size)
+static struct cifsd_rpc_rsp *rpc_rsp_queue(struct cifsd_pipe *pipe,
+		__u32 call_id)
 {
-	int nbytes = 0;
+	struct cifsd_rpc_rsp *rsp;
+	int i;
 
-	cifsd_debug("pipe %p, pipe->pkt_type = %d, pipe->pipe_type %d\n",
-			pipe, pipe->pkt_type, pipe->pipe_type);
-	switch (pipe->pkt_type) {
-	case RPC_REQUEST:
-		switch (pipe->pipe_type) {
-		case SRVSVC:
-			nbytes = rpc_read_srvsvc_data(pipe, data_buf, size);
-			break;
-		case WINREG:
-			nbytes = rpc_read_winreg_data(pipe, data_buf, size);
-			break;
-		default:
-			cifsd_debug("rpc pipe = %d Not Implemented\n",
-				pipe->pipe_type);
-			return -EINVAL;
+	if (pipe->nr_rsp == CIFSD_PIPE_RSP_MAX) {
+		cifsd_debug("%d replies not read, call %u refused\n",
+				pipe->nr_rsp, call_id);
+		return ERR_PTR(-EBUSY);
+	}
+
+	for (i = 0; i < pipe->nr_rsp; i++) {
+		rsp = &pipe->rsp[(pipe->rsp_head + i) % CIFSD_PIPE_RSP_MAX];
+		if (rsp->call_id == call_id) {
+			cifsd_debug("call %u is already pending\n", call_id);
+			return ERR_PTR(-EINVAL);
 		}
-		break;
-	case RPC_BIND:
-		nbytes = rpc_read_bind_data(pipe, data_buf);
-		break;
-	default:
-		cifsd_debug("rpc type = %d Not Implemented\n",
-					pipe->pkt_type);
-		return -EINVAL;
 	}
 
-	return nbytes;
+	rsp = rpc_rsp_tail(pipe);
+	memset(rsp, 0, sizeof(*rsp));
+	rsp->call_id = call_id;
+	return rsp;
 }
 
-
-
-int rpc_read_winreg_data(struct cifsd_pipe *pipe, char *outdata, int buf_len)
+/* make a reply filled in since rpc_rsp_queue() visible to reads */
+static void rpc_rsp_commit(struct cifsd_pipe *pipe)
 {
-	RPC_REQUEST_RSP *rpc_request_rsp = (RPC_REQUEST_RSP *)outdata;
-	int offset = 0;
-
-	if (pipe->opnum == WINREG_OPENHKCR ||
-			pipe->opnum == WINREG_OPENHKCU ||
-			pipe->opnum == WINREG_OPENHKLM ||
-			pipe->opnum == WINREG_OPENHKU ||
-			pipe->opnum == WINREG_OPENKEY ||
-			pipe->opnum == WINREG_CLOSEKEY) {
-
-		OPENHKEY_RSP *winreg_rsp;
-
-		winreg_rsp = (OPENHKEY_RSP *)pipe->data;
-		memcpy(outdata + offset, &winreg_rsp->rpc_request_rsp,
-						sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
-		memcpy(outdata + offset, &winreg_rsp->key_handle,
-						sizeof(KEY_HANDLE));
-		offset += sizeof(KEY_HANDLE);
-		memcpy(outdata + offset, &winreg_rsp->werror, sizeof(__u32));
-		offset += sizeof(__u32);
-		free(winreg_rsp);
-	}
-
-	if (pipe->opnum == WINREG_GETVERSION) {
-		GET_VERSION_RSP *winreg_rsp;
+	pipe->nr_rsp++;
+}
 
-		winreg_rsp = (GET_VERSION_RSP *)pipe->data;
+/* done with the oldest reply */
+static void rpc_rsp_pop(struct cifsd_pipe *pipe)
+{
+	rpc_rsp_free(&pipe->rsp[pipe->rsp_head]);
+	pipe->rsp_head = (pipe->rsp_head + 1) % CIFSD_PIPE_RSP_MAX;
+	pipe->nr_rsp--;
+}
 
-		memcpy(outdata + offset, &winreg_rsp->rpc_request_rsp,
-						sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
+/**
+ * dcerpc_pipe_release() - drop the replies queued on a pipe
+ * @pipe:	pipe being closed or bound anew
+ */
+void dcerpc_pipe_release(struct cifsd_pipe *pipe)
+{
+	while (pipe->nr_rsp)
+		rpc_rsp_pop(pipe);
+	pipe->rsp_head = 0;
+	pipe->bind_rsp = 0;
+}
 
-		memcpy(outdata + offset, &winreg_rsp->version, sizeof(__u32));
-		offset += sizeof(__u32);
-		memcpy(outdata + offset, &winreg_rsp->werror, sizeof(__u32));
-		offset += sizeof(__u32);
-		free(winreg_rsp);
-	}
+/**
+ * dcerpc_reasm_release() - drop the request fragments of a pipe
+ * @pipe:	pipe the fragments came in on
+ */
+static void dcerpc_reasm_release(struct cifsd_pipe *pipe)
+{
+	if (!pipe->reasm)
+		return;
+
+	if (pipe->reasm_size == CIFSD_REASM_BUF_SIZE)
+		cifsd_pool_free(CIFSD_POOL_REASM, pipe->reasm);
+	else
+		free(pipe->reasm);
+	if (pipe->client)
+		pipe->client->reasm_bytes -= pipe->reasm_size;
+	pipe->reasm = NULL;
+	pipe->reasm_len = 0;
+	pipe->reasm_size = 0;
+}
 
-	if (pipe->opnum == WINREG_DELETEKEY ||
-			pipe->opnum == WINREG_FLUSHKEY ||
-			pipe->opnum == WINREG_SETVALUE ||
-			pipe->opnum == WINREG_NOTIFYCHANGEKEYVALUE ||
-			pipe->opnum == WINREG_DELETEVALUE) {
-		WINREG_COMMON_RSP *winreg_rsp;
-
-		winreg_rsp = (WINREG_COMMON_RSP *)pipe->data;
-		memcpy(outdata + offset, &winreg_rsp->rpc_request_rsp,
-						sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
-		memcpy(outdata + offset, &winreg_rsp->werror, sizeof(__u32));
-		offset += sizeof(__u32);
-		free(winreg_rsp);
-	}
+/**
+ * rpc_assoc_join() - put a pipe in an association group of its client
+ * @pipe:	pipe being bound, in no group
+ * @id:		group named by the bind request, 0 to start a new one
+ *
+ * All pipes of a client are handled by the same worker, so the group
+ * table of the client needs no locking.
+ *
+ * Return:	0 on success, -ENOENT if the client has no group @id
+ */
+static int rpc_assoc_join(struct cifsd_pipe *pipe, __u32 id)
+{
+	struct cifsd_client_info *client = pipe->client;
+	struct cifsd_assoc_group *grp, *slot = NULL;
+	int i;
 
-	if (pipe->opnum == WINREG_CREATEKEY) {
-		CREATE_KEY_RSP *winreg_rsp;
-
-		winreg_rsp = (CREATE_KEY_RSP *)pipe->data;
-		memcpy(outdata + offset, &winreg_rsp->rpc_request_rsp,
-						sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
-		memcpy(outdata + offset, &winreg_rsp->key_handle,
-						sizeof(KEY_HANDLE));
-		offset += sizeof(KEY_HANDLE);
-		memcpy(outdata + offset, &winreg_rsp->ref_id, sizeof(__u32));
-		offset += sizeof(__u32);
-		memcpy(outdata + offset, &winreg_rsp->action_taken,
-								sizeof(__u32));
-		offset += sizeof(__u32);
-		memcpy(outdata + offset, &winreg_rsp->werror, sizeof(__u32));
-		offset += sizeof(__u32);
-		free(winreg_rsp);
-	}
+	if (!client)
+		return -ENOENT;
 
-	if (pipe->opnum == WINREG_ENUMKEY) {
-		ENUM_KEY_RSP *winreg_rsp;
-
-		winreg_rsp = (ENUM_KEY_RSP *)pipe->data;
-		memcpy(outdata + offset, &winreg_rsp->rpc_request_rsp,
-						sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
-		memcpy(outdata + offset, &winreg_rsp->key_name,
-						sizeof(CLASSNAME_INFO));
-		offset += sizeof(CLASSNAME_INFO);
-		memcpy(outdata + offset, &winreg_rsp->key_class_ref_id,
-							sizeof(__u32));
-		offset += sizeof(__u32);
-		memcpy(outdata + offset, &winreg_rsp->key_class,
-						sizeof(NAME_INFO));
-		offset += sizeof(NAME_INFO);
-		memcpy(outdata + offset, &winreg_rsp->last_changed_time_ref_id,
-								sizeof(__u32));
-		offset += sizeof(__u32);
-		memcpy(outdata + offset, &winreg_rsp->last_changed_time,
-						sizeof(__u64));
-		offset += sizeof(__u64);
-		memcpy(outdata + offset, &winreg_rsp->werror, sizeof(__u32));
-		offset += sizeof(__u32);
-		free(winreg_rsp);
+	for (i = 0; i < CIFSD_ASSOC_GROUPS; i++) {
+		grp = &client->assoc_groups[i];
+		if (id && grp->id == id)
+			break;
+		if (!grp->id && !slot)
+			slot = grp;
 	}
 
-	if (pipe->opnum == WINREG_ENUMVALUE) {
-		ENUM_VALUE_RSP *winreg_rsp;
-
-		winreg_rsp = (ENUM_VALUE_RSP *)pipe->data;
-		memcpy(outdata + offset, &winreg_rsp->rpc_request_rsp,
-						sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
-		memcpy(outdata + offset, &winreg_rsp->name_len, sizeof(__u16));
-		offset += sizeof(__u16);
-		memcpy(outdata + offset, &winreg_rsp->name_size,
-								sizeof(__u16));
-		offset += sizeof(__u16);
-		memcpy(outdata + offset, &winreg_rsp->name_ref_id,
-								sizeof(__u32));
-		offset += sizeof(__u32);
-		memcpy(outdata + offset, &winreg_rsp->name_str_info,
-							sizeof(UNISTR_INFO));
-		offset += sizeof(UNISTR_INFO);
-		memcpy(outdata + offset, &winreg_rsp->type_info,
-							sizeof(DATA_INFO));
-		offset += sizeof(DATA_INFO);
-		memcpy(outdata + offset, &winreg_rsp->value_ptr,
-								sizeof(__u32));
-		offset += sizeof(__u32);
-		memcpy(outdata + offset, &winreg_rsp->size_info,
-							sizeof(DATA_INFO));
-		offset += sizeof(DATA_INFO);
-		memcpy(outdata + offset, &winreg_rsp->length_info,
-							sizeof(DATA_INFO));
-		offset += sizeof(DATA_INFO);
-		memcpy(outdata + offset, &winreg_rsp->werror,
-							sizeof(__u32));
-		offset += sizeof(__u32);
-		free(winreg_rsp);
+	if (i == CIFSD_ASSOC_GROUPS) {
+		if (id) {
+			cifsd_debug("unknown association group 0x%x\n", id);
+			return -ENOENT;
+		}
+		/* one slot per pipe, a pipe outside any group finds one */
+		if (!slot)
+			return -ENOSPC;
+		do {
+			id = __atomic_add_fetch(&assoc_gid_last, 1,
+					__ATOMIC_RELAXED);
+		} while (!id);
+		grp = slot;
+		grp->id = id;
 	}
 
-	if (pipe->opnum == WINREG_QUERYINFOKEY) {
-		QUERY_INFO_KEY_RSP *winreg_rsp;
-
-		winreg_rsp = (QUERY_INFO_KEY_RSP *)pipe->data;
-		memcpy(outdata + offset, &winreg_rsp->rpc_request_rsp,
-						sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
-		memcpy(outdata + offset, &winreg_rsp->class_info,
-						sizeof(CLASSNAME_INFO));
-		offset += sizeof(CLASSNAME_INFO);
-		memcpy(outdata + offset, &winreg_rsp->key_info,
-							sizeof(KEY_INFO));
-		offset += sizeof(KEY_INFO);
-		memcpy(outdata + offset, &winreg_rsp->werror, sizeof(__u32));
-		offset += sizeof(__u32);
-		free(winreg_rsp);
-	}
+	grp->refcount++;
+	pipe->assoc_gid = id;
+	return 0;
+}
 
-	if (pipe->opnum == WINREG_QUERYVALUE) {
-		QUERY_VALUE_RSP *winreg_rsp;
+/**
+ * rpc_assoc_leave() - take a pipe out of its association group
+ * @pipe:	pipe being rebound or closed
+ *
+ * The group is gone once its last pipe left.
+ */
+static void rpc_assoc_leave(struct cifsd_pipe *pipe)
+{
+	struct cifsd_assoc_group *grp;
+	int i;
 
-		winreg_rsp = (QUERY_VALUE_RSP *)pipe->data;
-		memcpy(outdata + offset, &winreg_rsp->rpc_request_rsp,
-					sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
+	if (!pipe->assoc_gid)
+		return;
 
-		if (winreg_rsp->query_val_info == NULL) {
-			memset(outdata + offset, 0, (sizeof(__u32)*4));
-			offset += (sizeof(__u32)*4);
-		} else {
-			memcpy(outdata + offset,
-				&winreg_rsp->query_val_info->type_info,
-				sizeof(DATA_INFO));
-			offset += sizeof(DATA_INFO);
-			memcpy(outdata + offset,
-				&winreg_rsp->query_val_info->data_ref_id,
-				sizeof(__u32));
-			offset += sizeof(__u32);
-			memcpy(outdata + offset,
-				&winreg_rsp->query_val_info->data_info,
-				sizeof(UNISTR_INFO));
-			offset += sizeof(UNISTR_INFO);
-			if (winreg_rsp->query_val_info->size_info.info <
-								sizeof(__u32)) {
-				memcpy(outdata + offset,
-					winreg_rsp->query_val_info->Buffer,
-					sizeof(__u32));
-				offset += sizeof(__u32);
-			} else if ((winreg_rsp->query_val_info->size_info.info
-								%2) == 1) {
-				memcpy(outdata + offset,
-				winreg_rsp->query_val_info->Buffer,
-				(winreg_rsp->query_val_info->size_info.info+1));
-				offset +=
-				(winreg_rsp->query_val_info->size_info.info+1);
-			} else {
-				memcpy(outdata + offset,
-				winreg_rsp->query_val_info->Buffer,
-				winreg_rsp->query_val_info->size_info.info);
-				offset +=
-				winreg_rsp->query_val_info->size_info.info;
-			}
-			memcpy(outdata + offset,
-				&winreg_rsp->query_val_info->size_info,
-				sizeof(DATA_INFO));
-			offset += sizeof(DATA_INFO);
-			memcpy(outdata + offset,
-				&winreg_rsp->query_val_info->length_info,
-				sizeof(DATA_INFO));
-			offset += sizeof(DATA_INFO);
-			free(winreg_rsp->query_val_info->Buffer);
-			free(winreg_rsp->query_val_info);
+	for (i = 0; i < CIFSD_ASSOC_GROUPS; i++) {
+		grp = &pipe->client->assoc_groups[i];
+		if (grp->id == pipe->assoc_gid) {
+			if (!--grp->refcount)
+				grp->id = 0;
+			break;
 		}
-
-		memcpy(outdata + offset, &winreg_rsp->werror, sizeof(__u32));
-		offset += sizeof(__u32);
-		free(winreg_rsp);
 	}
+	pipe->assoc_gid = 0;
+}
 
-	rpc_request_rsp->hdr.frag_len = offset;
-	rpc_request_rsp->alloc_hint = offset - sizeof(RPC_REQUEST_RSP);
-
-	cifsd_debug("offset = %d size of RPC_REQUEST_RSP = %d\n",
-	offset, sizeof(RPC_REQUEST_RSP));
-	cifsd_debug("frag len = %d alloc_hint = %d\n",
-	rpc_request_rsp->hdr.frag_len, rpc_request_rsp->alloc_hint);
-
-	return offset;
+/**
+ * dcerpc_pipe_close() - release everything a pipe holds
+ * @pipe:	pipe being freed
+ */
+void dcerpc_pipe_close(struct cifsd_pipe *pipe)
+{
+	dcerpc_pipe_release(pipe);
+	dcerpc_reasm_release(pipe);
+	rpc_assoc_leave(pipe);
+	pipe->nr_contexts = 0;
 }
 
 /**
- * rpc_read_bind_data() - create RPC response buffer for RPC_BIND request
- * @server:     TCP server instance of connection
- * @out_data:	RPC response out buffer
+ * rpc_reasm_grow() - make room in the reassembly buffer of a pipe
+ * @pipe:	pipe receiving a fragmented request
+ * @size:	bytes the buffer must hold
+ *
+ * Buffers start out pooled and at least double when they grow, within
+ * what the client may still hold.
  *
- * Return:      response length on success, otherwise error number
+ * Return:	0 on success, -ENOSPC over the client limit, -ENOMEM
  */
-int rpc_read_bind_data(struct cifsd_pipe *pipe, char *out_data)
+static int rpc_reasm_grow(struct cifsd_pipe *pipe, int size)
 {
-	RPC_HDR *hdr = (RPC_HDR *)out_data;
-	int offset = 0;
-	int pipe_type = pipe->pipe_type;
-	RPC_BIND_RSP *rpc_bind_rsp;
+	struct cifsd_client_info *client = pipe->client;
+	int room = CIFSD_REASM_CLIENT_MAX;
+	char *buf;
 
-	rpc_bind_rsp = (RPC_BIND_RSP *)pipe->data;
+	if (size <= pipe->reasm_size)
+		return 0;
 
-	memcpy(out_data, &rpc_bind_rsp->hdr, sizeof(RPC_HDR));
-	offset += sizeof(RPC_HDR);
+	if (client)
+		room -= client->reasm_bytes - pipe->reasm_size;
+	if (size > room) {
+		cifsd_err("request of %d bytes is over the reassembly limit\n",
+				size);
+		return -ENOSPC;
+	}
 
-	memcpy(out_data + offset, &rpc_bind_rsp->bind_info,
-	       sizeof(BIND_ACK_INFO));
-	offset += sizeof(BIND_ACK_INFO);
+	if (size < 2 * pipe->reasm_size)
+		size = 2 * pipe->reasm_size;
+	if (size > room)
+		size = room;
 
-	memcpy(out_data + offset, &rpc_bind_rsp->addr.sec_addr_len,
-	       sizeof(__u16));
-	offset += sizeof(__u16);
+	/* a pooled buffer only if it stays within the limit */
+	if (size <= CIFSD_REASM_BUF_SIZE && room >= CIFSD_REASM_BUF_SIZE) {
+		size = CIFSD_REASM_BUF_SIZE;
+		buf = cifsd_pool_alloc(CIFSD_POOL_REASM);
+	} else {
+		buf = malloc(size);
+	}
+	if (!buf)
+		return -ENOMEM;
 
-	memcpy(out_data + offset, rpc_bind_rsp->addr.sec_addr,
-		rpc_bind_rsp->addr.sec_addr_len);
-	offset += rpc_bind_rsp->addr.sec_addr_len;
-	offset += (((offset + 3) & ~3) - offset);
+	if (pipe->reasm_len)
+		memcpy(buf, pipe->reasm, pipe->reasm_len);
+	if (pipe->reasm_size == CIFSD_REASM_BUF_SIZE)
+		cifsd_pool_free(CIFSD_POOL_REASM, pipe->reasm);
+	else
+		free(pipe->reasm);
+	if (client)
+		client->reasm_bytes += size - pipe->reasm_size;
+	pipe->reasm = buf;
+	pipe->reasm_size = size;
+	return 0;
+}
 
-	memcpy(out_data + offset, &rpc_bind_rsp->results, sizeof(RPC_RESULTS));
-	offset += sizeof(RPC_RESULTS);
+/**
+ * rpc_request_frag() - take in one fragment of a request
+ * @pipe:	pipe the fragment came in on
+ * @data:	fragment
+ * @len:	fragment length
+ *
+ * A request in a single fragment runs straight from @data. Otherwise the
+ * header of the first fragment and the stub of every fragment are copied
+ * once, back to back, into the reassembly buffer of the pipe. The request
+ * runs when its last fragment arrived.
+ *
+ * Return:	0 on success, error number on error
+ */
+static int rpc_request_frag(struct cifsd_pipe *pipe, char *data, int len)
+{
+	RPC_REQUEST_REQ *req = (RPC_REQUEST_REQ *)data, *first;
+	int hdr_len = sizeof(RPC_REQUEST_REQ);
+	int ret;
 
-	memcpy(out_data + offset, rpc_bind_rsp->transfer, sizeof(RPC_IFACE));
-	offset += sizeof(RPC_IFACE);
+	if (len < hdr_len)
+		return -EINVAL;
 
-	if (pipe_type == WINREG) {
-		memcpy(out_data + offset, &rpc_bind_rsp->auth,
-							sizeof(RPC_AUTH_INFO));
-		offset += sizeof(RPC_AUTH_INFO);
+	if (req->hdr.flags & RPC_FLAG_FIRST) {
+		/* a request still missing fragments is abandoned */
+		dcerpc_reasm_release(pipe);
+		if (req->hdr.flags & RPC_FLAG_LAST)
+			return rpc_request(pipe, data, len);
+
+		/* size the buffer after the hint unless it is implausible */
+		ret = len;
+		if (req->alloc_hint < CIFSD_REASM_CLIENT_MAX &&
+				hdr_len + req->alloc_hint > len)
+			ret = hdr_len + req->alloc_hint;
+		ret = rpc_reasm_grow(pipe, ret);
+		if (ret)
+			return ret;
+
+		memcpy(pipe->reasm, data, len);
+		pipe->reasm_len = len;
+		return 0;
+	}
 
-		memcpy(out_data + offset, rpc_bind_rsp->Buffer,
-						rpc_bind_rsp->BufferLength);
-		offset += rpc_bind_rsp->BufferLength;
+	first = (RPC_REQUEST_REQ *)pipe->reasm;
+	if (!first || first->hdr.call_id != req->hdr.call_id) {
+		cifsd_debug("fragment of call %u without its first one\n",
+				req->hdr.call_id);
+		dcerpc_reasm_release(pipe);
+		return -EINVAL;
+	}
 
-		free(rpc_bind_rsp->Buffer);
+	ret = rpc_reasm_grow(pipe, pipe->reasm_len + len - hdr_len);
+	if (ret) {
+		dcerpc_reasm_release(pipe);
+		return ret;
 	}
 
-	hdr->frag_len = offset;
-	hdr->auth_len = rpc_bind_rsp->BufferLength;
-	free(rpc_bind_rsp->addr.sec_addr);
-	free(rpc_bind_rsp->transfer);
-	free(rpc_bind_rsp);
+	memcpy(pipe->reasm + pipe->reasm_len, data + hdr_len, len - hdr_len);
+	pipe->reasm_len += len - hdr_len;
+	if (!(req->hdr.flags & RPC_FLAG_LAST))
+		return 0;
 
-	return offset;
+	ret = rpc_request(pipe, pipe->reasm, pipe->reasm_len);
+	dcerpc_reasm_release(pipe);
+	return ret;
 }
 
 /**
- * rpc_read_srvsvc_data() - create RPC response buffer for RPC_REQUEST
+ * process_rpc() - process a RPC request
  * @server:     TCP server instance of connection
- * @out_data:	RPC response out buffer
- * @buf_len:	RPC response buffer length
+ * @data:	RPC request packet - data
+ * @len:	bytes in @data, the event buflen that request_handler() has
+ *		checked against the length of the received message
+ *
+ * @data may hold several fragments back to back, each is handled in
+ * turn. A fragment cut short or trailing bytes fail the rest of @data.
  *
- * Return:      response length on success, otherwise error number
+ * Return:      0 on success, error number on error
  */
-int rpc_read_srvsvc_data(struct cifsd_pipe *pipe, char *outdata, int buf_len)
+int process_rpc(struct cifsd_pipe *pipe, char *data, int len)
 {
-	RPC_REQUEST_RSP *rpc_request_rsp = (RPC_REQUEST_RSP *)outdata;
-	int offset = 0, string_len = 0;
-	int i = 0, resume_handle = 0, data_sent = 0, datasize = 0;
-	SRVSVC_SHARE_INFO_CTR *sharectr;
-	SRVSVC_SHARE_GETINFO *shareinfo;
-	WKSSVC_SHARE_GETINFO *wkssvc_info;
-	char *buf = NULL;
-
-
-	sharectr = (SRVSVC_SHARE_INFO_CTR *)pipe->data;
-	memcpy(outdata, &sharectr->rpc_request_rsp, sizeof(RPC_REQUEST_RSP));
-	offset += sizeof(RPC_REQUEST_RSP);
-
-
-	if (pipe->opnum == SRV_NET_SHARE_GETINFO) {
-		shareinfo = (SRVSVC_SHARE_GETINFO *)pipe->data;
-
-		memcpy(outdata + offset, &shareinfo->info_level,
-				sizeof(shareinfo->info_level));
-		offset += sizeof(shareinfo->info_level);
-		memcpy(outdata + offset, &shareinfo->switch_value,
-				sizeof(shareinfo->switch_value));
-		offset += sizeof(shareinfo->switch_value);
-		if (shareinfo->status == WERR_INVALID_NAME)
-			goto out;
-		memcpy(outdata + offset, shareinfo->ptrs,
-				sizeof(PTR_INFO1));
-		offset += sizeof(PTR_INFO1);
-
-		for (i = 0; i < 1; i++) {
-			memcpy(outdata + offset,
-			&shareinfo->shares[i].str_info1, sizeof(UNISTR_INFO));
-			offset += sizeof(UNISTR_INFO);
-
-			string_len =
-				shareinfo->shares[i].str_info1.actual_count * 2;
+	RPC_HDR *rpc_hdr;
+	int frag_len;
+	int ret = 0;
 
-			memcpy(outdata + offset, shareinfo->shares[i].sharename,
-					string_len);
-			offset += ((string_len + 3) & ~3);
+	if (len < sizeof(RPC_HDR))
+		return -EINVAL;
 
-			memcpy(outdata + offset,
-			       &shareinfo->shares[i].str_info2,
-			       sizeof(UNISTR_INFO));
-			offset += sizeof(UNISTR_INFO);
+	do {
+		rpc_hdr = (RPC_HDR *)data;
+		frag_len = rpc_hdr->frag_len;
+		if (frag_len < sizeof(RPC_HDR) || frag_len > len)
+			return -EINVAL;
 
-			string_len =
-				shareinfo->shares[i].str_info2.actual_count * 2;
+		cifsd_debug("DCERPC pktype = %u\n", rpc_hdr->pkt_type);
 
-			memcpy(outdata + offset, shareinfo->shares[i].comment,
-					string_len);
-			offset += ((string_len + 3) & ~3);
+		switch (rpc_hdr->pkt_type) {
+		case RPC_REQUEST:
+			cifsd_debug("GOT RPC_REQUEST\n");
+			ret = rpc_request_frag(pipe, data, frag_len);
+			break;
+		case RPC_BIND:
+		case RPC_ALTCONT:
+			cifsd_debug("GOT RPC_BIND\n");
+			dcerpc_reasm_release(pipe);
+			ret = rpc_bind(pipe, data, frag_len);
+			break;
+		default:
+			cifsd_debug("rpc type = %d Not Implemented\n",
+					rpc_hdr->pkt_type);
+			ret = -EOPNOTSUPP;
 		}
-out:
-		memcpy(outdata + offset, &shareinfo->status,
-				sizeof(shareinfo->status));
-		offset += sizeof(shareinfo->status);
+		if (ret)
+			return ret;
 
-		rpc_request_rsp->hdr.frag_len = offset;
-		rpc_request_rsp->alloc_hint = offset - sizeof(RPC_REQUEST_RSP);
+		data += frag_len;
+		len -= frag_len;
+	} while (len >= sizeof(RPC_HDR));
 
-		cifsd_debug("frag len = %d alloc_hint = %d\n",
-			       rpc_request_rsp->hdr.frag_len,
-			       rpc_request_rsp->alloc_hint);
-
-		free(shareinfo->shares);
-		free(shareinfo->ptrs);
-		free(shareinfo);
+	if (len) {
+		cifsd_debug("%d bytes after the last fragment\n", len);
+		return -EINVAL;
 	}
+	return 0;
+}
 
-	if (pipe->opnum == SRV_NET_SHARE_ENUM_ALL) {
-		sharectr = (SRVSVC_SHARE_INFO_CTR *)pipe->data;
-		buf = pipe->buf;
-		data_sent = pipe->sent;
-		datasize = pipe->datasize;
-		resume_handle = sharectr->resume_handle;
-
-		cifsd_debug("num entries = %d\n", sharectr->info.num_entries);
-		if (resume_handle) {
-			memcpy(outdata, pipe->buf + data_sent, resume_handle);
-			datasize = resume_handle;
-			goto finish;
-		}
+/**
+ * process_rpc_rsp() - create RPC response buffer
+ * @server:     TCP server instance of connection
+ * @data_buf:	RPC response out buffer
+ * @size:	response buffer size
+ *
+ * Replies are handed out in the order their requests were written.
+ *
+ * Return:      response length, 0 if none is pending, otherwise error
+ */
+int process_rpc_rsp(struct cifsd_pipe *pipe, char *data_buf, int size)
+{
+	struct cifsd_rpc_rsp *rsp = rpc_rsp_head(pipe);
+	int nbytes = 0;
 
-		if (datasize > buf_len) {
-			memcpy(outdata, buf, buf_len);
-			resume_handle = datasize - buf_len;
-			pipe->sent = buf_len;
-			sharectr->resume_handle = resume_handle;
-		} else {
-			memcpy(outdata, buf, datasize);
-		}
+	if (!rsp)
+		return 0;
 
-		rpc_request_rsp->hdr.frag_len = datasize;
-		rpc_request_rsp->alloc_hint = datasize -
-					sizeof(RPC_REQUEST_RSP);
-		cifsd_debug("frag len = %d alloc_hint = %d\n",
-				       rpc_request_rsp->hdr.frag_len,
-				       rpc_request_rsp->alloc_hint);
-		if (resume_handle) {
-			pipe->sent = buf_len;
-			cifsd_debug("Pipe data is outstanding, "
-			"sent %d, remaining %d\n", buf_len, datasize - buf_len);
-			return datasize;
+	cifsd_debug("pipe %p, call %u, pkt_type = %d, pipe_type %d\n",
+			pipe, rsp->call_id, rsp->pkt_type, pipe->pipe_type);
+	switch (rsp->pkt_type) {
+	case RPC_RESPONSE:
+		switch (pipe->pipe_type) {
+		case SRVSVC:
+		case WINREG:
+			nbytes = rpc_read_srvsvc_data(pipe, data_buf, size);
+			break;
+		default:
+			cifsd_debug("rpc pipe = %d Not Implemented\n",
+				pipe->pipe_type);
+			return -EINVAL;
 		}
-finish:
-		free(sharectr->shares);
-		free(sharectr->ptrs);
-		free(sharectr);
-		free(pipe->buf);
-		pipe->buf = NULL;
-		pipe->sent = 0;
-		pipe->datasize = 0;
-		return datasize;
+		break;
+	case RPC_BINDACK:
+	case RPC_BINDNACK:
+	case RPC_ALTCONTRESP:
+		nbytes = rpc_read_bind_data(pipe, data_buf, size);
+		break;
+	default:
+		cifsd_debug("rpc type = %d Not Implemented\n",
+					rsp->pkt_type);
+		return -EINVAL;
 	}
 
-	if (pipe->opnum == 0) {
-		wkssvc_info = (WKSSVC_SHARE_GETINFO *)pipe->data;
-
-		memcpy(outdata + offset, &wkssvc_info->info_level,
-				sizeof(wkssvc_info->info_level));
-		offset += sizeof(wkssvc_info->info_level);
+	return nbytes;
+}
 
-		memcpy(outdata + offset, &wkssvc_info->platform_id,
-					sizeof(wkssvc_info->platform_id));
-		offset += sizeof(wkssvc_info->platform_id);
 
-		memcpy(outdata + offset, &wkssvc_info->refid,
-						sizeof(wkssvc_info->refid));
-		offset += sizeof(wkssvc_info->refid);
+/**
+ * rpc_bind_auth() - answer the NTLMSSP negotiate of a winreg bind
+ * @pipe:	pipe being bound
+ * @ndr:	writer of the bind ack, positioned after the results
+ *
+ * The challenge is built straight into the reply.
+ *
+ * Return:	auth_len of the ack, otherwise error
+ */
+static int rpc_bind_auth(struct cifsd_pipe *pipe, struct ndr *ndr)
+{
+	RPC_AUTH_INFO auth;
+	CHALLENGE_MESSAGE *chgblob;
+	__le16 name[8];
+	int name_len, size, blob_len;
+
+	memset(&auth, 0, sizeof(auth));
+	auth.auth_type = 10;
+	auth.auth_level = 6;
+	auth.auth_ctx_id = 1;
+	ndr_write_bytes(ndr, &auth, sizeof(auth));
+
+	name_len = smbConvertToUTF16(name, netbios_name, strlen(netbios_name),
+			8, pipe->codepage);
+	size = sizeof(CHALLENGE_MESSAGE) + sizeof(TargetInfo) * 5 +
+		UNICODE_LEN(name_len) * 4;
+	if (ndr->error || ndr->offset + size > ndr->size)
+		return ndr_set_error(ndr, -ENOSPC);
+
+	chgblob = (CHALLENGE_MESSAGE *)(ndr->data + ndr->offset);
+	memset(chgblob, 0, size);
+	blob_len = build_ntlmssp_challenge_blob(chgblob, pipe->codepage);
+	ndr->offset += blob_len;
+	return blob_len;
+}
 
-		memcpy(outdata + offset, &wkssvc_info->ref_id1,
-						sizeof(wkssvc_info->ref_id1));
-		offset += sizeof(wkssvc_info->ref_id1);
+/**
+ * rpc_read_bind_data() - hand out the reply to a bind or alter_context
+ * @pipe:	pipe holding the reply
+ * @out_data:	RPC response out buffer
+ * @buf_len:	response buffer size
+ *
+ * Return:      reply length, 0 if no reply is pending, otherwise error
+ */
+int rpc_read_bind_data(struct cifsd_pipe *pipe, char *out_data, int buf_len)
+{
+	struct cifsd_rpc_rsp *rsp = rpc_rsp_head(pipe);
+	RPC_HDR *hdr = (RPC_HDR *)out_data;
+	BIND_ACK_INFO *info = (BIND_ACK_INFO *)(hdr + 1);
+	const struct rpc_bind_tmpl *tmpl;
+	RPC_RESULT res;
+	struct ndr ndr;
+	int auth_len = 0;
+	int i;
 
-		memcpy(outdata + offset, &wkssvc_info->ref_id2,
-						sizeof(wkssvc_info->ref_id2));
-		offset += sizeof(wkssvc_info->ref_id2);
+	if (!pipe->bind_rsp)
+		return 0;
 
-		memcpy(outdata + offset, &wkssvc_info->maj,
-						sizeof(wkssvc_info->maj));
-		offset += sizeof(wkssvc_info->maj);
+	if (pipe->bind_rsp == RPC_BINDNACK)
+		tmpl = &bind_nak_tmpl;
+	else if (pipe->bind_rsp == RPC_ALTCONTRESP || pipe->bind_iface < 0)
+		tmpl = &bind_ack_tmpl[NR_DCERPC_IFACES];
+	else
+		tmpl = &bind_ack_tmpl[pipe->bind_iface];
+
+	ndr_init(&ndr, out_data, buf_len);
+	ndr_write_bytes(&ndr, tmpl->data, tmpl->len);
+	if (pipe->bind_rsp != RPC_BINDNACK) {
+		ndr_write_int8(&ndr, pipe->nr_results);
+		ndr_write_int8(&ndr, 0);
+		ndr_write_int16(&ndr, 0);
+		for (i = 0; i < pipe->nr_results; i++) {
+			if (pipe->results[i] == RPC_REASON_NONE) {
+				ndr_write_bytes(&ndr, &rpc_result_accept,
+						sizeof(RPC_RESULT));
+				continue;
+			}
+			memset(&res, 0, sizeof(res));
+			res.result = RPC_RESULT_PROVIDER_REJECT;
+			res.reason = pipe->results[i];
+			ndr_write_bytes(&ndr, &res, sizeof(res));
+		}
+		if (pipe->bind_auth)
+			auth_len = rpc_bind_auth(pipe, &ndr);
+	}
+	if (ndr.error) {
+		cifsd_err("read of %d bytes can't hold the bind reply\n",
+				buf_len);
+		return ndr.error;
+	}
 
-		memcpy(outdata + offset, &wkssvc_info->min,
-						sizeof(wkssvc_info->min));
-		offset += sizeof(wkssvc_info->min);
+	hdr->pkt_type = pipe->bind_rsp;
+	hdr->frag_len = ndr.offset;
+	hdr->auth_len = auth_len;
+	hdr->call_id = rsp->call_id;
+	if (pipe->bind_rsp != RPC_BINDNACK) {
+		info->max_tsize = pipe->max_frag;
+		info->max_rsize = pipe->max_recv;
+		info->assoc_gid = pipe->assoc_gid;
+	}
+	pipe->bind_rsp = 0;
+	rpc_rsp_pop(pipe);
+	return ndr.offset;
+}
 
-		for (i = 0; i < 1; i++) {
-			memcpy(outdata + offset,
-			&wkssvc_info->shares[i].str_info1, sizeof(UNISTR_INFO));
-			offset += sizeof(UNISTR_INFO);
+/**
+ * rpc_read_srvsvc_data() - hand out the next fragment of a marshalled reply
+ * @pipe:	pipe holding the reply
+ * @outdata:	RPC response out buffer
+ * @buf_len:	response buffer size
+ *
+ * The reply is marshalled as a single PDU. It is cut into fragments of
+ * the size negotiated at bind time, or of @buf_len if that is smaller,
+ * and every read returns the next one with its own response header.
+ * Fragments other than the last carry a multiple of 8 stub bytes.
+ *
+ * Return:      fragment length, 0 if no reply is pending, otherwise error
+ */
+int rpc_read_srvsvc_data(struct cifsd_pipe *pipe, char *outdata, int buf_len)
+{
+	struct cifsd_rpc_rsp *pending = rpc_rsp_head(pipe);
+	RPC_REQUEST_RSP *rsp = (RPC_REQUEST_RSP *)outdata;
+	int hdr_len = sizeof(RPC_REQUEST_RSP);
+	int frag_len, len, left;
+	int flags = 0;
 
-			string_len =
-			wkssvc_info->shares[i].str_info1.actual_count * 2;
+	if (!pending || !pending->buf)
+		return 0;
 
-			memcpy(outdata + offset,
-				wkssvc_info->shares[i].server_name, string_len);
-			offset += ((string_len + 3) & ~3);
+	frag_len = pipe->max_frag ? pipe->max_frag : RPC_MAX_FRAG_SIZE;
+	if (frag_len > buf_len)
+		frag_len = buf_len;
+	if (frag_len < hdr_len + 8) {
+		cifsd_err("read of %d bytes can't hold a fragment\n", buf_len);
+		return -EINVAL;
+	}
 
-			memcpy(outdata + offset,
-			&wkssvc_info->shares[i].str_info2, sizeof(UNISTR_INFO));
-			offset += sizeof(UNISTR_INFO);
+	left = pending->datasize - hdr_len - pending->sent;
+	len = frag_len - hdr_len;
+	if (left > len) {
+		len &= ~7;
+	} else {
+		len = left;
+		flags |= RPC_FLAG_LAST;
+	}
+	if (!pending->sent)
+		flags |= RPC_FLAG_FIRST;
+
+	/* cached replies are shared, their ids belong to this call */
+	memcpy(rsp, pending->buf, hdr_len);
+	rsp->hdr.flags = flags;
+	rsp->hdr.frag_len = hdr_len + len;
+	rsp->hdr.call_id = pending->call_id;
+	rsp->alloc_hint = left;
+	rsp->context_id = pending->context_id;
+	memcpy(outdata + hdr_len, pending->buf + hdr_len + pending->sent, len);
+	pending->sent += len;
+
+	if (flags & RPC_FLAG_LAST)
+		rpc_rsp_pop(pipe);
+	else
+		cifsd_debug("Pipe data is outstanding, sent %d, remaining %d\n",
+				pending->sent, left - len);
+	return hdr_len + len;
+}
 
-			string_len =
-			wkssvc_info->shares[i].str_info2.actual_count * 2;
+/**
+ * dcerpc_header_init() - initialize the header for rpc response
+ * @header: pointer to header in response packet
+ * @packet_type : DCE/RPC Packet type
+ * @flags : DCE/RPC flags
+ * @call_id: call_id from RPC request
+ *
+ */
+void dcerpc_header_init(RPC_HDR *header, int packet_type,
+				int flags, int call_id)
+{
+	header->major = RPC_MAJOR_VER;
+	header->minor = RPC_MINOR_VER;
+	header->pkt_type = packet_type;
+	header->flags = flags;
+	header->pack_type[0] = 0x10;
+	header->pack_type[1] = 0;
+	header->pack_type[2] = 0;
+	header->pack_type[3] = 0;
+	header->auth_len = 0;
+	header->call_id  = call_id;
+}
 
-			memcpy(outdata + offset,
-			wkssvc_info->shares[i].domain_name, string_len);
-			offset += ((string_len + 3) & ~3);
-		}
+static char *share_comment(struct cifsd_share *share)
+{
+	if (strcmp(share->sharename, STR_IPC) == 0)
+		return "IPC SHARE";
+	/* Windows expects a comment, fall back to the share name */
+	if (share->config.comment)
+		return share->config.comment;
+	return share->sharename;
+}
 
-		memcpy(outdata + offset, &wkssvc_info->status,
-				sizeof(wkssvc_info->status));
-		offset += sizeof(wkssvc_info->status);
+/* shares without a path, like IPC$, show up as the root directory */
+#define SHARE_PATH(share)	((share)->path ? (share)->path : "/")
 
-		rpc_request_rsp->hdr.frag_len = offset;
-		rpc_request_rsp->alloc_hint = offset - sizeof(RPC_REQUEST_RSP);
+/* local path in the form Windows clients display, "C:\dir\share" */
+static char *share_path(struct ndr *ndr, struct cifsd_share *share)
+{
+	char *path = SHARE_PATH(share);
+	char *p;
+	int i;
 
-		cifsd_debug("frag len = %d alloc_hint = %d\n",
-		rpc_request_rsp->hdr.frag_len, rpc_request_rsp->alloc_hint);
+	p = ndr_alloc(ndr, strlen(path) + 3);
+	if (!p)
+		return NULL;
 
-		free(wkssvc_info->shares);
-		free(wkssvc_info);
+	p[0] = 'C';
+	p[1] = ':';
+	for (i = 0; path[i]; i++)
+		p[i + 2] = path[i] == '/' ? '\\' : path[i];
+	return p;
+}
 
-	}
-	return offset;
+/* NDR bytes of a string, assuming one UTF-16 unit per byte of @len */
+static unsigned int unistr_size(size_t len)
+{
+	return 12 + (((len + 1) * 2 + 3) & ~3);
 }
 
 /**
- * pipe_data_size() - determine data size on pipe for share list enumeration
- * @server:     TCP server instance of connection
- * @data:	share control specific data
- * @num_shares:	number of shares points on given share control
+ * share_info_size() - bytes a share takes in a NetShareEnumAll reply
+ * @share:	share to list
+ * @level:	info level
+ *
+ * An upper bound for codepages encoding a character in at least one
+ * byte, which is all max_buffer accounting needs.
  *
- * Return:      data size used for share enumeration so far
+ * Return:	size of the entry on the wire
  */
-int pipe_data_size(struct cifsd_pipe *pipe, void *data, int num_shares)
+static unsigned int share_info_size(struct cifsd_share *share, __u32 level)
 {
-	int size = 0, i, string_len;
-	SRVSVC_SHARE_INFO_CTR *sharectr;
-
-	if (pipe->opnum == SRV_NET_SHARE_ENUM_ALL) {
-		sharectr = (SRVSVC_SHARE_INFO_CTR *)data;
-
-		size += sizeof(RPC_REQUEST_RSP);
-		size += sizeof(SRVSVC_SHARE_COMMON_INFO);
-		size += num_shares * sizeof(PTR_INFO1);
-
-		/* determine the size of share info */
-		for (i = 0; i < num_shares; i++) {
-			size += sizeof(UNISTR_INFO);
-			string_len =
-				sharectr->shares[i].str_info1.actual_count * 2;
-			size += ((string_len + 3) & ~3);
-			size += sizeof(UNISTR_INFO);
-			string_len =
-				sharectr->shares[i].str_info2.actual_count * 2;
-
-			size += ((string_len + 3) & ~3);
-		}
+	unsigned int size;
 
-		size += sizeof(sharectr->total_entries);
-		size += sizeof(sharectr->resume_handle);
-		size += sizeof(sharectr->status);
+	size = 4 + unistr_size(strlen(share->sharename));
+	if (level == INFO_0)
+		return size;
+
+	size += 8 + unistr_size(strlen(share_comment(share)));
+	switch (level) {
+	case INFO_501:
+		size += 4;
+		break;
+	case INFO_2:
+	case INFO_502:
+		size += 20 + unistr_size(strlen(SHARE_PATH(share)) + 2);
+		if (level == INFO_502)
+			size += 8;
+		break;
 	}
-	cifsd_debug("Total data length in pipe %d\n", size);
 	return size;
 }
 
+/* size of the info structure of @level, 0 if unsupported */
+static size_t share_info_sizeof(__u32 level)
+{
+	switch (level) {
+	case INFO_0:
+		return sizeof(struct srvsvc_NetShareInfo0);
+	case INFO_1:
+		return sizeof(struct srvsvc_NetShareInfo1);
+	case INFO_2:
+		return sizeof(struct srvsvc_NetShareInfo2);
+	case INFO_501:
+		return sizeof(struct srvsvc_NetShareInfo501);
+	case INFO_502:
+		return sizeof(struct srvsvc_NetShareInfo502);
+	}
+	return 0;
+}
+
 /**
- * pipe_data_copy() - copy share info data on rpc pipe
- * @server:     TCP server instance of connection
- * @buf:	buffer to copy share data
+ * share_info_set() - fill in the share information of one level
+ * @ndr:	request the strings are allocated from
+ * @share:	share to describe
+ * @level:	info level
+ * @info:	zeroed info structure of @level
  *
- * Return:      data size copied on buffer
+ * Return:	0 on success, otherwise error
  */
-int pipe_data_copy(struct cifsd_pipe *pipe, char *buf)
+static int share_info_set(struct ndr *ndr, struct cifsd_share *share,
+		__u32 level, void *info)
 {
-	int offset = 0, i, str_len, num_shares;
-	SRVSVC_SHARE_INFO_CTR *sharectr;
-
-	if (pipe->opnum == SRV_NET_SHARE_ENUM_ALL) {
-		sharectr = (SRVSVC_SHARE_INFO_CTR *)pipe->data;
-		num_shares = sharectr->info.num_entries;
-
-		cifsd_debug("num entries = %d\n", sharectr->info.num_entries);
-		memcpy(buf, &sharectr->rpc_request_rsp,
-						sizeof(RPC_REQUEST_RSP));
-		offset += sizeof(RPC_REQUEST_RSP);
-
-		memcpy(buf + offset, &sharectr->info,
-				sizeof(SRVSVC_SHARE_COMMON_INFO));
-		offset += sizeof(SRVSVC_SHARE_COMMON_INFO);
-
-		memcpy(buf + offset, sharectr->ptrs,
-				num_shares * sizeof(PTR_INFO1));
-		offset += num_shares * sizeof(PTR_INFO1);
-
-		for (i = 0; i < num_shares; i++) {
-
-			memcpy(buf + offset, &sharectr->shares[i].str_info1,
-					sizeof(UNISTR_INFO));
-			offset += sizeof(UNISTR_INFO);
+	struct srvsvc_NetShareInfo502 *info502 = info;
+	struct srvsvc_NetShareInfo501 *info501 = info;
+	struct srvsvc_NetShareInfo2 *info2 = info;
+	struct srvsvc_NetShareInfo1 *info1 = info;
+	struct srvsvc_NetShareInfo0 *info0 = info;
+	__u32 type, max_users;
+	char *path;
+
+	if (strcmp(share->sharename, STR_IPC) == 0)
+		type = STYPE_IPC_HIDDEN;
+	else
+		type = STYPE_DISKTREE;
+
+	max_users = share->config.max_connections;
+	if (!max_users)
+		max_users = 0xFFFFFFFF;
+
+	switch (level) {
+	case INFO_0:
+		info0->name = share->sharename;
+		break;
+	case INFO_1:
+		info1->name = share->sharename;
+		info1->type = type;
+		info1->comment = share_comment(share);
+		break;
+	case INFO_2:
+		path = share_path(ndr, share);
+		if (!path)
+			return -ENOMEM;
+		info2->name = share->sharename;
+		info2->type = type;
+		info2->comment = share_comment(share);
+		info2->max_users = max_users;
+		info2->current_users = share->tcount;
+		info2->path = path;
+		break;
+	case INFO_501:
+		info501->name = share->sharename;
+		info501->type = type;
+		info501->comment = share_comment(share);
+		break;
+	case INFO_502:
+		path = share_path(ndr, share);
+		if (!path)
+			return -ENOMEM;
+		info502->name = share->sharename;
+		info502->type = type;
+		info502->comment = share_comment(share);
+		info502->max_users = max_users;
+		info502->current_users = share->tcount;
+		info502->path = path;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
 
-			str_len =
-				sharectr->shares[i].str_info1.actual_count * 2;
+/**
+ * share_enum_ctr() - allocate the share container of one level
+ * @ndr:	request the container is allocated from
+ * @level:	info level
+ * @count:	number of shares the container holds
+ * @ctr:	on success, points to the container
+ *
+ * Return:	zeroed array of @count info structures, NULL if @count is 0
+ *		or on failure, which sets @ndr->error
+ */
+static void *share_enum_ctr(struct ndr *ndr, __u32 level, __u32 count,
+		union srvsvc_NetShareCtr *ctr)
+{
+	void *array = NULL;
 
-			memcpy(buf + offset, sharectr->shares[i].sharename,
-					str_len);
-			offset += ((str_len + 3) & ~3);
+	if (count)
+		array = ndr_alloc(ndr, count * share_info_sizeof(level));
 
-			memcpy(buf + offset, &sharectr->shares[i].str_info2,
-					sizeof(UNISTR_INFO));
-			offset += sizeof(UNISTR_INFO);
+	switch (level) {
+	case INFO_0:
+		ctr->ctr0 = ndr_alloc(ndr, sizeof(*ctr->ctr0));
+		if (ctr->ctr0) {
+			ctr->ctr0->count = count;
+			ctr->ctr0->array = array;
+		}
+		break;
+	case INFO_1:
+		ctr->ctr1 = ndr_alloc(ndr, sizeof(*ctr->ctr1));
+		if (ctr->ctr1) {
+			ctr->ctr1->count = count;
+			ctr->ctr1->array = array;
+		}
+		break;
+	case INFO_2:
+		ctr->ctr2 = ndr_alloc(ndr, sizeof(*ctr->ctr2));
+		if (ctr->ctr2) {
+			ctr->ctr2->count = count;
+			ctr->ctr2->array = array;
+		}
+		break;
+	case INFO_501:
+		ctr->ctr501 = ndr_alloc(ndr, sizeof(*ctr->ctr501));
+		if (ctr->ctr501) {
+			ctr->ctr501->count = count;
+			ctr->ctr501->array = array;
+		}
+		break;
+	case INFO_502:
+		ctr->ctr502 = ndr_alloc(ndr, sizeof(*ctr->ctr502));
+		if (ctr->ctr502) {
+			ctr->ctr502->count = count;
+			ctr->ctr502->array = array;
+		}
+		break;
+	default:
+		ndr_set_error(ndr, -EINVAL);
+	}
+	return array;
+}
 
-			str_len =
-				sharectr->shares[i].str_info2.actual_count * 2;
+/**
+ * dcerpc_marshal() - encode the reply of a call
+ * @pipe:	pipe the call came in on
+ * @call:	call description from the generated interface table
+ * @r:		call with its out parameters set
+ * @data:	on success, the response PDU, owned by the caller
+ *
+ * Return:	PDU length on success, otherwise error
+ */
+static int dcerpc_marshal(struct cifsd_pipe *pipe, const struct ndr_call *call,
+		const void *r, char **data)
+{
+	struct ndr ndr;
+	int ret;
 
-			memcpy(buf + offset, sharectr->shares[i].comment,
-					str_len);
-			offset += ((str_len + 3) & ~3);
+	ret = ndr_init_alloc(&ndr, 1024);
+	if (ret)
+		return ret;
 
-		}
-		memcpy(buf + offset, &sharectr->total_entries,
-				sizeof(sharectr->total_entries));
-		offset += sizeof(sharectr->total_entries);
-		memcpy(buf + offset, &sharectr->resume_handle,
-				sizeof(sharectr->resume_handle));
-		offset += sizeof(sharectr->resume_handle);
-		memcpy(buf + offset, &sharectr->status,
-				sizeof(sharectr->status));
-		offset += sizeof(sharectr->status);
+	ndr.codepage = pipe->codepage;
+	ndr_rpc_rsp_begin(&ndr, pipe->call_id, pipe->context_id);
+	call->push_out(&ndr, r);
+	ret = ndr_rpc_rsp_end(&ndr);
+	if (ret < 0) {
+		cifsd_err("failed to marshal %s reply, err %d\n",
+				call->name, ret);
+		ndr_free(&ndr);
+		return ret;
 	}
 
-	return offset;
+	*data = ndr.data;
+	return ret;
 }
 
 /**
- * dcerpc_header_init() - initialize the header for rpc response
- * @header: pointer to header in response packet
- * @packet_type : DCE/RPC Packet type
- * @flags : DCE/RPC flags
- * @call_id: call_id from RPC request
+ * dcerpc_reply() - encode the reply of a call and queue it for reading
+ * @pipe:	pipe the call came in on
+ * @call:	call description from the generated interface table
+ * @r:		call with its out parameters set
  *
+ * Return:	0 on success, otherwise error
  */
-void dcerpc_header_init(RPC_HDR *header, int packet_type,
-				int flags, int call_id)
+int dcerpc_reply(struct cifsd_pipe *pipe, const struct ndr_call *call,
+		const void *r)
 {
-	header->major = RPC_MAJOR_VER;
-	header->minor = RPC_MINOR_VER;
-	header->pkt_type = packet_type;
-	header->flags = flags;
-	header->pack_type[0] = 0x10;
-	header->pack_type[1] = 0;
-	header->pack_type[2] = 0;
-	header->pack_type[3] = 0;
-	header->auth_len = 0;
-	header->call_id  = call_id;
+	struct cifsd_rpc_rsp *rsp = rpc_rsp_tail(pipe);
+	char *data;
+	int len;
+
+	len = dcerpc_marshal(pipe, call, r, &data);
+	if (len < 0)
+		return len;
+
+	rsp->buf = data;
+	rsp->datasize = len;
+	return 0;
 }
 
 /**
- * init_srvsvc_share_info1() - initialize srvsvc pipe share information
- * @server:		TCP server instance of connection
- * @rpc_request_req:	rpc request
+ * winreg_marshal() - encode the reply of a hand decoded winreg call
+ * @pipe:	pipe the call came in on
+ * @rsp:	queued reply of the call
+ * @data:	reply left on the pipe by the handler
  *
- * Return:      0 on success or error number
+ * These replies are packed structures behind a response header. Their
+ * body is copied into a marshalled PDU, so they are read out in
+ * fragments like the replies of the generated calls.
+ *
+ * Return:	0 on success, otherwise error
  */
-static int init_srvsvc_share_info1(struct cifsd_pipe *pipe,
-				RPC_REQUEST_REQ *rpc_request_req)
+static int winreg_marshal(struct cifsd_pipe *pipe, struct cifsd_rpc_rsp *rsp,
+		char *data)
 {
-	int num_shares = 0, cnt = 0, len = 0, ret;
-	int total_pipe_data = 0, data_copied = 0;
-	struct list_head *tmp;
-	struct cifsd_share *share;
-	SRVSVC_SHARE_INFO1 *share_info;
-	PTR_INFO1 *ptr_info;
-	int share_name_len, comment_len = 0;
-	RPC_REQUEST_RSP *rpc_request_rsp;
-	SRVSVC_SHARE_INFO_CTR *sharectr;
-	char *buf = NULL;
-
-	num_shares = cifsd_num_shares; // TBD: cifsd_num_shares;
-	sharectr = (SRVSVC_SHARE_INFO_CTR *)
-			calloc(1, sizeof(SRVSVC_SHARE_INFO_CTR));
-	if (!sharectr) {
-		return -ENOMEM;
-	}
-	pipe->data = (char *)sharectr;
+	ENUM_VALUE_RSP *enum_value = (ENUM_VALUE_RSP *)data;
+	struct ndr ndr;
+	int size, ret;
 
-	sharectr->ptrs = calloc(1, (num_shares * sizeof(PTR_INFO1)));
+	switch (rsp->opnum) {
+	case WINREG_DELETEKEY:
+	case WINREG_FLUSHKEY:
+	case WINREG_NOTIFYCHANGEKEYVALUE:
+	case WINREG_DELETEVALUE:
+		size = sizeof(WINREG_COMMON_RSP);
+		break;
+	case WINREG_CREATEKEY:
+		size = sizeof(CREATE_KEY_RSP);
+		break;
+	case WINREG_ENUMKEY:
+		size = sizeof(ENUM_KEY_RSP);
+		break;
+	case WINREG_ENUMVALUE:
+		size = sizeof(ENUM_VALUE_RSP);
+		break;
+	case WINREG_QUERYINFOKEY:
+		size = sizeof(QUERY_INFO_KEY_RSP);
+		break;
+	default:
+		return -EINVAL;
+	}
 
-	if (!sharectr->ptrs) {
-		free(sharectr);
-		return -ENOMEM;
+	ret = ndr_init_alloc(&ndr, size);
+	if (ret)
+		return ret;
+
+	ndr_rpc_rsp_begin(&ndr, pipe->call_id, pipe->context_id);
+	if (rsp->opnum == WINREG_ENUMVALUE) {
+		/* the host pointer to the name is not on the wire */
+		ndr_write_bytes(&ndr, &enum_value->name_len,
+				offsetof(ENUM_VALUE_RSP, Buffer) -
+				offsetof(ENUM_VALUE_RSP, name_len));
+		ndr_write_bytes(&ndr, &enum_value->type_info,
+				size - offsetof(ENUM_VALUE_RSP, type_info));
+	} else {
+		ndr_write_bytes(&ndr, data + sizeof(RPC_REQUEST_RSP),
+				size - sizeof(RPC_REQUEST_RSP));
+	}
+	ret = ndr_rpc_rsp_end(&ndr);
+	if (ret < 0) {
+		ndr_free(&ndr);
+		return ret;
 	}
-	sharectr->shares = calloc(1, (num_shares * sizeof(SRVSVC_SHARE_INFO1)));
 
-	if (!sharectr->shares) {
-		free(sharectr->ptrs);
-		free(sharectr);
-		return -ENOMEM;
+	rsp->buf = ndr.data;
+	rsp->datasize = ret;
+	return 0;
+}
+
+/**
+ * srvsvc_net_share_enum_all() - srvsvc pipe for share list enumeration
+ * @pipe:	pipe the request came in on
+ * @ndr:	reader positioned at the request stub
+ *
+ * Shares are listed from the position of the resume handle on, as many
+ * as fit in max_buffer but at least one. When some are left over, the
+ * reply is WERR_MORE_DATA with the resume handle pointing at the next.
+ * A level we do not serve gets an empty container and WERR_UNKNOWN_LEVEL.
+ *
+ * Return:      0 on success or error number
+ */
+static int srvsvc_net_share_enum_all(struct cifsd_pipe *pipe, struct ndr *ndr)
+{
+	const struct ndr_call *call =
+		&ndr_table_srvsvc.calls[NDR_SRVSVC_NETSHAREENUMALL];
+	struct srvsvc_NetShareEnumAll r;
+	struct share_enum_rsp *rsp;
+	struct cifsd_share *share;
+	struct list_head *tmp, *first = NULL;
+	unsigned int gen, size = 0, total = 0, count = 0;
+	__u32 level, resume, i = 0;
+	size_t info_size;
+	struct cifsd_rpc_rsp *pending;
+	char *array, *data;
+	int ret;
+
+	ret = ndr_pull_srvsvc_NetShareEnumAll_in(ndr, &r);
+	if (ret)
+		return ret;
+
+	level = r.in.info_ctr->level;
+	resume = r.in.resume_handle ? *r.in.resume_handle : 0;
+	cifsd_debug("server_unc = %s level %u resume %u max_buffer %u\n",
+			r.in.server_unc ? r.in.server_unc : "", level, resume,
+			r.in.max_buffer);
+
+	if (!share_info_sizeof(level)) {
+		cifsd_debug("SRVSVC pipe info level %u not supported\n",
+				level);
+		*r.out.totalentries = 0;
+		r.out.result = WERR_UNKNOWN_LEVEL;
+		return dcerpc_reply(pipe, call, &r);
 	}
 
-	rpc_request_rsp = &sharectr->rpc_request_rsp;
-
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
+	if (!resume) {
+		rsp = share_enum_get(level, pipe->codepage,
+				r.in.resume_handle != NULL, r.in.max_buffer);
+		if (rsp)
+			goto out;
+	}
 
-	sharectr->info.info_level = cpu_to_le32(1);
-	sharectr->info.switch_value = cpu_to_le32(1);
-	sharectr->info.ptr_share_info = cpu_to_le32(1);
-	sharectr->info.num_entries = cpu_to_le32(num_shares);
-	sharectr->info.ptr_entries = cpu_to_le32(1);
-	sharectr->info.num_entries2 = cpu_to_le32(num_shares);
+	gen = __atomic_load_n(&cifsd_share_generation, __ATOMIC_ACQUIRE);
 
-/*
- * TBD: To replace with actual user configuration part,
- * need to decide complete logic to get this information
- */
-#if 1
 	list_for_each(tmp, &cifsd_share_list) {
-		share_info = &sharectr->shares[cnt];
-		ptr_info = &sharectr->ptrs[cnt];
-		share = list_entry(tmp, struct cifsd_share, list);
-		share_name_len = strlen(share->sharename) + 1;
-
-		if (share_name_len > 13) {
-			cifsd_debug("Not displaying share = %s",
-					share->sharename);
+		if (i++ < resume)
 			continue;
+		share = list_entry(tmp, struct cifsd_share, list);
+		if (!first)
+			first = tmp;
+		total++;
+		if (count == total - 1) {
+			size += share_info_size(share, level);
+			if (size <= r.in.max_buffer || !count)
+				count++;
 		}
+	}
 
-		if (strcmp(share->sharename, STR_IPC) == 0) {
-			ptr_info->type = STYPE_IPC_HIDDEN;
-			ret = smbConvertToUTF16((__le16 *)share_info->comment,
-					"IPC SHARE", strlen("IPC SHARE"), 256,
-					pipe->codepage);
-			if (ret < 0) {
-				free(sharectr->ptrs);
-				free(sharectr);
-				return -EINVAL;
-			}
-			comment_len = strlen("IPC SHARE") + 1;
-			cifsd_debug("IPC share %s added len = %d\n",
-				       share->sharename, len);
-		} else {
-			ptr_info->type = STYPE_DISKTREE;
-			if (share->config.comment) {
-				ret = smbConvertToUTF16((__le16 *)share_info->comment,
-				share->config.comment, strlen(share->config.comment),
-				256, pipe->codepage);
-				if (ret < 0) {
-					free(sharectr->ptrs);
-					free(sharectr);
-					return -EINVAL;
-				}
-				comment_len = strlen(share->config.comment) + 1;
-			} else {
-				/* Windows expect comment to be non-null
-				   In case comment is not given in conf file,
-				   using sharename as comment */
-				ret = smbConvertToUTF16((__le16 *)share_info->comment,
-				share->sharename, strlen(share->sharename), 256,
-				pipe->codepage);
-				if (ret < 0) {
-					free(sharectr->ptrs);
-					free(sharectr);
-					return -EINVAL;			
-				}
-				comment_len = strlen(share->sharename) + 1;
-			}
-			cifsd_debug("share %s added\n", share->sharename);
-		}
-
-		cifsd_debug("comment len = %d share len = %d uni len = %d\n",
-				comment_len, share_name_len, len);
+	info_size = share_info_sizeof(level);
+	array = share_enum_ctr(ndr, level, count, &r.out.info_ctr->ctr);
+	if (ndr->error)
+		return ndr->error;
 
-		/* Since sharename and comment are non-null*/
-		ptr_info->ptr_netname = 1;
-		ptr_info->ptr_remark = 1;
+	for (i = 0, tmp = first; i < count; i++, tmp = tmp->next) {
+		share = list_entry(tmp, struct cifsd_share, list);
+		ret = share_info_set(ndr, share, level,
+				array + i * info_size);
+		if (ret)
+			return ret;
+	}
 
-		ret = smbConvertToUTF16((__le16 *)share_info->sharename,
-				share->sharename, strlen(share->sharename),
-				256, pipe->codepage);
-		if (ret < 0) {
-			free(sharectr->ptrs);
-			free(sharectr);
-			return -EINVAL;
+	*r.out.totalentries = total;
+	r.out.result = WERR_OK;
+	if (count < total) {
+		if (!r.out.resume_handle) {
+			r.out.resume_handle = ndr_alloc(ndr, sizeof(__u32));
+			if (!r.out.resume_handle)
+				return ndr->error;
 		}
-		share_info->str_info1.max_count = share_name_len;
-		share_info->str_info1.offset = 0;
-		share_info->str_info1.actual_count = share_name_len;
-
-		share_info->str_info2.max_count = comment_len;
-		share_info->str_info2.offset = 0;
-		share_info->str_info2.actual_count = comment_len;
-		cnt++;
+		*r.out.resume_handle = resume + count;
+		r.out.result = WERR_MORE_DATA;
+	} else if (r.out.resume_handle) {
+		*r.out.resume_handle = 0;
 	}
-#endif
 
-	sharectr->total_entries = cpu_to_le32(num_shares);
-	sharectr->resume_handle = 0;
-	sharectr->status = 0;
+	/* only complete lists are worth caching */
+	if (resume || count < total)
+		return dcerpc_reply(pipe, call, &r);
 
-	total_pipe_data = pipe_data_size(pipe, (void *)sharectr, num_shares);
-	if (total_pipe_data == 0)
-		return 0;
-	buf =  calloc(1, total_pipe_data);
-	if (buf == NULL)
+	ret = dcerpc_marshal(pipe, call, &r, &data);
+	if (ret < 0)
+		return ret;
+
+	rsp = share_enum_add(level, pipe->codepage, r.in.resume_handle != NULL,
+			size, gen, data, ret);
+	if (!rsp)
 		return -ENOMEM;
-	pipe->buf = buf;
 
-	data_copied = pipe_data_copy(pipe, buf);
-	cifsd_debug("data_copied %d, total_pipe_data %d\n", data_copied,
-							total_pipe_data);
-	pipe->datasize = data_copied;
+out:
+	pending = rpc_rsp_tail(pipe);
+	pending->rsp_cache = rsp;
+	pending->buf = rsp->data;
+	pending->datasize = rsp->len;
 	return 0;
 }
 
 /**
- * srvsvc_net_share_enum_all() - srvsvc pipe for share list enumeration
- * @server:     TCP server instance of connection
- * @data:	SRVSVC_REQ data
- * @rpc_request_req:	rpc request
+ * srvsvc_net_share_info() - get share information on srvsvc pipe
+ * @pipe:	pipe the request came in on
+ * @ndr:	reader positioned at the request stub
  *
  * Return:      0 on success or error number
  */
-static int srvsvc_net_share_enum_all(struct cifsd_pipe *pipe, char *data,
-				RPC_REQUEST_REQ *rpc_request_req)
+static int srvsvc_net_share_info(struct cifsd_pipe *pipe, struct ndr *ndr)
 {
-	SRVSVC_REQ *req = (SRVSVC_REQ *)data;
-	SERVER_HANDLE handle;
-	char *server_unc_ptr, *server_unc;
-	int server_unc_len = 0;
-	int ret = 0;
-
-	handle = req->server_unc_handle;
-	server_unc_ptr = (char *)(data + sizeof(SERVER_HANDLE));
-	server_unc = smb_strndup_from_utf16(server_unc_ptr,
-			req->server_unc_handle.handle_info.actual_count, 1,
-			pipe->codepage);
-	if (IS_ERR(server_unc))
-		return PTR_ERR(server_unc);
-
-	cifsd_debug("server_unc = %s unc size = %d\n", server_unc,
-			handle.handle_info.actual_count);
-	free(server_unc);
-
-	server_unc_len = 2 * handle.handle_info.actual_count;
-	server_unc_len = ((server_unc_len + 3) & ~3);
-	/* Add 2 for Pad */
-	req->info_level = le32_to_cpu(*(server_unc_ptr + server_unc_len));
+	const struct ndr_call *call =
+		&ndr_table_srvsvc.calls[NDR_SRVSVC_NETSHAREGETINFO];
+	struct srvsvc_NetShareGetInfo r;
+	struct cifsd_share *share;
+	struct list_head *tmp;
+	void *info;
+	int ret;
+
+	ret = ndr_pull_srvsvc_NetShareGetInfo_in(ndr, &r);
+	if (ret)
+		return ret;
+
+	cifsd_debug("Share name is %s, level %u\n", r.in.share_name,
+			r.in.level);
+	if (!share_info_sizeof(r.in.level)) {
+		cifsd_debug("SRVSVC pipe info level %u not supported\n",
+				r.in.level);
+		r.out.result = WERR_UNKNOWN_LEVEL;
+		return dcerpc_reply(pipe, call, &r);
+	}
 
-	switch (req->info_level) {
+	r.out.result = WERR_INVALID_NAME;
+	list_for_each(tmp, &cifsd_share_list) {
+		share = list_entry(tmp, struct cifsd_share, list);
+		if (strcmp(share->sharename, r.in.share_name))
+			continue;
 
-	case INFO_1:
-		cifsd_debug("GOT SRVSVC pipe info level %u\n",
-			       req->info_level);
+		info = ndr_alloc(ndr, share_info_sizeof(r.in.level));
+		if (!info)
+			return ndr->error;
+		ret = share_info_set(ndr, share, r.in.level, info);
+		if (ret)
+			return ret;
 
-		ret = init_srvsvc_share_info1(pipe, rpc_request_req);
+		switch (r.in.level) {
+		case INFO_0:
+			r.out.info->info0 = info;
+			break;
+		case INFO_1:
+			r.out.info->info1 = info;
+			break;
+		case INFO_2:
+			r.out.info->info2 = info;
+			break;
+		case INFO_501:
+			r.out.info->info501 = info;
+			break;
+		case INFO_502:
+			r.out.info->info502 = info;
+			break;
+		}
+		r.out.result = WERR_OK;
 		break;
-
-	default:
-		cifsd_debug("SRVSVC pipe info level %u  not supported\n",
-				req->info_level);
-		return -EOPNOTSUPP;
 	}
 
-	return ret;
+	return dcerpc_reply(pipe, call, &r);
 }
 
 /**
- * init_srvsvc_share_info2() - get a share information on srvsvc pipe
- * @server:		TCP server instance of connection
- * @rpc_request_req:	rpc request
- * @share_name:		share_name for which information is requested
+ * wkkssvc_net_share_info() - get workstation info on wkssvc pipe
+ * @pipe:	pipe the request came in on
+ * @ndr:	reader positioned at the request stub
  *
  * Return:      0 on success or error number
  */
-int init_srvsvc_share_info2(struct cifsd_pipe *pipe,
-			RPC_REQUEST_REQ *rpc_request_req, char *share_name)
+static int wkkssvc_net_share_info(struct cifsd_pipe *pipe, struct ndr *ndr)
 {
-	int num_shares = 1, cnt = 0, len = 0;
-	struct list_head *tmp;
-	struct cifsd_share *share;
-	SRVSVC_SHARE_INFO1 *share_info;
-	SRVSVC_SHARE_GETINFO *shareinfo;
-	PTR_INFO1 *ptr_info;
-	int share_name_len, comment_len = 0;
-	RPC_REQUEST_RSP *rpc_request_rsp;
-
-	shareinfo = (SRVSVC_SHARE_GETINFO *)
-			calloc(1, sizeof(SRVSVC_SHARE_GETINFO));
-	if (!shareinfo) {
-		return -ENOMEM;
-	}
+	const struct ndr_call *call =
+		&ndr_table_wkssvc.calls[NDR_WKSSVC_NETWKSTAGETINFO];
+	struct wkssvc_NetWkstaGetInfo r;
+	struct wkssvc_NetWkstaInfo100 info100;
+	int ret;
 
-	pipe->data = (char *)shareinfo;
-	shareinfo->ptrs = calloc(1, (num_shares * sizeof(PTR_INFO1)));
-	if (!shareinfo->ptrs) {
-		free(shareinfo);
-		return -ENOMEM;
-	}
+	ret = ndr_pull_wkssvc_NetWkstaGetInfo_in(ndr, &r);
+	if (ret)
+		return ret;
 
-	shareinfo->shares = calloc(1, num_shares * sizeof(SRVSVC_SHARE_INFO1));
-	if (!shareinfo->shares) {
-		free(shareinfo->ptrs);
-		free(shareinfo);
-		return -ENOMEM;
+	if (r.in.level != INFO_100) {
+		cifsd_err("WKSSVC pipe info level %u  not supported\n",
+				r.in.level);
+		return -EOPNOTSUPP;
 	}
 
-	rpc_request_rsp = &shareinfo->rpc_request_rsp;
+	info100.platform_id = PLATFORM_ID_NT;
+	info100.server_name = server_string;
+	info100.domain_name = workgroup;
+	info100.version_major = 4;
+	info100.version_minor = 9;
+	r.out.info->info100 = &info100;
+	r.out.result = WERR_OK;
 
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
-
-	shareinfo->status = cpu_to_le32(WERR_INVALID_NAME);
-	shareinfo->info_level = cpu_to_le32(1);
-	shareinfo->switch_value = cpu_to_le32(0);
+	return dcerpc_reply(pipe, call, &r);
+}
 
-/*
- * TBD: To replace with actual user configuration part,
- * need to decide complete logic to get this information
- */
-#if 1
-	list_for_each(tmp, &cifsd_share_list) {
-		share_info = &shareinfo->shares[cnt];
-		ptr_info = &shareinfo->ptrs[cnt];
-		share = list_entry(tmp, struct cifsd_share, list);
-		share_name_len = strlen(share->sharename) + 1;
+/* interface bound to a context of the pipe, or -1 */
+static int rpc_context_iface(struct cifsd_pipe *pipe, __u16 context_id)
+{
+	int i;
 
-		if (share_name_len > 13) {
-			cifsd_err("Not displaying share = %s",
-					share->sharename);
-			continue;
-		}
+	for (i = 0; i < pipe->nr_contexts; i++)
+		if (pipe->contexts[i].id == context_id)
+			return pipe->contexts[i].iface;
+	return -1;
+}
 
-		if (strcmp(share->sharename, share_name) == 0) {
-			ptr_info->type = STYPE_DISKTREE;
-			if (share->config.comment) {
-				len =
-				smbConvertToUTF16((__le16 *)share_info->comment,
-				share->config.comment,
-				strlen(share->config.comment),
-				256, pipe->codepage);
-				comment_len = strlen(share->config.comment) + 1;
-			} else {
-				len =
-				smbConvertToUTF16((__le16 *)share_info->comment,
-				share->sharename, strlen(share->sharename),
-				256, pipe->codepage);
-				comment_len = strlen(share->sharename) + 1;
-			}
-			cifsd_debug("share %s added\n", share->sharename);
-
-			shareinfo->switch_value = cpu_to_le32(1);
-			cifsd_debug("comment len = %d share len = %d uni len = %d\n",
-				      comment_len, share_name_len, len);
-
-			/* Since sharename and comment are non-null*/
-			ptr_info->ptr_netname = 1;
-			ptr_info->ptr_remark = 1;
-
-			smbConvertToUTF16((__le16 *)share_info->sharename,
-					  share->sharename,
-					  strlen(share->sharename),
-					  256, pipe->codepage);
-			share_info->str_info1.max_count = share_name_len;
-			share_info->str_info1.offset = 0;
-			share_info->str_info1.actual_count = share_name_len;
-
-			share_info->str_info2.max_count = comment_len;
-			share_info->str_info2.offset = 0;
-			share_info->str_info2.actual_count = comment_len;
-			shareinfo->status = cpu_to_le32(WERR_OK);
-		}
+/**
+ * dcerpc_reject() - log a request refused without running a handler
+ * @iface:	interface the request was for
+ * @opnum:	its opnum
+ * @len:	its stub length
+ * @why:	reason for the log
+ */
+static void dcerpc_reject(const struct dcerpc_iface *iface,
+		unsigned int opnum, int len, const char *why)
+{
+	struct dcerpc_reject_log *log;
+	__u64 now, next;
+	unsigned int suppressed;
+
+	cifsd_stats_rejected(iface->stat, opnum);
+
+	log = &reject_log[iface->stat][opnum < CIFSD_STAT_MAX_OPNUM ?
+		opnum : CIFSD_STAT_MAX_OPNUM];
+	now = cifsd_stats_now() / 1000000000ULL;
+	next = __atomic_load_n(&log->next, __ATOMIC_RELAXED);
+	if (now < next || !__atomic_compare_exchange_n(&log->next, &next,
+				now + DCERPC_REJECT_LOG_SECS, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&log->suppressed, 1, __ATOMIC_RELAXED);
+		return;
 	}
-#endif
-	return 0;
+
+	suppressed = __atomic_exchange_n(&log->suppressed, 0,
+			__ATOMIC_RELAXED);
+	cifsd_err("%s opnum %u with %d stub bytes rejected: %s (%u more not logged)\n",
+			iface->table->name, opnum, len, why, suppressed);
 }
 
 /**
- * srvsvc_net_share_info() - get share information on srvsvc pipe
- * @server:		TCP server instance of connection
- * @data:		SRVSVC_REQ data
- * @rpc_request_req:	rpc request
- *
- * parse srvspc packet for share_name. Get share information on requested
- * share_name
+ * dcerpc_dispatch() - run the handler of a request
+ * @pipe:	pipe the request came in on
+ * @iface:	interface bound to the context of the request
+ * @req:	request header
+ * @stub:	marshalled call parameters
+ * @len:	bytes in @stub
  *
  * Return:      0 on success or error number
  */
-int srvsvc_net_share_info(struct cifsd_pipe *pipe, char *data,
-				RPC_REQUEST_REQ *rpc_request_req)
+static int dcerpc_dispatch(struct cifsd_pipe *pipe,
+		const struct dcerpc_iface *iface, RPC_REQUEST_REQ *req,
+		char *stub, int len)
 {
-	SRVSVC_REQ *req = (SRVSVC_REQ *)data;
-	char *server_unc_ptr, *server_unc;
-	int server_unc_len = 0;
-	int ret = 0;
-	int infolevel_len;
-	UNISTR_INFO *istr_info;
-	char *ptr, *share_name_ptr, *share_name;
-
-	server_unc_ptr = (char *)(data + sizeof(SERVER_HANDLE));
-	server_unc = smb_strndup_from_utf16(server_unc_ptr,
-			req->server_unc_handle.handle_info.actual_count, 1,
-			pipe->codepage);
-	if (IS_ERR(server_unc))
-		return PTR_ERR(server_unc);
-
-	cifsd_debug("server_unc = %s unc size = %d\n", server_unc,
-			req->server_unc_handle.handle_info.actual_count);
-	free(server_unc);
-
-	server_unc_len = 2 * req->server_unc_handle.handle_info.actual_count;
-	server_unc_len = ((server_unc_len + 3) & ~3);
-	/* Add 2 for Pad */
-	istr_info = (UNISTR_INFO *)((char *)(server_unc_ptr + server_unc_len));
-
-	infolevel_len = 2 * istr_info->actual_count;
-	infolevel_len = ((infolevel_len + 3) & ~3);
-
-	cifsd_debug("istr_info->max_count %u, offset %u, actual count %u\n",
-	istr_info->max_count, istr_info->offset, istr_info->actual_count);
-	share_name_ptr = (char *)((char *)istr_info + sizeof(UNISTR_INFO));
-	share_name = smb_strndup_from_utf16(share_name_ptr,
-			istr_info->actual_count, 1, pipe->codepage);
-	if (IS_ERR(share_name))
-		return PTR_ERR(share_name);
-
-	ptr = (char *)((char *)istr_info + infolevel_len + sizeof(UNISTR_INFO));
-	cifsd_debug("Share name is %s\n", share_name);
-	switch (le32_to_cpu(*(ptr))) {
-	case INFO_1:
-		cifsd_debug("GOT SRVSVC pipe info level %u\n",
-			       req->info_level);
-		ret = init_srvsvc_share_info2(pipe, rpc_request_req,
-								share_name);
-		free(share_name);
-		break;
-
-	default:
-		cifsd_debug("SRVSVC pipe info level %u  not supported\n",
-				req->info_level);
+	unsigned int opnum = le16_to_cpu(req->opnum);
+	const struct dcerpc_op *op = NULL;
+	__u64 start = cifsd_stats_start();
+	struct cifsd_rpc_rsp *rsp;
+	struct ndr ndr;
+	int ret;
+
+	if (opnum < iface->nr_ops && iface->ops[opnum].handler)
+		op = &iface->ops[opnum];
+	if (!op) {
+		dcerpc_reject(iface, opnum, len, "not implemented");
 		return -EOPNOTSUPP;
 	}
+	if (len < op->min_size || (op->max_size && len > op->max_size)) {
+		dcerpc_reject(iface, opnum, len, "stub size out of bounds");
+		return -EINVAL;
+	}
+
+	cifsd_debug("%s %s, call %u\n", iface->table->name, op->name,
+			req->hdr.call_id);
+	rsp = rpc_rsp_queue(pipe, req->hdr.call_id);
+	if (IS_ERR(rsp))
+		return PTR_ERR(rsp);
+	rsp->context_id = req->context_id;
+	rsp->opnum = opnum;
+	rsp->pkt_type = RPC_RESPONSE;
 
+	pipe->opnum = opnum;
+	pipe->call_id = req->hdr.call_id;
+	pipe->context_id = req->context_id;
+	pipe->data = NULL;
+
+	ndr_init_pull(&ndr, stub, len, pipe->codepage);
+	ret = op->handler(pipe, &ndr);
+	ndr_pull_free(&ndr);
+
+	/* the hand decoded winreg calls leave their reply on the pipe */
+	if (!ret && pipe->data)
+		ret = winreg_marshal(pipe, rsp, pipe->data);
+	free(pipe->data);
+	pipe->data = NULL;
+	if (ret)
+		rpc_rsp_free(rsp);
+	else
+		rpc_rsp_commit(pipe);
+
+	cifsd_stats_opnum(iface->stat, opnum, start, ret);
 	return ret;
 }
 
 /**
- * init_wkssvc_share_info2() - helper function to initialize share info
- *			response on wkssvc pipe
- * @server:		TCP server instance of connection
- * @rpc_request_req:	rpc request
+ * rpc_request() - rpc request dispatcher
+ * @pipe:	pipe the request came in on
+ * @in_data:	request PDU, a single fragment or the reassembled ones
+ * @len:	request length
+ *
+ * The request goes to the interface bound to its context.
  *
  * Return:      0 on success or error number
  */
-int init_wkssvc_share_info2(struct cifsd_pipe *pipe,
-				RPC_REQUEST_REQ *rpc_request_req)
+int rpc_request(struct cifsd_pipe *pipe, char *in_data, int len)
 {
-	WKSSVC_SHARE_INFO1 *share_info;
-	WKSSVC_SHARE_GETINFO *shareinfo;
-	int share_name_len, comment_len, ret;
-	RPC_REQUEST_RSP *rpc_request_rsp;
-
-	shareinfo = (WKSSVC_SHARE_GETINFO *)
-			calloc(1, sizeof(WKSSVC_SHARE_GETINFO));
-	if (!shareinfo) {
-		return -ENOMEM;
-	}
-	pipe->data = (char *)shareinfo;
-	shareinfo->shares = calloc(1, sizeof(WKSSVC_SHARE_INFO1));
-
-	if (!shareinfo->shares) {
-		free(shareinfo);
-		return -ENOMEM;
-	}
-
-	rpc_request_rsp = &shareinfo->rpc_request_rsp;
-
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
-
-	shareinfo->info_level = cpu_to_le32(100);
-	shareinfo->refid = cpu_to_le32(1);
-	shareinfo->platform_id = cpu_to_le32(500);
-	shareinfo->ref_id1 = cpu_to_le32(1);
-	shareinfo->ref_id2 = cpu_to_le32(1);
-	shareinfo->maj =	cpu_to_le32(4);
-	shareinfo->min = cpu_to_le32(9);
-	share_info = &shareinfo->shares[0];
-
+	RPC_REQUEST_REQ *req = (RPC_REQUEST_REQ *)in_data;
+	char *stub = in_data + sizeof(RPC_REQUEST_REQ);
+	int iface;
+	int ret = 0;
 
-	ret = smbConvertToUTF16((__le16 *)share_info->domain_name,
-			workgroup, strlen(workgroup), 256, pipe->codepage);
-	if (ret < 0) {
-		free(shareinfo);
+	if (len < sizeof(RPC_REQUEST_REQ))
 		return -EINVAL;
-	}
-	comment_len = strlen(workgroup) + 1;
-
-	share_name_len = strlen(server_string) + 1;
-	cifsd_debug("comment len = %d share len = %d \n",
-			comment_len, share_name_len);
+	len -= sizeof(RPC_REQUEST_REQ);
 
-	ret = smbConvertToUTF16((__le16 *)share_info->server_name,
-			server_string, strlen(server_string), 256,
-			pipe->codepage);
-	if (ret < 0) {
-		free(shareinfo);
+	iface = rpc_context_iface(pipe, req->context_id);
+	if (iface < 0) {
+		cifsd_debug("request on unbound context %u\n",
+				req->context_id);
 		return -EINVAL;
 	}
 
-	share_info->str_info1.max_count = share_name_len;
-	share_info->str_info1.offset = 0;
-	share_info->str_info1.actual_count = share_name_len;
+	switch (pipe->pipe_type) {
+	case SRVSVC:
+		ret = dcerpc_dispatch(pipe, &dcerpc_ifaces[iface], req, stub,
+				len);
+		break;
+	case WINREG:
+#ifdef WINREG_SUPPORT
+		pthread_mutex_lock(&winreg_lock);
+		ret = dcerpc_dispatch(pipe, &dcerpc_ifaces[iface], req, stub,
+				len);
+		pthread_mutex_unlock(&winreg_lock);
+		break;
+#else
+		return -EOPNOTSUPP;
+#endif
+	default:
+		cifsd_debug("pipe not supported\n");
+		return -EOPNOTSUPP;
+	}
+	return ret;
+}
 
-	share_info->str_info2.max_count = comment_len;
-	share_info->str_info2.offset = 0;
-	share_info->str_info2.actual_count = comment_len;
+/* interface table index of an abstract syntax served on a pipe type */
+static int rpc_iface_find(unsigned int pipe_type, RPC_IFACE *abstract)
+{
+	const struct ndr_interface *table;
+	int i;
 
-	shareinfo->status = cpu_to_le32(0);
-	return 0;
+	for (i = 0; i < NR_DCERPC_IFACES; i++) {
+		table = dcerpc_ifaces[i].table;
+		if (dcerpc_ifaces[i].pipe_type == pipe_type &&
+				!memcmp(&abstract->uuid, table->uuid, 16) &&
+				abstract->version_maj == table->version_major &&
+				abstract->version_min <= table->version_minor)
+			return i;
+	}
+	return -1;
 }
 
 /**
- * wkkssvc_net_share_info() - get share info on wkssvc pipe
- * @server:		TCP server instance of connection
- * @data:		wkssvc request data
- * @rpc_request_req:	rpc request
+ * rpc_context_bind() - negotiate one presentation context
+ * @pipe:	pipe being bound
+ * @ctx:	context from the request, followed by its transfer syntaxes
  *
- * Return:      0 on success or error number
+ * The abstract syntax must be an interface served on the type of @pipe
+ * and NDR one of the transfer syntaxes. An accepted context is added to
+ * the pipe, or rebinds the context of the same id.
+ *
+ * Return:	RPC_REASON_NONE if accepted, otherwise the rejection reason
  */
-int wkkssvc_net_share_info(struct cifsd_pipe *pipe, char *data,
-				RPC_REQUEST_REQ *rpc_request_req)
+static int rpc_context_bind(struct cifsd_pipe *pipe, RPC_CONTEXT *ctx)
 {
-	SRVSVC_REQ *req = (SRVSVC_REQ *)data;
-	char *server_unc_ptr, *server_unc;
-	int server_unc_len = 0;
-	int ret = 0;
-	int *info_level;
-
-	server_unc_ptr = (char *)(data + sizeof(SERVER_HANDLE));
-	server_unc = smb_strndup_from_utf16(server_unc_ptr,
-			req->server_unc_handle.handle_info.actual_count, 1,
-			pipe->codepage);
-	if (IS_ERR(server_unc))
-		return PTR_ERR(server_unc);
-
-	cifsd_debug("server_unc = %s unc size = %d\n", server_unc,
-			req->server_unc_handle.handle_info.actual_count);
-	free(server_unc);
-
-	server_unc_len = 2 * req->server_unc_handle.handle_info.actual_count;
-	server_unc_len = ((server_unc_len + 3) & ~3);
-	/* Add 2 for Pad */
-	info_level = (int *)((char *)(server_unc_ptr + server_unc_len));
-
-	switch (le32_to_cpu(*info_level)) {
-	case INFO_100:
-		cifsd_debug("GOT WKSSVC pipe info level %u\n",
-			       le32_to_cpu(*info_level));
-
-		ret = init_wkssvc_share_info2(pipe, rpc_request_req);
-		break;
+	RPC_IFACE *syntax = (RPC_IFACE *)(ctx + 1);
+	int iface, i;
+
+	iface = rpc_iface_find(pipe->pipe_type, &ctx->abstract);
+	if (iface < 0) {
+		cifsd_debug("context %u: abstract syntax not supported\n",
+				ctx->context_id);
+		return RPC_REASON_ABSTRACT_SYNTAX;
+	}
 
-	default:
-		cifsd_err("WKSSVC pipe info level %u  not supported\n",
-				req->info_level);
-		return -EOPNOTSUPP;
+	for (i = 0; i < ctx->num_transfer_syntaxes; i++)
+		if (!memcmp(&syntax[i], &rpc_result_accept.transfer,
+					sizeof(RPC_IFACE)))
+			break;
+	if (i == ctx->num_transfer_syntaxes) {
+		cifsd_debug("context %u: no NDR transfer syntax\n",
+				ctx->context_id);
+		return RPC_REASON_TRANSFER_SYNTAX;
 	}
 
-	return ret;
+	for (i = 0; i < pipe->nr_contexts; i++)
+		if (pipe->contexts[i].id == ctx->context_id)
+			break;
+	if (i == CIFSD_PIPE_CONTEXTS) {
+		cifsd_debug("context %u: too many contexts\n",
+				ctx->context_id);
+		return RPC_REASON_LOCAL_LIMIT;
+	}
+	if (i == pipe->nr_contexts)
+		pipe->nr_contexts++;
+	pipe->contexts[i].id = ctx->context_id;
+	pipe->contexts[i].iface = iface;
+
+	cifsd_debug("context %u bound to %s\n", ctx->context_id,
+			dcerpc_ifaces[iface].table->name);
+	return RPC_REASON_NONE;
 }
 
-/**
- * rpc_request() - rpc request dispatcher
- * @server:	TCP server instance of connection
- * @in_data:	wkssvc request data
- *
- * parse rpc request command number, and call corresponding
- * command handler
- *
- * Return:      0 on success or error number
- */
-static int srvsvc_rpc_request(struct cifsd_pipe *pipe, char *in_data)
+/* whether a winreg bind carries an NTLMSSP negotiate in its verifier */
+static int rpc_bind_negotiate(struct cifsd_pipe *pipe, char *in_data,
+		int len)
 {
-	RPC_REQUEST_REQ *rpc_request_req = (RPC_REQUEST_REQ *)in_data;
-	int opnum;
-	char *data;
-	int ret = 0;
+	RPC_BIND_REQ *req = (RPC_BIND_REQ *)in_data;
+	NEGOTIATE_MESSAGE *negblob;
 
-	opnum = cpu_to_le16(rpc_request_req->opnum);
-	pipe->opnum = opnum;
-	switch (opnum) {
-	case SRV_NET_SHARE_ENUM_ALL:
-		cifsd_debug("Got SRV_NET_SHARE_ENUM_ALL\n");
-		data = in_data + sizeof(RPC_REQUEST_REQ);
-		ret = srvsvc_net_share_enum_all(pipe, data, rpc_request_req);
-		break;
-	case SRV_NET_SHARE_GETINFO:
-		cifsd_debug("Got SRV_NET_SHARE_GETINFO\n");
-		data = in_data + sizeof(RPC_REQUEST_REQ);
-		ret = srvsvc_net_share_info(pipe, data, rpc_request_req);
-		break;
-	case WKSSVC_NET_SHARE_GETINFO:
-		cifsd_debug("Got WKSSVC_SHARE_GETINFO\n");
-		data = in_data + sizeof(RPC_REQUEST_REQ);
-		ret = wkkssvc_net_share_info(pipe, data, rpc_request_req);
-		break;
-	default:
-		cifsd_debug("WKSSVC pipe opnum not supported = %d\n", opnum);
-		return -EOPNOTSUPP;
+	if (pipe->pipe_type != WINREG ||
+			req->hdr.auth_len < sizeof(NEGOTIATE_MESSAGE) ||
+			len - req->hdr.auth_len - (int)sizeof(RPC_AUTH_INFO) <
+			(int)sizeof(RPC_BIND_REQ))
+		return 0;
+
+	cifsd_debug("RPC authentication length %d\n", req->hdr.auth_len);
+	negblob = (NEGOTIATE_MESSAGE *)(in_data + len - req->hdr.auth_len);
+	if (memcmp(negblob->Signature, "NTLMSSP", 8) ||
+			negblob->MessageType != NtLmNegotiate) {
+		cifsd_debug("%s NTLMSSP negotiate not present\n", __func__);
+		return 0;
 	}
-	return ret;
+	return 1;
 }
 
-int winreg_rpc_request(struct cifsd_pipe *pipe, char *in_data)
+/* fragment size for a size proposed by the client */
+static __u16 rpc_frag_size(__u16 size)
 {
-	RPC_REQUEST_REQ *rpc_request_req = (RPC_REQUEST_REQ *)in_data;
-	int opnum;
-	char *data;
-	int ret = 0;
+	if (size < RPC_MIN_FRAG_SIZE)
+		return RPC_MIN_FRAG_SIZE;
+	if (size > RPC_MAX_FRAG_SIZE)
+		return RPC_MAX_FRAG_SIZE;
+	return size;
+}
 
-	opnum = cpu_to_le16(rpc_request_req->opnum);
-	pipe->opnum = opnum;
-	data = in_data + sizeof(RPC_REQUEST_REQ);
-	cifsd_debug("Opnum %d\n", opnum);
-
-	switch (opnum) {
-	case WINREG_OPENHKCR:
-		cifsd_debug("Got WINREG_OPENHKCR\n");
-		/* fall through */
-	case WINREG_OPENHKCU:
-		cifsd_debug("Got WINREG_OPENHKCU\n");
-		/* fall through */
-	case WINREG_OPENHKLM:
-		cifsd_debug("Got WINREG_OPENHKLM\n");
-		/* fall through */
-	case WINREG_OPENHKU:
-		cifsd_debug("Got WINREG_OPENHKU\n");
-		ret = winreg_open_root_key(pipe,
-				opnum, rpc_request_req, data);
-		break;
-	case WINREG_GETVERSION:
-		cifsd_debug("Got WINREG_GETVERSION\n");
-		ret = winreg_get_version(pipe, rpc_request_req, data);
-		break;
-	case WINREG_DELETEKEY:
-		cifsd_debug("Got WINREG_DELETEKEY\n");
-		ret = winreg_delete_key(pipe, rpc_request_req, data);
-		break;
-	case WINREG_FLUSHKEY:
-		cifsd_debug("Got WINREG_FLUSHKEY\n");
-		ret = winreg_flush_key(pipe, rpc_request_req, data);
-		break;
-	case WINREG_OPENKEY:
-		cifsd_debug("Got WINREG_OPENKEY\n");
-		ret = winreg_open_key(pipe, rpc_request_req, data);
-		break;
-	case WINREG_CREATEKEY:
-		cifsd_debug("Got WINREG_CREATEKEY\n");
-		ret = winreg_create_key(pipe, rpc_request_req, data);
-		break;
-	case WINREG_CLOSEKEY:
-		cifsd_debug("Got WINREG_CLOSEKEY\n");
-		ret = winreg_close_key(pipe, rpc_request_req, data);
-		break;
-	case WINREG_ENUMKEY:
-		cifsd_debug("Got WINREG_CLOSEKEY\n");
-		ret = winreg_enum_key(pipe, rpc_request_req, data);
-		break;
-	case WINREG_ENUMVALUE:
-		cifsd_debug("Got WINREG_ENUMVALUE\n");
-		ret = winreg_enum_value(pipe, rpc_request_req, data);
-		break;
-	case WINREG_QUERYINFOKEY:
-		cifsd_debug("Got WINREG_QUERYINFOKEY\n");
-		ret = winreg_query_info_key(pipe, rpc_request_req, data);
-		break;
-	case WINREG_NOTIFYCHANGEKEYVALUE:
-		cifsd_debug("Got WINREG_NOTIFYCHANGEKEYVALUE\n");
-		ret = winreg_notify_change_key_value(pipe, rpc_request_req,
-									data);
-		break;
-	case WINREG_SETVALUE:
-		cifsd_debug("Got WINREG_SETVALUE\n");
-		ret = winreg_set_value(pipe, rpc_request_req, data);
-		break;
-	case WINREG_QUERYVALUE:
-		cifsd_debug("Got WINREG_QUERYVALUE\n");
-		ret = winreg_query_value(pipe, rpc_request_req, data);
-		break;
-	case WINREG_DELETEVALUE:
-		cifsd_debug("Got WINREG_DELETEVALUE\n");
-		ret = winreg_delete_value(pipe, rpc_request_req, data);
-		break;
-	default:
-		cifsd_debug("WINREG pipe opnum not supported = %d\n", opnum);
-		return -EOPNOTSUPP;
+/* bind reply up to its result list, @endpoint NULL for none */
+static void rpc_bind_tmpl_init(struct rpc_bind_tmpl *tmpl, int pkt_type,
+		const char *endpoint)
+{
+	RPC_HDR hdr;
+	struct ndr ndr;
+
+	ndr_init(&ndr, tmpl->data, sizeof(tmpl->data));
+	dcerpc_header_init(&hdr, pkt_type, RPC_FLAG_FIRST | RPC_FLAG_LAST, 0);
+	hdr.frag_len = 0;
+	ndr_write_bytes(&ndr, &hdr, sizeof(hdr));
+
+	if (pkt_type == RPC_BINDNACK) {
+		/* only protocol version 5.0 is offered */
+		ndr_write_int16(&ndr, RPC_NAK_REASON_NONE);
+		ndr_write_int8(&ndr, 1);
+		ndr_write_int8(&ndr, RPC_MAJOR_VER);
+		ndr_write_int8(&ndr, RPC_MINOR_VER);
+	} else {
+		/* fragment sizes and association group are patched in */
+		ndr_write_int16(&ndr, 0);
+		ndr_write_int16(&ndr, 0);
+		ndr_write_int32(&ndr, 0);
+		if (endpoint) {
+			ndr_write_int16(&ndr, strlen(endpoint) + 1);
+			ndr_write_bytes(&ndr, endpoint, strlen(endpoint) + 1);
+		} else {
+			ndr_write_int16(&ndr, 0);
+		}
 	}
-	return ret;
+	ndr_write_align(&ndr, 4);
+
+	/* the endpoints are constants that fit */
+	tmpl->len = ndr.error ? 0 : ndr.offset;
 }
 
-int rpc_request(struct cifsd_pipe *pipe, char *in_data)
+/**
+ * dcerpc_init() - build the bind reply templates and the registry
+ */
+void dcerpc_init(void)
 {
-	int ret = 0;
-	cifsd_debug("server pipe request %d\n", pipe->pipe_type);
-	switch (pipe->pipe_type) {
-	case SRVSVC:
-		cifsd_debug("SRVSVC pipe\n");
-		ret = srvsvc_rpc_request(pipe, in_data);
-		break;
-	case WINREG:
-		cifsd_debug("WINREG pipe\n");
+	int i;
+
+	for (i = 0; i < NR_DCERPC_IFACES; i++)
+		rpc_bind_tmpl_init(&bind_ack_tmpl[i], RPC_BINDACK,
+				dcerpc_ifaces[i].endpoint);
+	rpc_bind_tmpl_init(&bind_ack_tmpl[i], RPC_BINDACK, NULL);
+	rpc_bind_tmpl_init(&bind_nak_tmpl, RPC_BINDNACK, NULL);
 #ifdef WINREG_SUPPORT
-		ret = winreg_rpc_request(pipe, in_data);
-		break;
-#else
-		return -EOPNOTSUPP;
+	if (cifsd_init_registry())
+		cifsd_err("failed to initialize the registry\n");
 #endif
-	default:
-		cifsd_debug("pipe not supported\n");
-		return -EOPNOTSUPP;
+}
+
+/**
+ * rpc_bind_contexts_valid() - check the context list of a bind
+ * @req:	bind or alter_context request
+ * @end:	end of the request PDU
+ *
+ * Return:	1 if every proposed context and its transfer syntaxes are
+ *		within the PDU and can be answered, otherwise 0
+ */
+static int rpc_bind_contexts_valid(RPC_BIND_REQ *req, char *end)
+{
+	char *p = (char *)(req + 1);
+	RPC_CONTEXT *ctx;
+	int i;
+
+	if (req->num_contexts > CIFSD_BIND_RESULTS) {
+		cifsd_debug("%u contexts proposed, at most %d answered\n",
+				req->num_contexts, CIFSD_BIND_RESULTS);
+		return 0;
 	}
-	return ret;
+
+	for (i = 0; i < req->num_contexts; i++) {
+		ctx = (RPC_CONTEXT *)p;
+		if (p + sizeof(RPC_CONTEXT) > end ||
+				p + sizeof(RPC_CONTEXT) +
+				ctx->num_transfer_syntaxes * sizeof(RPC_IFACE) >
+				end) {
+			cifsd_debug("context list cut short\n");
+			return 0;
+		}
+		p += sizeof(RPC_CONTEXT) +
+			ctx->num_transfer_syntaxes * sizeof(RPC_IFACE);
+	}
+	return 1;
 }
 
 /**
- * rpc_bind() - rpc bind request handler
- * @server:	TCP server instance of connection
- * @in_data:	rpc bind request data
+ * rpc_bind() - bind and alter_context request handler
+ * @pipe:	pipe the request came in on
+ * @in_data:	request PDU
+ * @len:	request length
+ *
+ * Every presentation context of the request gets a result of its own.
+ * A bind starts the pipe over: it joins the association group the
+ * client names, or a new one, and an unknown group is refused with a
+ * bind_nak, as is a malformed context list. alter_context adds contexts
+ * to a bound pipe and is answered without secondary address, one with
+ * a malformed context list fails and leaves the pipe as it was.
+ *
+ * Only the outcome is recorded here and queued behind the replies of
+ * earlier requests, a pipe read builds the reply from a template. A
+ * bind drops the replies not read yet.
  *
  * Return:      0 on success or error number
  */
-int rpc_bind(struct cifsd_pipe *pipe, char *in_data)
+int rpc_bind(struct cifsd_pipe *pipe, char *in_data, int len)
 {
-	RPC_BIND_REQ *rpc_bind_req = (RPC_BIND_REQ *)in_data;
-	char *pipe_name = NULL;
-	int len;
-	RPC_CONTEXT *rpc_context;
-	RPC_IFACE *transfer;
-	RPC_BIND_RSP *rpc_bind_rsp;
-	int version_maj;
-	int pipe_type;
-	int num_ctx;
-	int i = 0;
-	int offset = 0;
-
-	rpc_context = (RPC_CONTEXT *)(((char *)in_data) + sizeof(RPC_BIND_REQ));
-	transfer = (RPC_IFACE *)(((char *)in_data) + sizeof(RPC_BIND_REQ) +
-				   sizeof(RPC_CONTEXT));
-	rpc_bind_rsp = (RPC_BIND_RSP *) calloc(1, sizeof(RPC_BIND_RSP));
-	if (!rpc_bind_rsp)
-		return -ENOMEM;
-
-	version_maj = rpc_context->abstract.version_maj;
-	pipe_type = pipe->pipe_type;
+	RPC_BIND_REQ *req = (RPC_BIND_REQ *)in_data;
+	int alter = req->hdr.pkt_type == RPC_ALTCONT;
+	char *p = in_data + sizeof(RPC_BIND_REQ), *end = in_data + len;
+	struct cifsd_rpc_rsp *rsp;
+	RPC_CONTEXT *ctx;
+	int valid, i;
+
+	if (len < sizeof(RPC_BIND_REQ))
+		return -EINVAL;
+	if (alter && !pipe->assoc_gid) {
+		cifsd_debug("alter_context on a pipe not bound\n");
+		return -EINVAL;
+	}
 
-	pipe->data = (char *)rpc_bind_rsp;
+	cifsd_debug("incoming call id = %u frag_len = %u contexts = %u\n",
+			req->hdr.call_id, req->hdr.frag_len, req->num_contexts);
+	cifsd_debug("max_tsize = %u max_rsize = %u assoc_gid = 0x%x\n",
+			req->max_tsize, req->max_rsize, req->assoc_gid);
 
-	rpc_bind_rsp->addr.sec_addr = malloc(256);
-	if (!rpc_bind_rsp->addr.sec_addr) {
-		free(rpc_bind_rsp);
-		return -ENOMEM;
+	/* the results of one bind or alter_context are kept at a time */
+	if (alter && pipe->bind_rsp) {
+		cifsd_debug("alter_context before the last bind reply was read\n");
+		return -EBUSY;
 	}
 
-	/* Initialize header */
-	dcerpc_header_init(&rpc_bind_rsp->hdr, RPC_BINDACK,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_bind_req->hdr.call_id);
-	cifsd_debug("incoming call id = %u frag_len = %u\n",
-		      rpc_bind_req->hdr.call_id, rpc_bind_req->hdr.frag_len);
-
-	/* Update bind info */
-	rpc_bind_rsp->bind_info.max_tsize = rpc_bind_req->max_tsize;
-	rpc_bind_rsp->bind_info.max_rsize = rpc_bind_req->max_rsize;
-	/* Using hard coded assoc_gid value */
-	rpc_bind_rsp->bind_info.assoc_gid = 0x53f0;
-
-	num_ctx = rpc_bind_req->num_contexts;
-
-	cifsd_debug("max_tsize = %u max_rsize = %u\n",
-		       rpc_bind_req->max_tsize, rpc_bind_req->max_rsize);
-	cifsd_debug("RPC authentication length %d\n",
-						rpc_bind_req->hdr.auth_len);
-	/* Update pipe name*/
-	if (pipe_type == SRVSVC) {
-		if (version_maj == 3)
-			pipe_name = "\\PIPE\\srvsvc";
-		else if (version_maj == 1)
-			pipe_name = "\\PIPE\\wkssvc";
-	} else if (pipe_type == WINREG) {
-		pipe_name = "\\PIPE\\winreg";
-		rpc_bind_rsp->BufferLength = 0;
-		if (rpc_bind_req->hdr.auth_len != 0) {
-			NEGOTIATE_MESSAGE *negblob;
-			CHALLENGE_MESSAGE *chgblob;
-			__le16 name[8];
-			while (i < num_ctx) {
-				offset  = offset + sizeof(RPC_CONTEXT);
-				i++;
-			}
-			rpc_bind_rsp->auth.auth_type = 10;
-			rpc_bind_rsp->auth.auth_level = 6;
-			rpc_bind_rsp->auth.auth_pad_len = 0;
-			rpc_bind_rsp->auth.auth_reserved = 0;
-			rpc_bind_rsp->auth.auth_ctx_id = 1;
-			negblob = (NEGOTIATE_MESSAGE *)(((char *)in_data) +
-						sizeof(RPC_BIND_REQ) +
-						offset + sizeof(RPC_AUTH_INFO));
-			if (!memcmp(negblob->Signature, "NTLMSSP", 8))
-				cifsd_debug("%s NTLMSSP present\n", __func__);
-			else
-				cifsd_debug("%s NTLMSSP not present\n",
-								__func__);
-			if (negblob->MessageType == NtLmNegotiate) {
-				cifsd_debug("%s negotiate phase\n", __func__);
-				len = smbConvertToUTF16(name, netbios_name,
-							strlen(netbios_name),8,
-							pipe->codepage);
-				rpc_bind_rsp->Buffer = calloc(1,
-					sizeof(CHALLENGE_MESSAGE) +
-					sizeof(TargetInfo)*5 +
-					UNICODE_LEN(len)*4);
-				chgblob = (CHALLENGE_MESSAGE *)
-						rpc_bind_rsp->Buffer;
-				rpc_bind_rsp->BufferLength =
-					build_ntlmssp_challenge_blob(chgblob,
-							pipe->codepage);
-			}
+	/* nothing of the pipe changes before the request is checked */
+	valid = rpc_bind_contexts_valid(req, end);
+	if (alter && !valid)
+		return -EINVAL;
+
+	if (!alter)
+		dcerpc_pipe_release(pipe);
+	rsp = rpc_rsp_queue(pipe, req->hdr.call_id);
+	if (IS_ERR(rsp))
+		return PTR_ERR(rsp);
+	pipe->call_id = req->hdr.call_id;
+
+	if (!alter) {
+		rpc_assoc_leave(pipe);
+		pipe->nr_contexts = 0;
+		if (!valid || rpc_assoc_join(pipe, req->assoc_gid)) {
+			pipe->bind_rsp = RPC_BINDNACK;
+			goto queue;
 		}
 
-	} else {
-		cifsd_err("invalid version %d\n", version_maj);
-		free(rpc_bind_rsp->addr.sec_addr);
-		free(rpc_bind_rsp);
-		return -EINVAL;
+		/* our fragments must fit the client's max_rsize */
+		pipe->max_frag = rpc_frag_size(req->max_rsize);
+		pipe->max_recv = rpc_frag_size(req->max_tsize);
+
+		/* the ack names the endpoint of the interface bound first */
+		pipe->bind_iface = -1;
+		ctx = (RPC_CONTEXT *)p;
+		if (req->num_contexts)
+			pipe->bind_iface = rpc_iface_find(pipe->pipe_type,
+					&ctx->abstract);
 	}
 
-	memcpy(rpc_bind_rsp->addr.sec_addr, pipe_name, strlen(pipe_name));
-	len = strlen(pipe_name) + 1;
-	rpc_bind_rsp->addr.sec_addr[len - 1] = '\0';
-	rpc_bind_rsp->addr.sec_addr_len = len;
-	cifsd_debug("pipe_name len = %d\n", len);
-
-	/* Results */
-	rpc_bind_rsp->results.num_results = 1;
-	rpc_bind_rsp->results.reserved1 = 0;
-	rpc_bind_rsp->results.reserved2 = 0;
-	rpc_bind_rsp->results.result = 0;
-	rpc_bind_rsp->results.reason = 0;
-
-	/* Interface */
-	rpc_bind_rsp->transfer = malloc(sizeof(RPC_IFACE));
-	if (!rpc_bind_rsp->transfer) {
-		free(rpc_bind_rsp->addr.sec_addr);
-		free(rpc_bind_rsp);
-		return -ENOMEM;
+	for (i = 0; i < req->num_contexts; i++) {
+		ctx = (RPC_CONTEXT *)p;
+		p += sizeof(RPC_CONTEXT) +
+			ctx->num_transfer_syntaxes * sizeof(RPC_IFACE);
+
+		pipe->results[i] = rpc_context_bind(pipe, ctx);
 	}
+	pipe->nr_results = req->num_contexts;
+
+	pipe->bind_auth = !alter && req->hdr.auth_len &&
+		rpc_bind_negotiate(pipe, in_data, len);
+	pipe->bind_rsp = alter ? RPC_ALTCONTRESP : RPC_BINDACK;
+queue:
+	rsp->pkt_type = pipe->bind_rsp;
+	rpc_rsp_commit(pipe);
+	return 0;
+}
+
+/* RAP share names are limited to 12 characters, srvsvc lists the rest */
+static int rap_share_listed(struct cifsd_share *share)
+{
+	NETSHAREINFO1 *info1;
 
-	cifsd_debug("num syntaxes = %u\n",
-		       rpc_context->num_transfer_syntaxes);
+	if (strlen(share->sharename) < sizeof(info1->NetworkName))
+		return 1;
 
-	memcpy(rpc_bind_rsp->transfer, transfer, sizeof(RPC_IFACE));
+	cifsd_debug("Not listing share %s over RAP\n", share->sharename);
 	return 0;
 }
 
@@ -1591,7 +1992,10 @@ static int handle_netshareenum_info1(struct cifsd_pipe *pipe,
 
 	resp = (LANMAN_NETSHAREENUM_RESP *)out_data;
 	info1 = (NETSHAREINFO1 *)resp->RAPOutData;
-	num_shares = cifsd_num_shares;
+	list_for_each(tmp, &cifsd_share_list) {
+		share = list_entry(tmp, struct cifsd_share, list);
+		num_shares += rap_share_listed(share);
+	}
 	comment_offset = num_shares * sizeof(NETSHAREINFO1);
 
 /*
@@ -1600,8 +2004,11 @@ static int handle_netshareenum_info1(struct cifsd_pipe *pipe,
  */
 #if 1
 	list_for_each(tmp, &cifsd_share_list) {
-		memset(info1, 0, sizeof(NETSHAREINFO1));
 		share = list_entry(tmp, struct cifsd_share, list);
+		if (!rap_share_listed(share))
+			continue;
+
+		memset(info1, 0, sizeof(NETSHAREINFO1));
 		memcpy(info1->NetworkName, share->sharename,
 			strlen(share->sharename));
 
@@ -1622,7 +2029,7 @@ static int handle_netshareenum_info1(struct cifsd_pipe *pipe,
 				       comment_len);
 			} else {
 				comment_len = strlen(share->sharename);
-				memcpy(comment_buf, share->config.comment,
+				memcpy(comment_buf, share->sharename,
 				       comment_len);
 			}
 			info1->Type = STYPE_DISKTREE;
@@ -32,6 +32,7 @@
 #define WERR_NOT_SUPPORTED	0x00000032
 #define WERR_INVALID_PARAMETER	0x00000057
 #define WERR_INVALID_NAME	0x0000007B
+#define WERR_UNKNOWN_LEVEL	0x0000007C
 #define WERR_MORE_DATA		0x000000EA
 #define WERR_NO_MORE_DATA	0x00000103
 
@@ -42,6 +43,13 @@
 #define RPC_FLAG_FIRST	0x01
 #define RPC_FLAG_LAST	0x02
 
+/*
+ * Fragment sizes negotiated at bind time. Clients must accept fragments
+ * of RPC_MIN_FRAG_SIZE, larger ones are capped the way Windows does.
+ */
+#define RPC_MIN_FRAG_SIZE	1432
+#define RPC_MAX_FRAG_SIZE	4280
+
 /* DCE/RPC packet types */
 enum RPC_PKT_TYPE {
 	RPC_REQUEST	= 0x00,    /* Ordinary request. */
@@ -66,6 +74,19 @@ enum RPC_PKT_TYPE {
 	RPC_ORPHANED	= 0x13
 };
 
+/* presentation context results, p_cont_def_result_t */
+#define RPC_RESULT_ACCEPT		0
+#define RPC_RESULT_PROVIDER_REJECT	2
+
+/* provider rejection reasons, p_provider_reason_t */
+#define RPC_REASON_NONE			0
+#define RPC_REASON_ABSTRACT_SYNTAX	1
+#define RPC_REASON_TRANSFER_SYNTAX	2
+#define RPC_REASON_LOCAL_LIMIT		3
+
+/* bind_nak reject reason, p_reject_reason_t */
+#define RPC_NAK_REASON_NONE		0
+
 /* SRVSVC pipe packet types*/
 
 #define SRV_NET_SHARE_ENUM_ALL     0x0f
@@ -88,9 +109,16 @@ enum RPC_PKT_TYPE {
 
 /* Info Level Values*/
 
+#define INFO_0		0
 #define INFO_1		1
+#define INFO_2		2
 #define INFO_10		10
 #define INFO_100	100
+#define INFO_501	501
+#define INFO_502	502
+
+/* NetWkstaGetInfo platform ids */
+#define PLATFORM_ID_NT	500
 
 /* RPC_HDR - dce rpc header */
 typedef struct rpc_hdr_info {
@@ -161,35 +189,18 @@ typedef struct rpc_request_rsp {
 	__u8 reserved;
 } __attribute__((packed)) RPC_REQUEST_RSP;
 
-typedef struct rpc_addr_info {
-	__u16	sec_addr_len;
-	char	*sec_addr;
-} RPC_ADDR_INFO;
-
-typedef struct rpc_results_info {
-	__u8 num_results; /* the number of results (0x01) */
-	__u8 reserved1;
-	__u16 reserved2;
-	__u16 result; /* result (0x00 = accept) */
-	__u16 reason; /* reason (0x00 = no reason specified) */
-} __attribute__((packed)) RPC_RESULTS;
-
 typedef struct bind_ack_info {
 	__u16  max_tsize;
 	__u16  max_rsize;
 	__u32  assoc_gid;
 } __attribute__((packed)) BIND_ACK_INFO;
 
-typedef struct rpc_bind_rsp {
-	RPC_HDR hdr;
-	BIND_ACK_INFO bind_info;
-	RPC_ADDR_INFO addr;
-	RPC_RESULTS results;
-	RPC_IFACE *transfer;
-	RPC_AUTH_INFO auth;
-	__u32 BufferLength;
-	__u8 *Buffer;
-} RPC_BIND_RSP;
+/* negotiation result of one presentation context */
+typedef struct rpc_result {
+	__u16 result; /* RPC_RESULT_* */
+	__u16 reason; /* RPC_REASON_* if rejected */
+	RPC_IFACE transfer; /* accepted transfer syntax, zero if rejected */
+} __attribute__((packed)) RPC_RESULT;
 
 /* SRVSVC structures */
 
@@ -204,79 +215,6 @@ typedef struct server_handle {
 	UNISTR_INFO handle_info;
 } __attribute__((packed)) SERVER_HANDLE;
 
-typedef struct srvsvc_req {
-	SERVER_HANDLE server_unc_handle;
-	char  *server_unc; /* unicode */
-	__u32 info_level;
-} SRVSVC_REQ;
-
-typedef struct srvsvc_share_ptr_info1 {
-	__u32 ptr_netname; /* pointer to net name. */
-	__u32 type; /* ipc, print, disk ... */
-	__u32 ptr_remark; /* pointer to comment. */
-} __attribute__((packed)) PTR_INFO1;
-
-typedef struct srvsvc_share_info1 {
-	UNISTR_INFO str_info1;
-	char sharename[256];
-	UNISTR_INFO str_info2;
-	char comment[256];
-} SRVSVC_SHARE_INFO1;
-
-typedef struct srvsvc_share_common_info {
-	__u32 info_level;
-	__u32 switch_value;
-	__u32 ptr_share_info;
-
-	__u32 num_entries;
-	__u32 ptr_entries;
-	__u32 num_entries2;
-} __attribute__((packed)) SRVSVC_SHARE_COMMON_INFO;
-
-typedef struct srvsvc_share_info_ctr {
-	RPC_REQUEST_RSP rpc_request_rsp;
-	SRVSVC_SHARE_COMMON_INFO info;
-
-	PTR_INFO1 *ptrs;
-	SRVSVC_SHARE_INFO1 *shares;
-	__u32 total_entries;
-	__u32 resume_handle;
-	__u32 status;
-} SRVSVC_SHARE_INFO_CTR;
-
-typedef struct srvsvc_share_getinfo {
-	RPC_REQUEST_RSP rpc_request_rsp;
-	__u32 info_level;
-	__u32 switch_value;
-	__u32 ptr_share_info;
-
-	PTR_INFO1 *ptrs;
-
-	SRVSVC_SHARE_INFO1 *shares;
-	__u32 status;
-} SRVSVC_SHARE_GETINFO;
-
-typedef struct wkssvc_share_info1 {
-	UNISTR_INFO str_info1;
-	char server_name[256];
-	UNISTR_INFO str_info2;
-	char domain_name[256];
-} WKSSVC_SHARE_INFO1;
-
-
-typedef struct wkssvc_share_getinfo {
-	RPC_REQUEST_RSP rpc_request_rsp;
-	__u32 info_level;
-	__u32 refid;
-	__u32 platform_id;
-	__u32 ref_id1;
-	__u32 ref_id2;
-	__u32 maj;
-	__u32 min;
-	WKSSVC_SHARE_INFO1 *shares;
-	__u32 status;
-} WKSSVC_SHARE_GETINFO;
-
 /* LANMAN PIPE STRUCTURES */
 
 typedef struct lanman_params {
@@ -324,18 +262,21 @@ typedef struct netwkstageinfo10 {
 
 /* DCERPC Functions */
 
-int process_rpc(struct cifsd_pipe *pipe, char *data);
+int process_rpc(struct cifsd_pipe *pipe, char *data, int len);
 int process_rpc_rsp(struct cifsd_pipe *pipe, char *data_buf, int size);
+void dcerpc_pipe_release(struct cifsd_pipe *pipe);
+void dcerpc_pipe_close(struct cifsd_pipe *pipe);
+void dcerpc_init(void);
 
 void dcerpc_header_init(RPC_HDR *header, int packet_type,
 					int flags, int call_id);
-int rpc_bind(struct cifsd_pipe *pipe, char *data);
-int rpc_request(struct cifsd_pipe *pipe, char *data);
-int rpc_read_bind_data(struct cifsd_pipe *pipe, char *data);
-int rpc_read_winreg_data(struct cifsd_pipe *pipe, char *outdata,
-							int buf_len);
+int rpc_bind(struct cifsd_pipe *pipe, char *data, int len);
+int rpc_request(struct cifsd_pipe *pipe, char *data, int len);
+int rpc_read_bind_data(struct cifsd_pipe *pipe, char *data, int buf_len);
+struct ndr_call;
+int dcerpc_reply(struct cifsd_pipe *pipe, const struct ndr_call *call,
+		const void *r);
 
-int winreg_rpc_request(struct cifsd_pipe *pipe, char *in_data);
 /* SRVSVC pipe function */
 
 int rpc_read_srvsvc_data(struct cifsd_pipe *pipe,
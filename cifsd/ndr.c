@@ -0,0 +1,475 @@
+/*
+ *   cifsd-tools/cifsd/ndr.c
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcerpc.h"
+#include "ndr.h"
+#include "pool.h"
+
+/* first referent id, as Windows and Samba number them */
+#define NDR_REF_ID_BASE		0x00020000
+
+char ndr_pending;
+
+/**
+ * ndr_init() - start encoding into a caller provided buffer
+ * @ndr:	writer
+ * @buf:	buffer
+ * @size:	buffer size, writing past it fails with -ENOSPC
+ */
+void ndr_init(struct ndr *ndr, char *buf, int size)
+{
+	memset(ndr, 0, sizeof(*ndr));
+	ndr->data = buf;
+	ndr->size = size;
+	ndr->ref_id = NDR_REF_ID_BASE - 4;
+}
+
+/**
+ * ndr_init_alloc() - start encoding into a buffer that grows as needed
+ * @ndr:	writer
+ * @size:	initial size
+ *
+ * The buffer belongs to the caller once encoding is done, ndr_free()
+ * releases it.
+ *
+ * Return:	0 on success, otherwise -ENOMEM
+ */
+int ndr_init_alloc(struct ndr *ndr, int size)
+{
+	ndr_init(ndr, malloc(size), size);
+	if (!ndr->data)
+		return -ENOMEM;
+	ndr->grow = 1;
+	return 0;
+}
+
+void ndr_free(struct ndr *ndr)
+{
+	if (ndr->grow)
+		free(ndr->data);
+	ndr->data = NULL;
+}
+
+/**
+ * ndr_set_error() - fail encoding or decoding
+ * @ndr:	writer or reader
+ * @error:	negative error number, kept only if nothing failed before
+ *
+ * Return:	the first error
+ */
+int ndr_set_error(struct ndr *ndr, int error)
+{
+	if (!ndr->error)
+		ndr->error = error;
+	return ndr->error;
+}
+
+/* make room for @len more bytes, return where they go or NULL */
+static char *ndr_reserve(struct ndr *ndr, int len)
+{
+	int size = ndr->size;
+	char *data;
+
+	if (ndr->error)
+		return NULL;
+
+	if (ndr->offset + len > ndr->size) {
+		if (!ndr->grow) {
+			ndr->error = -ENOSPC;
+			return NULL;
+		}
+
+		while (ndr->offset + len > size)
+			size *= 2;
+		data = realloc(ndr->data, size);
+		if (!data) {
+			ndr->error = -ENOMEM;
+			return NULL;
+		}
+		ndr->data = data;
+		ndr->size = size;
+	}
+	return ndr->data + ndr->offset;
+}
+
+/**
+ * ndr_write_align() - pad with zeroes up to a multiple of @n
+ * @ndr:	writer
+ * @n:		alignment, a power of two
+ */
+void ndr_write_align(struct ndr *ndr, int n)
+{
+	int pad = (n - (ndr->offset & (n - 1))) & (n - 1);
+	char *p;
+
+	if (!pad)
+		return;
+
+	p = ndr_reserve(ndr, pad);
+	if (!p)
+		return;
+	memset(p, 0, pad);
+	ndr->offset += pad;
+}
+
+void ndr_write_bytes(struct ndr *ndr, const void *src, int len)
+{
+	char *p = ndr_reserve(ndr, len);
+
+	if (!p)
+		return;
+	memcpy(p, src, len);
+	ndr->offset += len;
+}
+
+void ndr_write_int8(struct ndr *ndr, __u8 val)
+{
+	ndr_write_bytes(ndr, &val, sizeof(val));
+}
+
+void ndr_write_int16(struct ndr *ndr, __u16 val)
+{
+	__le16 v = cpu_to_le16(val);
+
+	ndr_write_align(ndr, 2);
+	ndr_write_bytes(ndr, &v, sizeof(v));
+}
+
+void ndr_write_int32(struct ndr *ndr, __u32 val)
+{
+	__le32 v = cpu_to_le32(val);
+
+	ndr_write_align(ndr, 4);
+	ndr_write_bytes(ndr, &v, sizeof(v));
+}
+
+void ndr_write_int64(struct ndr *ndr, __u64 val)
+{
+	__le64 v = cpu_to_le64(val);
+
+	ndr_write_align(ndr, 8);
+	ndr_write_bytes(ndr, &v, sizeof(v));
+}
+
+/**
+ * ndr_write_ptr() - write a unique pointer
+ * @ndr:	writer
+ * @ptr:	pointer being encoded, only its NULLness matters
+ *
+ * A non-NULL pointer gets the next referent id. The referent itself is
+ * written later, in the buffers pass.
+ */
+void ndr_write_ptr(struct ndr *ndr, const void *ptr)
+{
+	if (!ptr) {
+		ndr_write_int32(ndr, 0);
+		return;
+	}
+
+	ndr->ref_id += 4;
+	ndr_write_int32(ndr, ndr->ref_id);
+}
+
+/**
+ * ndr_write_unistr() - write a NUL terminated conformant varying string
+ * @ndr:	writer
+ * @str:	string in @codepage
+ * @codepage:	encoding of @str
+ *
+ * The string is converted to UTF-16 straight into the output buffer,
+ * max_count and actual_count are filled in from the converted length.
+ */
+void ndr_write_unistr(struct ndr *ndr, const char *str, const char *codepage)
+{
+	int len = strlen(str), hdr, count;
+	char *p;
+
+	ndr_write_align(ndr, 4);
+	hdr = ndr->offset;
+	/* a character never takes more UTF-16 bytes than twice its size */
+	p = ndr_reserve(ndr, 12 + 2 * len + 2);
+	if (!p)
+		return;
+
+	count = smbConvertToUTF16((__le16 *)(p + 12), (char *)str, len,
+			2 * len, codepage);
+	if (count < 0) {
+		ndr->error = count;
+		return;
+	}
+	memset(p + 12 + count, 0, 2);
+	count = count / 2 + 1;
+
+	ndr_write_int32(ndr, count);	/* max_count */
+	ndr_write_int32(ndr, 0);	/* offset */
+	ndr_write_int32(ndr, count);	/* actual_count */
+	ndr->offset = hdr + 12 + 2 * count;
+}
+
+/**
+ * ndr_init_pull() - start decoding a request
+ * @ndr:	reader
+ * @buf:	NDR stream
+ * @size:	bytes of @buf that belong to the stream
+ * @codepage:	encoding strings are converted to
+ *
+ * Decoded objects come from the arena of the calling thread, so a
+ * thread decodes one request at a time.
+ */
+void ndr_init_pull(struct ndr *ndr, char *buf, int size,
+		const char *codepage)
+{
+	ndr_init(ndr, buf, size);
+	ndr->codepage = codepage;
+	ndr->arena = cifsd_arena_get();
+}
+
+/**
+ * ndr_pull_free() - release everything decoded from a request
+ * @ndr:	reader
+ *
+ * So is everything else the handler took from the arena.
+ */
+void ndr_pull_free(struct ndr *ndr)
+{
+	if (ndr->arena)
+		cifsd_arena_reset(ndr->arena);
+	ndr->arena = NULL;
+}
+
+/**
+ * ndr_alloc() - allocate a decoded object
+ * @ndr:	reader
+ * @size:	object size
+ *
+ * Objects are zeroed and live until ndr_pull_free(), handlers use it
+ * for their scratch memory too.
+ *
+ * Return:	object, or NULL if decoding failed already or on -ENOMEM
+ */
+void *ndr_alloc(struct ndr *ndr, size_t size)
+{
+	void *obj;
+
+	if (ndr->error)
+		return NULL;
+
+	obj = cifsd_arena_alloc(ndr->arena, size);
+	if (!obj)
+		ndr_set_error(ndr, -ENOMEM);
+	return obj;
+}
+
+/**
+ * ndr_alloc_array() - allocate a decoded conformant array
+ * @ndr:	reader
+ * @count:	elements announced on the wire
+ * @size:	host size of an element
+ * @wire_size:	smallest number of stream bytes an element takes
+ *
+ * A count larger than what the rest of the stream could hold fails
+ * with -EINVAL instead of allocating on behalf of the client.
+ *
+ * Return:	zeroed array, or NULL on failure or for an empty array
+ */
+void *ndr_alloc_array(struct ndr *ndr, __u32 count, size_t size,
+		int wire_size)
+{
+	if (!count)
+		return NULL;
+	if ((__u64)count * (wire_size ? wire_size : 1) >
+			ndr->size - ndr->offset) {
+		ndr_set_error(ndr, -EINVAL);
+		return NULL;
+	}
+	return ndr_alloc(ndr, (size_t)count * size);
+}
+
+/* consume @len bytes, return where they are or NULL past the end */
+static char *ndr_consume(struct ndr *ndr, int len)
+{
+	char *p;
+
+	if (ndr->error)
+		return NULL;
+	if (len < 0 || len > ndr->size - ndr->offset) {
+		ndr->error = -EINVAL;
+		return NULL;
+	}
+	p = ndr->data + ndr->offset;
+	ndr->offset += len;
+	return p;
+}
+
+/**
+ * ndr_read_align() - skip the padding up to a multiple of @n
+ * @ndr:	reader
+ * @n:		alignment, a power of two
+ */
+void ndr_read_align(struct ndr *ndr, int n)
+{
+	ndr_consume(ndr, (n - (ndr->offset & (n - 1))) & (n - 1));
+}
+
+void ndr_read_bytes(struct ndr *ndr, void *dst, int len)
+{
+	char *p = ndr_consume(ndr, len);
+
+	if (p)
+		memcpy(dst, p, len);
+	else
+		memset(dst, 0, len);
+}
+
+__u8 ndr_read_int8(struct ndr *ndr)
+{
+	__u8 v;
+
+	ndr_read_bytes(ndr, &v, sizeof(v));
+	return v;
+}
+
+__u16 ndr_read_int16(struct ndr *ndr)
+{
+	__le16 v;
+
+	ndr_read_align(ndr, 2);
+	ndr_read_bytes(ndr, &v, sizeof(v));
+	return le16_to_cpu(v);
+}
+
+__u32 ndr_read_int32(struct ndr *ndr)
+{
+	__le32 v;
+
+	ndr_read_align(ndr, 4);
+	ndr_read_bytes(ndr, &v, sizeof(v));
+	return le32_to_cpu(v);
+}
+
+__u64 ndr_read_int64(struct ndr *ndr)
+{
+	__le64 v;
+
+	ndr_read_align(ndr, 8);
+	ndr_read_bytes(ndr, &v, sizeof(v));
+	return le64_to_cpu(v);
+}
+
+/**
+ * ndr_read_ptr() - read a unique or full pointer
+ * @ndr:	reader
+ *
+ * Return:	referent id, 0 for a NULL pointer
+ */
+__u32 ndr_read_ptr(struct ndr *ndr)
+{
+	return ndr_read_int32(ndr);
+}
+
+/**
+ * ndr_read_unistr() - read a conformant varying UTF-16 string
+ * @ndr:	reader
+ *
+ * The counts must describe a string that lies within the stream, the
+ * terminating NUL is optional. The result is converted to the reader
+ * codepage.
+ *
+ * Return:	string owned by the reader, or NULL on failure
+ */
+char *ndr_read_unistr(struct ndr *ndr)
+{
+	__u32 max_count, offset, count;
+	char *src, *str;
+	int len;
+
+	max_count = ndr_read_int32(ndr);
+	offset = ndr_read_int32(ndr);
+	count = ndr_read_int32(ndr);
+	if (ndr->error)
+		return NULL;
+	if (offset || count > max_count ||
+			count > (ndr->size - ndr->offset) / 2) {
+		ndr_set_error(ndr, -EINVAL);
+		return NULL;
+	}
+
+	src = ndr_consume(ndr, 2 * count);
+	if (count && !src[2 * count - 2] && !src[2 * count - 1])
+		count--;
+
+	/* no codepage needs more than four bytes for a UTF-16 unit */
+	str = ndr_alloc(ndr, 4 * count + 1);
+	if (!str)
+		return NULL;
+
+	len = smbConvertFromUTF16(str, src, 2 * count, 4 * count,
+			ndr->codepage);
+	if (len < 0) {
+		ndr_set_error(ndr, len);
+		return NULL;
+	}
+	str[len] = '\0';
+	return str;
+}
+
+/**
+ * ndr_rpc_rsp_begin() - start a DCE/RPC response PDU
+ * @ndr:	writer, empty
+ * @call_id:	call_id of the request
+ * @context_id:	presentation context of the request
+ *
+ * frag_len and alloc_hint are filled in by ndr_rpc_rsp_end().
+ */
+void ndr_rpc_rsp_begin(struct ndr *ndr, __u32 call_id, __u16 context_id)
+{
+	RPC_REQUEST_RSP *rsp;
+
+	rsp = (RPC_REQUEST_RSP *)ndr_reserve(ndr, sizeof(*rsp));
+	if (!rsp)
+		return;
+
+	memset(rsp, 0, sizeof(*rsp));
+	dcerpc_header_init(&rsp->hdr, RPC_RESPONSE,
+			RPC_FLAG_FIRST | RPC_FLAG_LAST, call_id);
+	rsp->context_id = context_id;
+	ndr->offset += sizeof(*rsp);
+}
+
+/**
+ * ndr_rpc_rsp_end() - finish a response started by ndr_rpc_rsp_begin()
+ * @ndr:	writer
+ *
+ * Return:	PDU length, or the first error hit while encoding
+ */
+int ndr_rpc_rsp_end(struct ndr *ndr)
+{
+	RPC_REQUEST_RSP *rsp = (RPC_REQUEST_RSP *)ndr->data;
+
+	if (ndr->error)
+		return ndr->error;
+
+	rsp->hdr.frag_len = ndr->offset;
+	rsp->alloc_hint = ndr->offset - sizeof(RPC_REQUEST_RSP);
+	return ndr->offset;
+}
@@ -0,0 +1,116 @@
+/*
+ *   cifsd-tools/cifsd/ndr.h
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef __CIFSD_TOOLS_NDR_H
+#define __CIFSD_TOOLS_NDR_H
+
+#include "cifsd.h"
+
+/*
+ * Streaming NDR writer and bounds checked reader. Replies are encoded
+ * in a single pass straight into their final buffer, which is either
+ * fixed or grows as needed. Requests are decoded in place, every read
+ * is checked against the end of the buffer. Primitives are aligned to
+ * their size. The first failure sticks in ->error and turns every
+ * later access into a no-op, so marshalling code only checks the
+ * result once at the end.
+ */
+struct cifsd_arena;
+
+struct ndr {
+	char	*data;
+	int	offset;
+	int	size;
+	int	grow;		/* data is ours and may be reallocated */
+	__u32	ref_id;		/* last referent id handed out */
+	int	error;
+	const char *codepage;	/* host side encoding of strings */
+	struct cifsd_arena *arena; /* decoded objects, see ndr_pull_free() */
+};
+
+/*
+ * Encoder passes: scalars are the fixed part of a structure, buffers
+ * are the referents of its pointers. A conformant array of structures
+ * writes the scalars of all elements before any of their buffers.
+ */
+#define NDR_SCALARS	0x1
+#define NDR_BUFFERS	0x2
+
+/*
+ * Set by the scalars pass of a decoder for a non-NULL embedded pointer,
+ * replaced with the decoded referent by the buffers pass.
+ */
+extern char ndr_pending;
+#define NDR_PENDING	((void *)&ndr_pending)
+
+/*
+ * Interface tables emitted by ndrgen. calls[] is indexed by opnum and
+ * has holes, ->name is NULL for opnums the IDL does not describe.
+ */
+struct ndr_call {
+	const char	*name;
+	size_t		size;		/* of the call structure */
+	int		(*pull_in)(struct ndr *ndr, void *r);
+	int		(*push_out)(struct ndr *ndr, const void *r);
+};
+
+struct ndr_interface {
+	const char		*name;
+	__u8			uuid[16];	/* wire order */
+	__u16			version_major;
+	__u16			version_minor;
+	int			nr_calls;
+	const struct ndr_call	*calls;
+};
+
+void ndr_init(struct ndr *ndr, char *buf, int size);
+int ndr_init_alloc(struct ndr *ndr, int size);
+void ndr_free(struct ndr *ndr);
+int ndr_set_error(struct ndr *ndr, int error);
+
+void ndr_write_align(struct ndr *ndr, int n);
+void ndr_write_int8(struct ndr *ndr, __u8 val);
+void ndr_write_int16(struct ndr *ndr, __u16 val);
+void ndr_write_int32(struct ndr *ndr, __u32 val);
+void ndr_write_int64(struct ndr *ndr, __u64 val);
+void ndr_write_bytes(struct ndr *ndr, const void *src, int len);
+void ndr_write_ptr(struct ndr *ndr, const void *ptr);
+void ndr_write_unistr(struct ndr *ndr, const char *str, const char *codepage);
+
+void ndr_init_pull(struct ndr *ndr, char *buf, int size,
+		const char *codepage);
+void ndr_pull_free(struct ndr *ndr);
+void *ndr_alloc(struct ndr *ndr, size_t size);
+void *ndr_alloc_array(struct ndr *ndr, __u32 count, size_t size,
+		int wire_size);
+
+void ndr_read_align(struct ndr *ndr, int n);
+__u8 ndr_read_int8(struct ndr *ndr);
+__u16 ndr_read_int16(struct ndr *ndr);
+__u32 ndr_read_int32(struct ndr *ndr);
+__u64 ndr_read_int64(struct ndr *ndr);
+void ndr_read_bytes(struct ndr *ndr, void *dst, int len);
+__u32 ndr_read_ptr(struct ndr *ndr);
+char *ndr_read_unistr(struct ndr *ndr);
+
+void ndr_rpc_rsp_begin(struct ndr *ndr, __u32 call_id, __u16 context_id);
+int ndr_rpc_rsp_end(struct ndr *ndr);
+
+#endif /* __CIFSD_TOOLS_NDR_H */
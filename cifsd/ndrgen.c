@@ -0,0 +1,1557 @@
+/*
+ *   cifsd-tools/cifsd/ndrgen.c
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * ndrgen - build time NDR code generator
+ *
+ * Reads an interface description in the subset of MIDL understood by
+ * Samba's pidl that our pipes need, and writes a header with the C
+ * types of the interface plus a source file with a pull and a push
+ * function for every type and call. Generated code is straight calls
+ * into the ndr.c primitives, nothing is interpreted at run time.
+ *
+ * Supported: one interface per file with uuid(), version() and
+ * pointer_default(unique); typedef'd structs and unions; uint8, uint16,
+ * uint32, hyper, NTTIME, WERROR and NTSTATUS; fixed size arrays of
+ * those; [ref] and [unique] pointers; [string,charset(UTF16)] uint16
+ * pointers, which become host strings in the client codepage;
+ * [size_is()] conformant arrays, made conformant varying by
+ * [length_is()]; non-encapsulated unions selected with [switch_is()],
+ * [case()] and [default]; and calls with [in], [out] and [opnum()].
+ * The size_is() and length_is() operand of a call parameter may come
+ * after the array, as in winreg, and is then checked once it is read.
+ *
+ * Usage: ndrgen <file.idl> <output basename>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+
+#define NAME_LEN	64
+#define ARG_LEN		128
+#define EXPR_LEN	256
+#define MAX_ATTRS	8
+#define MAX_ELEMS	32
+#define MAX_TYPES	64
+#define MAX_CALLS	64
+
+enum {
+	TOK_EOF,
+	TOK_IDENT,
+	TOK_NUM,
+	TOK_PUNCT,
+};
+
+struct token {
+	int	type;
+	char	text[ARG_LEN];
+	int	line;
+};
+
+struct attr {
+	char	name[NAME_LEN];
+	char	arg[ARG_LEN];
+};
+
+struct base_type {
+	const char	*name;
+	const char	*ctype;
+	int		size;
+};
+
+struct type;
+
+/* struct member, union arm or call parameter */
+struct elem {
+	char			name[NAME_LEN];
+	char			type[NAME_LEN];
+	int			ptr;
+	int			array;		/* fixed array length */
+	int			nattrs;
+	struct attr		attrs[MAX_ATTRS];
+	int			line;
+
+	const struct base_type	*base;
+	struct type		*ctype;
+	int			string;
+	int			unique;
+	int			in;
+	int			out;
+	int			empty;		/* [default] arm without member */
+	int			is_default;
+	long			case_val;
+	struct elem		*size_is;
+	struct elem		*length_is;
+	struct elem		*switch_is;
+	int			late;		/* operands follow on the wire */
+};
+
+struct type {
+	char		name[NAME_LEN];
+	int		is_union;
+	int		nelems;
+	struct elem	elems[MAX_ELEMS];
+	int		align;
+	int		has_buffers;
+	int		wire_size;	/* bytes of scalars */
+	int		has_default;
+};
+
+struct call {
+	char		name[NAME_LEN];
+	const struct base_type *result;
+	int		opnum;
+	int		nparams;
+	struct elem	params[MAX_ELEMS];
+};
+
+static const struct base_type base_types[] = {
+	{"uint8",	"__u8",		1},
+	{"uint16",	"__u16",	2},
+	{"uint32",	"__u32",	4},
+	{"hyper",	"__u64",	8},
+	{"NTTIME",	"__u64",	8},
+	{"WERROR",	"__u32",	4},
+	{"NTSTATUS",	"__u32",	4},
+};
+
+static const char *idl_path;
+static char *src;
+static int pos, line = 1;
+static struct token tok;
+
+static char iface_name[NAME_LEN];
+static char iface_uuid[ARG_LEN];
+static int iface_vmajor, iface_vminor;
+
+static struct type types[MAX_TYPES];
+static int ntypes;
+static struct call calls[MAX_CALLS];
+static int ncalls;
+
+static FILE *out;
+
+static void fatal(int at, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s:%d: ", idl_path, at);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+/* -------------------------------------------------------------------- */
+/* lexer */
+
+static void skip_space(void)
+{
+	for (;;) {
+		if (src[pos] == '\n') {
+			line++;
+			pos++;
+		} else if (isspace((unsigned char)src[pos])) {
+			pos++;
+		} else if (src[pos] == '/' && src[pos + 1] == '*') {
+			pos += 2;
+			while (src[pos] && !(src[pos] == '*' &&
+						src[pos + 1] == '/')) {
+				if (src[pos] == '\n')
+					line++;
+				pos++;
+			}
+			if (src[pos])
+				pos += 2;
+		} else if ((src[pos] == '/' && src[pos + 1] == '/') ||
+				src[pos] == '#') {
+			while (src[pos] && src[pos] != '\n')
+				pos++;
+		} else {
+			return;
+		}
+	}
+}
+
+static void next(void)
+{
+	int len = 0;
+
+	skip_space();
+	tok.line = line;
+	tok.text[0] = '\0';
+
+	if (!src[pos]) {
+		tok.type = TOK_EOF;
+		return;
+	}
+
+	if (isalnum((unsigned char)src[pos]) || src[pos] == '_') {
+		tok.type = isdigit((unsigned char)src[pos]) ?
+			TOK_NUM : TOK_IDENT;
+		while (isalnum((unsigned char)src[pos]) || src[pos] == '_') {
+			if (len == ARG_LEN - 1)
+				fatal(line, "token too long");
+			tok.text[len++] = src[pos++];
+		}
+		tok.text[len] = '\0';
+		return;
+	}
+
+	tok.type = TOK_PUNCT;
+	tok.text[0] = src[pos++];
+	tok.text[1] = '\0';
+}
+
+static int is(const char *text)
+{
+	return tok.type != TOK_EOF && !strcmp(tok.text, text);
+}
+
+static int accept(const char *text)
+{
+	if (!is(text))
+		return 0;
+	next();
+	return 1;
+}
+
+static void expect(const char *text)
+{
+	if (!accept(text))
+		fatal(tok.line, "expected '%s' before '%s'", text, tok.text);
+}
+
+static void expect_ident(char *name)
+{
+	if (tok.type != TOK_IDENT)
+		fatal(tok.line, "expected identifier before '%s'", tok.text);
+	if (strlen(tok.text) >= NAME_LEN)
+		fatal(tok.line, "identifier '%s' too long", tok.text);
+	strcpy(name, tok.text);
+	next();
+}
+
+static long parse_number(const char *text, int at)
+{
+	char *end;
+	long val = strtol(text, &end, 0);
+
+	if (*end)
+		fatal(at, "bad number '%s'", text);
+	return val;
+}
+
+/* -------------------------------------------------------------------- */
+/* parser */
+
+/* [name, name(args), ...] possibly repeated, arguments are kept as text */
+static int parse_attrs(struct attr *attrs)
+{
+	int n = 0, depth, len;
+
+	while (accept("[")) {
+		if (accept("]"))
+			continue;
+		do {
+			if (n == MAX_ATTRS)
+				fatal(tok.line, "too many attributes");
+			expect_ident(attrs[n].name);
+			attrs[n].arg[0] = '\0';
+			if (accept("(")) {
+				for (depth = 1, len = 0; ; next()) {
+					if (tok.type == TOK_EOF)
+						fatal(tok.line, "unterminated attribute");
+					if (is("("))
+						depth++;
+					if (is(")") && !--depth)
+						break;
+					len += strlen(tok.text);
+					if (len >= ARG_LEN)
+						fatal(tok.line, "attribute too long");
+					strcat(attrs[n].arg, tok.text);
+				}
+				next();
+			}
+			n++;
+		} while (accept(","));
+		expect("]");
+	}
+	return n;
+}
+
+static void parse_elem(struct elem *e, int allow_empty)
+{
+	memset(e, 0, sizeof(*e));
+	e->line = tok.line;
+	e->nattrs = parse_attrs(e->attrs);
+	if (allow_empty && is(";")) {
+		e->empty = 1;
+		return;
+	}
+
+	expect_ident(e->type);
+	while (accept("*"))
+		e->ptr++;
+	expect_ident(e->name);
+	if (accept("[")) {
+		if (tok.type != TOK_NUM)
+			fatal(tok.line, "%s: only fixed size arrays are supported, use size_is()",
+					e->name);
+		e->array = parse_number(tok.text, tok.line);
+		if (e->array <= 0)
+			fatal(tok.line, "%s: bad array size", e->name);
+		next();
+		expect("]");
+	}
+}
+
+static void parse_typedef(void)
+{
+	struct attr attrs[MAX_ATTRS];
+	struct type *t;
+
+	if (ntypes == MAX_TYPES)
+		fatal(tok.line, "too many types");
+	t = &types[ntypes];
+	memset(t, 0, sizeof(*t));
+
+	parse_attrs(attrs);
+	if (accept("union"))
+		t->is_union = 1;
+	else
+		expect("struct");
+
+	expect("{");
+	while (!accept("}")) {
+		if (t->nelems == MAX_ELEMS)
+			fatal(tok.line, "too many members");
+		parse_elem(&t->elems[t->nelems++], t->is_union);
+		expect(";");
+	}
+	expect_ident(t->name);
+	expect(";");
+	ntypes++;
+}
+
+static void parse_call(void)
+{
+	struct attr attrs[MAX_ATTRS];
+	char ret[NAME_LEN];
+	struct call *c;
+	int i, n;
+
+	if (ncalls == MAX_CALLS)
+		fatal(tok.line, "too many calls");
+	c = &calls[ncalls];
+	memset(c, 0, sizeof(*c));
+	c->opnum = ncalls ? calls[ncalls - 1].opnum + 1 : 0;
+
+	n = parse_attrs(attrs);
+	for (i = 0; i < n; i++) {
+		if (!strcmp(attrs[i].name, "opnum"))
+			c->opnum = parse_number(attrs[i].arg, tok.line);
+		else
+			fatal(tok.line, "unknown call attribute '%s'",
+					attrs[i].name);
+	}
+
+	expect_ident(ret);
+	if (strcmp(ret, "void")) {
+		for (i = 0; i < sizeof(base_types) / sizeof(base_types[0]); i++)
+			if (!strcmp(base_types[i].name, ret))
+				c->result = &base_types[i];
+		if (!c->result)
+			fatal(tok.line, "unsupported result type '%s'", ret);
+	}
+	expect_ident(c->name);
+
+	expect("(");
+	if (!accept(")")) {
+		if (accept("void")) {
+			expect(")");
+		} else {
+			do {
+				if (c->nparams == MAX_ELEMS)
+					fatal(tok.line, "too many parameters");
+				parse_elem(&c->params[c->nparams++], 0);
+			} while (accept(","));
+			expect(")");
+		}
+	}
+	expect(";");
+
+	for (i = 0; i < ncalls; i++)
+		if (calls[i].opnum >= c->opnum)
+			fatal(tok.line, "%s: opnums must be ascending", c->name);
+	ncalls++;
+}
+
+static void parse_version(const char *arg, int at)
+{
+	if (sscanf(arg, "%d.%d", &iface_vmajor, &iface_vminor) < 1)
+		fatal(at, "bad version '%s'", arg);
+}
+
+static void parse_file(void)
+{
+	struct attr attrs[MAX_ATTRS];
+	int i, n;
+
+	next();
+	n = parse_attrs(attrs);
+	for (i = 0; i < n; i++) {
+		if (!strcmp(attrs[i].name, "uuid"))
+			snprintf(iface_uuid, ARG_LEN, "%s", attrs[i].arg);
+		else if (!strcmp(attrs[i].name, "version"))
+			parse_version(attrs[i].arg, tok.line);
+		else if (!strcmp(attrs[i].name, "pointer_default")) {
+			if (strcmp(attrs[i].arg, "unique"))
+				fatal(tok.line, "only pointer_default(unique) is supported");
+		} else if (strcmp(attrs[i].name, "helpstring")) {
+			fatal(tok.line, "unknown interface attribute '%s'",
+					attrs[i].name);
+		}
+	}
+	if (!iface_uuid[0])
+		fatal(tok.line, "interface without uuid");
+
+	expect("interface");
+	expect_ident(iface_name);
+	expect("{");
+	while (!accept("}")) {
+		if (accept("typedef"))
+			parse_typedef();
+		else
+			parse_call();
+	}
+	accept(";");
+	if (tok.type != TOK_EOF)
+		fatal(tok.line, "junk after interface");
+}
+
+/* -------------------------------------------------------------------- */
+/* semantic checks */
+
+static struct type *find_type(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ntypes; i++)
+		if (!strcmp(types[i].name, name))
+			return &types[i];
+	return NULL;
+}
+
+static struct elem *find_sibling(struct elem *elems, int n, const char *name,
+		int at)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!elems[i].empty && !strcmp(elems[i].name, name))
+			return &elems[i];
+	fatal(at, "no member or parameter '%s'", name);
+	return NULL;
+}
+
+static int elem_align(struct elem *e)
+{
+	if (e->ptr)
+		return 4;
+	if (e->base)
+		return e->base->size;
+	return e->ctype->align;
+}
+
+static int elem_has_buffers(struct elem *e)
+{
+	if (e->ptr)
+		return 1;
+	if (e->base)
+		return 0;
+	return e->ctype->has_buffers;
+}
+
+static int elem_wire_size(struct elem *e)
+{
+	if (e->ptr)
+		return 4;
+	if (e->base)
+		return e->base->size * (e->array ? e->array : 1);
+	return e->ctype->wire_size;
+}
+
+/*
+ * Resolve the type and attributes of @e. @siblings are the members or
+ * parameters size_is() and switch_is() may refer to, @top is set for
+ * call parameters, whose pointers default to [ref].
+ */
+static void resolve_elem(struct elem *e, struct elem *siblings, int n,
+		int top, int in_union, struct type *self)
+{
+	int i, charset = 0, ref = 0;
+
+	if (e->empty) {
+		for (i = 0; i < e->nattrs; i++)
+			if (!strcmp(e->attrs[i].name, "default"))
+				e->is_default = 1;
+		if (!e->is_default || e->nattrs != 1)
+			fatal(e->line, "empty arm must be [default]");
+		return;
+	}
+
+	for (i = 0; i < sizeof(base_types) / sizeof(base_types[0]); i++)
+		if (!strcmp(base_types[i].name, e->type))
+			e->base = &base_types[i];
+	if (!e->base) {
+		e->ctype = find_type(e->type);
+		if (!e->ctype || e->ctype == self)
+			fatal(e->line, "%s: unknown type '%s'", e->name,
+					e->type);
+	}
+
+	if (in_union)
+		e->case_val = -1;
+
+	for (i = 0; i < e->nattrs; i++) {
+		struct attr *a = &e->attrs[i];
+
+		if (!strcmp(a->name, "in") && top) {
+			e->in = 1;
+		} else if (!strcmp(a->name, "out") && top) {
+			e->out = 1;
+		} else if (!strcmp(a->name, "ref")) {
+			ref = 1;
+		} else if (!strcmp(a->name, "unique")) {
+			e->unique = 1;
+		} else if (!strcmp(a->name, "string")) {
+			e->string = 1;
+		} else if (!strcmp(a->name, "charset")) {
+			if (strcmp(a->arg, "UTF16"))
+				fatal(e->line, "%s: only charset(UTF16) is supported",
+						e->name);
+			charset = 1;
+		} else if (!strcmp(a->name, "size_is")) {
+			e->size_is = find_sibling(siblings, n, a->arg,
+					e->line);
+		} else if (!strcmp(a->name, "length_is")) {
+			e->length_is = find_sibling(siblings, n, a->arg,
+					e->line);
+		} else if (!strcmp(a->name, "switch_is")) {
+			e->switch_is = find_sibling(siblings, n, a->arg,
+					e->line);
+		} else if (!strcmp(a->name, "case") && in_union) {
+			e->case_val = parse_number(a->arg, e->line);
+			if (e->case_val < 0)
+				fatal(e->line, "%s: bad case", e->name);
+		} else if (!strcmp(a->name, "default") && in_union) {
+			e->is_default = 1;
+		} else {
+			fatal(e->line, "%s: unsupported attribute '%s'",
+					e->name, a->name);
+		}
+	}
+
+	if (e->ptr > 1)
+		fatal(e->line, "%s: pointers to pointers are not supported",
+				e->name);
+	if ((ref || e->unique) && !e->ptr)
+		fatal(e->line, "%s: pointer attribute on a non-pointer",
+				e->name);
+	if (ref && e->unique)
+		fatal(e->line, "%s: both ref and unique", e->name);
+	/* [ref] is the default at the top level, [unique] below */
+	if (e->ptr && !ref && !e->unique && !top)
+		e->unique = 1;
+
+	if (e->string != charset)
+		fatal(e->line, "%s: strings are [string,charset(UTF16)]",
+				e->name);
+	if (e->string && (!e->ptr || strcmp(e->type, "uint16")))
+		fatal(e->line, "%s: strings are uint16 pointers", e->name);
+	if (e->array && (!e->base || e->ptr))
+		fatal(e->line, "%s: fixed arrays are of plain integers",
+				e->name);
+	if (e->size_is) {
+		if (!e->ptr || e->string)
+			fatal(e->line, "%s: size_is() needs an array pointer",
+					e->name);
+		if (e->ctype && e->ctype->is_union)
+			fatal(e->line, "%s: arrays of unions are not supported",
+					e->name);
+	}
+	if (e->length_is && !e->size_is)
+		fatal(e->line, "%s: length_is() without size_is()", e->name);
+	if (e->ctype && e->ctype->is_union) {
+		if (!e->switch_is)
+			fatal(e->line, "%s: union without switch_is()",
+					e->name);
+	} else if (e->switch_is) {
+		fatal(e->line, "%s: switch_is() on a non-union", e->name);
+	}
+	if (in_union && e->case_val < 0 && !e->is_default)
+		fatal(e->line, "%s: union arm without case()", e->name);
+	if (in_union && e->ctype && e->ctype->is_union)
+		fatal(e->line, "%s: nested unions are not supported", e->name);
+	if (top && !e->in && !e->out)
+		fatal(e->line, "%s: parameter is neither in nor out", e->name);
+	if (top && e->out && !e->ptr)
+		fatal(e->line, "%s: out parameters are pointers", e->name);
+}
+
+static void resolve_operand(struct elem *e, struct elem *op,
+		const char *attr, int top)
+{
+	if (!op)
+		return;
+	if (!op->base || op->array)
+		fatal(e->line, "%s: %s() needs an integer", e->name, attr);
+	if (!top || !e->in)
+		return;
+	if (!op->in)
+		fatal(e->line, "%s: %s() of an in parameter is not in",
+				e->name, attr);
+	/* parameters are read in order, later operands are checked late */
+	if (op > e)
+		e->late = 1;
+}
+
+/* checked once the siblings @e refers to are resolved too */
+static void resolve_operands(struct elem *e, int top)
+{
+	if (e->empty)
+		return;
+	resolve_operand(e, e->size_is, "size_is", top);
+	resolve_operand(e, e->length_is, "length_is", top);
+	resolve_operand(e, e->switch_is, "switch_is", top);
+	if (e->late && e->switch_is)
+		fatal(e->line, "%s: switch_is() must be read first", e->name);
+}
+
+static void resolve(void)
+{
+	struct type *t;
+	struct call *c;
+	int i, j;
+
+	for (i = 0; i < ntypes; i++) {
+		t = &types[i];
+		t->align = 1;
+		if (t->is_union) {
+			t->align = 4;
+			t->wire_size = 4;
+		}
+
+		for (j = 0; j < t->nelems; j++) {
+			struct elem *e = &t->elems[j];
+
+			resolve_elem(e, t->elems, t->is_union ? 0 : t->nelems,
+					0, t->is_union, t);
+			if (e->is_default) {
+				if (t->has_default)
+					fatal(e->line, "two default arms");
+				t->has_default = 1;
+			}
+			if (e->empty)
+				continue;
+			if (elem_align(e) > t->align)
+				t->align = elem_align(e);
+			if (elem_has_buffers(e))
+				t->has_buffers = 1;
+			if (!t->is_union)
+				t->wire_size += elem_wire_size(e);
+		}
+		if (!t->nelems)
+			fatal(0, "%s: empty type", t->name);
+		for (j = 0; j < t->nelems; j++)
+			resolve_operands(&t->elems[j], 0);
+	}
+
+	for (i = 0; i < ncalls; i++) {
+		c = &calls[i];
+		for (j = 0; j < c->nparams; j++)
+			resolve_elem(&c->params[j], c->params, c->nparams, 1,
+					0, NULL);
+		for (j = 0; j < c->nparams; j++)
+			resolve_operands(&c->params[j], 1);
+	}
+}
+
+/* -------------------------------------------------------------------- */
+/* code generation */
+
+static void emit(int indent, const char *fmt, ...)
+{
+	va_list ap;
+
+	while (indent--)
+		fputc('\t', out);
+	va_start(ap, fmt);
+	vfprintf(out, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * How generated code reaches a member: struct members and union arms
+ * hang off r, call parameters off r->in or r->out. Out parameters are
+ * pushed from r->out but may depend on in-only parameters.
+ */
+struct scope {
+	int		is_call;
+	int		out;
+};
+
+static void elem_expr(char *buf, struct scope *s, struct elem *e)
+{
+	if (!s->is_call)
+		sprintf(buf, "r->%s", e->name);
+	else
+		sprintf(buf, "r->%s.%s", s->out && e->out ? "out" : "in",
+				e->name);
+}
+
+/* value of a size_is(), length_is() or switch_is() operand */
+static void value_expr(char *buf, struct scope *s, struct elem *e)
+{
+	char expr[ARG_LEN];
+
+	elem_expr(expr, s, e);
+	if (e->ptr && e->unique)
+		sprintf(buf, "(%s ? *%s : 0)", expr, expr);
+	else if (e->ptr)
+		sprintf(buf, "*%s", expr);
+	else
+		strcpy(buf, expr);
+}
+
+static const char *int_bits(const struct base_type *b)
+{
+	switch (b->size) {
+	case 1:
+		return "8";
+	case 2:
+		return "16";
+	case 8:
+		return "64";
+	}
+	return "32";
+}
+
+static const char *ctype_kind(struct type *t)
+{
+	return t->is_union ? "union" : "struct";
+}
+
+static void emit_decl(int indent, struct elem *e)
+{
+	if (e->string)
+		emit(indent, "char\t*%s;\n", e->name);
+	else if (e->base && e->array)
+		emit(indent, "%s\t%s[%d];\n", e->base->ctype, e->name,
+				e->array);
+	else if (e->base)
+		emit(indent, "%s\t%s%s;\n", e->base->ctype,
+				e->ptr ? "*" : "", e->name);
+	else
+		emit(indent, "%s %s\t%s%s;\n", ctype_kind(e->ctype),
+				e->ctype->name, e->ptr ? "*" : "", e->name);
+}
+
+static int elem_is_array(struct elem *e)
+{
+	return e->size_is != NULL;
+}
+
+/* ---- push ---- */
+
+/* one array element or pointee of compound type, @expr is an lvalue */
+static void push_compound(int indent, struct elem *e, struct scope *s,
+		const char *flags, const char *addr)
+{
+	char sw[EXPR_LEN];
+
+	if (e->ctype->is_union) {
+		value_expr(sw, s, e->switch_is);
+		emit(indent, "ndr_push_%s(ndr, %s, %s, %s);\n",
+				e->ctype->name, flags, sw, addr);
+	} else {
+		emit(indent, "ndr_push_%s(ndr, %s, %s);\n", e->ctype->name,
+				flags, addr);
+	}
+}
+
+static void push_referent(int indent, struct elem *e, struct scope *s,
+		const char *expr)
+{
+	char size[EXPR_LEN], addr[EXPR_LEN];
+
+	if (e->string) {
+		emit(indent, "ndr_write_unistr(ndr, %s, ndr->codepage);\n",
+				expr);
+	} else if (elem_is_array(e)) {
+		value_expr(size, s, e->size_is);
+		emit(indent, "ndr_write_int32(ndr, %s);\n", size);
+		if (e->length_is) {
+			/* elements sent are the varying part, from 0 */
+			value_expr(size, s, e->length_is);
+			emit(indent, "ndr_write_int32(ndr, 0);\n");
+			emit(indent, "ndr_write_int32(ndr, %s);\n", size);
+		}
+		sprintf(addr, "&%s[i]", expr);
+		if (e->base) {
+			emit(indent, "for (i = 0; i < %s; i++)\n", size);
+			emit(indent + 1, "ndr_write_int%s(ndr, %s[i]);\n",
+					int_bits(e->base), expr);
+			return;
+		}
+		emit(indent, "for (i = 0; i < %s; i++)\n", size);
+		push_compound(indent + 1, e, s, "NDR_SCALARS", addr);
+		if (e->ctype->has_buffers) {
+			emit(indent, "for (i = 0; i < %s; i++)\n", size);
+			push_compound(indent + 1, e, s, "NDR_BUFFERS", addr);
+		}
+	} else if (e->base) {
+		emit(indent, "ndr_write_int%s(ndr, *%s);\n", int_bits(e->base),
+				expr);
+	} else {
+		push_compound(indent, e, s, "NDR_SCALARS | NDR_BUFFERS", expr);
+	}
+}
+
+static void push_scalars(int indent, struct elem *e, struct scope *s)
+{
+	char expr[ARG_LEN], addr[EXPR_LEN];
+
+	elem_expr(expr, s, e);
+	if (e->ptr) {
+		emit(indent, "ndr_write_ptr(ndr, %s);\n", expr);
+	} else if (e->base && e->array) {
+		if (e->base->size == 1) {
+			emit(indent, "ndr_write_bytes(ndr, %s, %d);\n", expr,
+					e->array);
+		} else {
+			emit(indent, "for (i = 0; i < %d; i++)\n", e->array);
+			emit(indent + 1, "ndr_write_int%s(ndr, %s[i]);\n",
+					int_bits(e->base), expr);
+		}
+	} else if (e->base) {
+		emit(indent, "ndr_write_int%s(ndr, %s);\n", int_bits(e->base),
+				expr);
+	} else {
+		sprintf(addr, "&%s", expr);
+		push_compound(indent, e, s, "NDR_SCALARS", addr);
+	}
+}
+
+static void push_buffers(int indent, struct elem *e, struct scope *s)
+{
+	char expr[ARG_LEN], addr[EXPR_LEN];
+
+	if (!elem_has_buffers(e))
+		return;
+
+	elem_expr(expr, s, e);
+	if (e->ptr) {
+		emit(indent, "if (%s) {\n", expr);
+		push_referent(indent + 1, e, s, expr);
+		emit(indent, "}\n");
+	} else {
+		sprintf(addr, "&%s", expr);
+		push_compound(indent, e, s, "NDR_BUFFERS", addr);
+	}
+}
+
+/* ---- pull ---- */
+
+static void pull_compound(int indent, struct elem *e, struct scope *s,
+		const char *flags, const char *addr)
+{
+	char sw[EXPR_LEN];
+
+	if (e->ctype->is_union) {
+		value_expr(sw, s, e->switch_is);
+		emit(indent, "ndr_pull_%s(ndr, %s, %s, %s);\n",
+				e->ctype->name, flags, sw, addr);
+	} else {
+		emit(indent, "ndr_pull_%s(ndr, %s, %s);\n", e->ctype->name,
+				flags, addr);
+	}
+}
+
+static void pull_referent(int indent, struct elem *e, struct scope *s,
+		const char *expr)
+{
+	char size[EXPR_LEN], addr[EXPR_LEN];
+
+	if (e->string) {
+		emit(indent, "%s = ndr_read_unistr(ndr);\n", expr);
+		return;
+	}
+
+	if (elem_is_array(e)) {
+		emit(indent, "count = ndr_read_int32(ndr);\n");
+		if (e->late) {
+			emit(indent, "size_%s = count;\n", e->name);
+		} else {
+			value_expr(size, s, e->size_is);
+			emit(indent, "if (count != %s)\n", size);
+			emit(indent + 1, "return ndr_set_error(ndr, -EINVAL);\n");
+		}
+		if (e->length_is) {
+			emit(indent, "if (ndr_read_int32(ndr) != 0)\n");
+			emit(indent + 1, "return ndr_set_error(ndr, -EINVAL);\n");
+			emit(indent, "length = ndr_read_int32(ndr);\n");
+			emit(indent, "if (length > count)\n");
+			emit(indent + 1, "return ndr_set_error(ndr, -EINVAL);\n");
+			if (e->late) {
+				emit(indent, "length_%s = length;\n", e->name);
+			} else {
+				value_expr(size, s, e->length_is);
+				emit(indent, "if (length != %s)\n", size);
+				emit(indent + 1, "return ndr_set_error(ndr, -EINVAL);\n");
+			}
+			/* only the varying part is on the wire */
+			emit(indent, "count = length;\n");
+		}
+		/* a count is only believed if that many elements fit */
+		emit(indent, "%s = ndr_alloc_array(ndr, count, sizeof(*%s), %d);\n",
+				expr, expr, e->base ? e->base->size :
+				e->ctype->wire_size);
+		emit(indent, "if (ndr->error)\n");
+		emit(indent + 1, "return ndr->error;\n");
+		if (e->length_is) {
+			/* an empty buffer still tells the callee one was passed */
+			emit(indent, "if (!%s)\n", expr);
+			emit(indent + 1, "%s = ndr_alloc(ndr, sizeof(*%s));\n",
+					expr, expr);
+		}
+		sprintf(addr, "&%s[i]", expr);
+		if (e->base) {
+			emit(indent, "for (i = 0; i < count; i++)\n");
+			emit(indent + 1, "%s[i] = ndr_read_int%s(ndr);\n",
+					expr, int_bits(e->base));
+			return;
+		}
+		emit(indent, "for (i = 0; i < count; i++)\n");
+		pull_compound(indent + 1, e, s, "NDR_SCALARS", addr);
+		if (e->ctype->has_buffers) {
+			emit(indent, "for (i = 0; i < count; i++)\n");
+			pull_compound(indent + 1, e, s, "NDR_BUFFERS", addr);
+		}
+		return;
+	}
+
+	emit(indent, "%s = ndr_alloc(ndr, sizeof(*%s));\n", expr, expr);
+	emit(indent, "if (!%s)\n", expr);
+	emit(indent + 1, "return ndr->error;\n");
+	if (e->base)
+		emit(indent, "*%s = ndr_read_int%s(ndr);\n", expr,
+				int_bits(e->base));
+	else
+		pull_compound(indent, e, s, "NDR_SCALARS | NDR_BUFFERS", expr);
+}
+
+static void pull_scalars(int indent, struct elem *e, struct scope *s)
+{
+	char expr[ARG_LEN], addr[EXPR_LEN];
+
+	elem_expr(expr, s, e);
+	if (e->ptr) {
+		/* the referent follows in the buffers pass */
+		emit(indent, "%s = ndr_read_ptr(ndr) ? NDR_PENDING : NULL;\n",
+				expr);
+	} else if (e->base && e->array) {
+		if (e->base->size == 1) {
+			emit(indent, "ndr_read_bytes(ndr, %s, %d);\n", expr,
+					e->array);
+		} else {
+			emit(indent, "for (i = 0; i < %d; i++)\n", e->array);
+			emit(indent + 1, "%s[i] = ndr_read_int%s(ndr);\n",
+					expr, int_bits(e->base));
+		}
+	} else if (e->base) {
+		emit(indent, "%s = ndr_read_int%s(ndr);\n", expr,
+				int_bits(e->base));
+	} else {
+		sprintf(addr, "&%s", expr);
+		pull_compound(indent, e, s, "NDR_SCALARS", addr);
+	}
+}
+
+static void pull_buffers(int indent, struct elem *e, struct scope *s)
+{
+	char expr[ARG_LEN], addr[EXPR_LEN];
+
+	if (!elem_has_buffers(e))
+		return;
+
+	elem_expr(expr, s, e);
+	if (e->ptr) {
+		emit(indent, "if (%s) {\n", expr);
+		pull_referent(indent + 1, e, s, expr);
+		emit(indent, "}\n");
+	} else {
+		sprintf(addr, "&%s", expr);
+		pull_compound(indent, e, s, "NDR_BUFFERS", addr);
+	}
+}
+
+/* ---- per type ---- */
+
+static int needs_index(struct elem *elems, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!elems[i].empty && (elem_is_array(&elems[i]) ||
+				(elems[i].array && elems[i].base->size > 1)))
+			return 1;
+	return 0;
+}
+
+static int needs_count(struct elem *elems, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!elems[i].empty && elem_is_array(&elems[i]))
+			return 1;
+	return 0;
+}
+
+static int needs_length(struct elem *elems, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!elems[i].empty && elems[i].length_is)
+			return 1;
+	return 0;
+}
+
+static void emit_locals(struct elem *elems, int n, int pull)
+{
+	if (!needs_index(elems, n))
+		return;
+	if (pull && needs_length(elems, n))
+		emit(1, "__u32 i, count, length;\n\n");
+	else if (pull && needs_count(elems, n))
+		emit(1, "__u32 i, count;\n\n");
+	else
+		emit(1, "__u32 i;\n\n");
+}
+
+static void emit_struct(struct type *t, int pull)
+{
+	struct scope s = { 0, 0 };
+	int i;
+
+	emit(0, "int ndr_%s_%s(struct ndr *ndr, int flags, %sstruct %s *r)\n",
+			pull ? "pull" : "push", t->name,
+			pull ? "" : "const ", t->name);
+	emit(0, "{\n");
+	emit_locals(t->elems, t->nelems, pull);
+
+	emit(1, "if (flags & NDR_SCALARS) {\n");
+	if (t->align > 1)
+		emit(2, "ndr_%s_align(ndr, %d);\n", pull ? "read" : "write",
+				t->align);
+	for (i = 0; i < t->nelems; i++) {
+		if (pull)
+			pull_scalars(2, &t->elems[i], &s);
+		else
+			push_scalars(2, &t->elems[i], &s);
+	}
+	if (t->align > 1)
+		emit(2, "ndr_%s_align(ndr, %d);\n", pull ? "read" : "write",
+				t->align);
+	emit(1, "}\n");
+
+	if (t->has_buffers) {
+		emit(1, "if (flags & NDR_BUFFERS) {\n");
+		for (i = 0; i < t->nelems; i++) {
+			if (pull)
+				pull_buffers(2, &t->elems[i], &s);
+			else
+				push_buffers(2, &t->elems[i], &s);
+		}
+		emit(1, "}\n");
+	}
+	emit(1, "return ndr->error;\n");
+	emit(0, "}\n\n");
+}
+
+static void emit_union_cases(struct type *t, int pull, int buffers)
+{
+	struct scope s = { 0, 0 };
+	struct elem *e;
+	int i;
+
+	emit(2, "switch (level) {\n");
+	for (i = 0; i < t->nelems; i++) {
+		e = &t->elems[i];
+		if (e->is_default)
+			continue;
+		emit(2, "case %ld:\n", e->case_val);
+		if (!buffers && pull)
+			pull_scalars(3, e, &s);
+		else if (!buffers)
+			push_scalars(3, e, &s);
+		else if (pull)
+			pull_buffers(3, e, &s);
+		else
+			push_buffers(3, e, &s);
+		emit(3, "break;\n");
+	}
+	for (i = 0; i < t->nelems; i++) {
+		e = &t->elems[i];
+		if (!e->is_default)
+			continue;
+		emit(2, "default:\n");
+		if (!e->empty) {
+			if (!buffers && pull)
+				pull_scalars(3, e, &s);
+			else if (!buffers)
+				push_scalars(3, e, &s);
+			else if (pull)
+				pull_buffers(3, e, &s);
+			else
+				push_buffers(3, e, &s);
+		}
+		emit(3, "break;\n");
+	}
+	if (!t->has_default) {
+		emit(2, "default:\n");
+		if (!buffers)
+			emit(3, "ndr_set_error(ndr, -EINVAL);\n");
+		emit(3, "break;\n");
+	}
+	emit(2, "}\n");
+}
+
+static void emit_union(struct type *t, int pull)
+{
+	emit(0, "int ndr_%s_%s(struct ndr *ndr, int flags, __u32 level, %sunion %s *r)\n",
+			pull ? "pull" : "push", t->name,
+			pull ? "" : "const ", t->name);
+	emit(0, "{\n");
+	emit_locals(t->elems, t->nelems, pull);
+
+	emit(1, "if (flags & NDR_SCALARS) {\n");
+	/* non-encapsulated unions repeat the discriminant on the wire */
+	if (pull) {
+		emit(2, "if (ndr_read_int32(ndr) != level)\n");
+		emit(3, "return ndr_set_error(ndr, -EINVAL);\n");
+	} else {
+		emit(2, "ndr_write_int32(ndr, level);\n");
+	}
+	emit_union_cases(t, pull, 0);
+	emit(1, "}\n");
+
+	if (t->has_buffers) {
+		emit(1, "if (flags & NDR_BUFFERS) {\n");
+		emit_union_cases(t, pull, 1);
+		emit(1, "}\n");
+	}
+	emit(1, "return ndr->error;\n");
+	emit(0, "}\n\n");
+}
+
+/* ---- per call ---- */
+
+static void emit_call_pull_in(struct call *c)
+{
+	struct scope s = { 1, 0 };
+	char expr[ARG_LEN];
+	struct elem *e;
+	int i;
+
+	emit(0, "int ndr_pull_%s_in(struct ndr *ndr, struct %s *r)\n",
+			c->name, c->name);
+	emit(0, "{\n");
+	/* counts of arrays whose operands are not read yet */
+	for (i = 0; i < c->nparams; i++) {
+		e = &c->params[i];
+		if (!e->in || !e->late)
+			continue;
+		emit(1, "__u32 size_%s = 0;\n", e->name);
+		if (e->length_is)
+			emit(1, "__u32 length_%s = 0;\n", e->name);
+	}
+	emit_locals(c->params, c->nparams, 1);
+	emit(1, "memset(r, 0, sizeof(*r));\n");
+
+	for (i = 0; i < c->nparams; i++) {
+		e = &c->params[i];
+		if (!e->in)
+			continue;
+		elem_expr(expr, &s, e);
+		if (!e->ptr) {
+			pull_scalars(1, e, &s);
+			pull_buffers(1, e, &s);
+		} else if (e->unique) {
+			emit(1, "if (ndr_read_ptr(ndr)) {\n");
+			pull_referent(2, e, &s, expr);
+			emit(1, "}\n");
+		} else {
+			pull_referent(1, e, &s, expr);
+		}
+	}
+
+	for (i = 0; i < c->nparams; i++) {
+		char size[EXPR_LEN], length[EXPR_LEN];
+
+		e = &c->params[i];
+		if (!e->in || !e->late)
+			continue;
+		elem_expr(expr, &s, e);
+		value_expr(size, &s, e->size_is);
+		if (!e->length_is) {
+			emit(1, "if (%s && size_%s != %s)\n", expr, e->name,
+					size);
+		} else {
+			value_expr(length, &s, e->length_is);
+			emit(1, "if (%s && (size_%s != %s ||\n", expr,
+					e->name, size);
+			emit(3, "length_%s != %s))\n", e->name, length);
+		}
+		emit(2, "return ndr_set_error(ndr, -EINVAL);\n");
+	}
+
+	/* out pointers point at the in value, or at zeroed storage */
+	for (i = 0; i < c->nparams; i++) {
+		e = &c->params[i];
+		if (!e->out)
+			continue;
+		if (e->in) {
+			emit(1, "r->out.%s = r->in.%s;\n", e->name, e->name);
+		} else if (!e->string && !elem_is_array(e)) {
+			emit(1, "r->out.%s = ndr_alloc(ndr, sizeof(*r->out.%s));\n",
+					e->name, e->name);
+			emit(1, "if (!r->out.%s)\n", e->name);
+			emit(2, "return ndr->error;\n");
+		}
+	}
+	emit(1, "return ndr->error;\n");
+	emit(0, "}\n\n");
+}
+
+static void emit_call_push_out(struct call *c)
+{
+	struct scope s = { 1, 1 };
+	char expr[ARG_LEN];
+	struct elem *e;
+	int i;
+
+	emit(0, "int ndr_push_%s_out(struct ndr *ndr, const struct %s *r)\n",
+			c->name, c->name);
+	emit(0, "{\n");
+	/* only out arrays are indexed */
+	for (i = 0; i < c->nparams; i++) {
+		if (c->params[i].out && elem_is_array(&c->params[i])) {
+			emit(1, "__u32 i;\n\n");
+			break;
+		}
+	}
+
+	for (i = 0; i < c->nparams; i++) {
+		e = &c->params[i];
+		if (!e->out)
+			continue;
+		elem_expr(expr, &s, e);
+		if (e->unique) {
+			emit(1, "ndr_write_ptr(ndr, %s);\n", expr);
+			emit(1, "if (%s) {\n", expr);
+			push_referent(2, e, &s, expr);
+			emit(1, "}\n");
+		} else {
+			emit(1, "if (!%s)\n", expr);
+			emit(2, "return ndr_set_error(ndr, -EINVAL);\n");
+			push_referent(1, e, &s, expr);
+		}
+	}
+	if (c->result)
+		emit(1, "ndr_write_int%s(ndr, r->out.result);\n",
+				int_bits(c->result));
+	emit(1, "return ndr->error;\n");
+	emit(0, "}\n\n");
+}
+
+static void emit_call_struct(struct call *c)
+{
+	int i, n;
+
+	emit(0, "struct %s {\n", c->name);
+	emit(1, "struct {\n");
+	for (i = 0, n = 0; i < c->nparams; i++) {
+		if (c->params[i].in) {
+			emit_decl(2, &c->params[i]);
+			n++;
+		}
+	}
+	if (!n)
+		emit(2, "int\tunused;\n");
+	emit(1, "} in;\n");
+	emit(1, "struct {\n");
+	for (i = 0, n = 0; i < c->nparams; i++) {
+		if (c->params[i].out) {
+			emit_decl(2, &c->params[i]);
+			n++;
+		}
+	}
+	if (c->result)
+		emit(2, "%s\tresult;\n", c->result->ctype);
+	else if (!n)
+		emit(2, "int\tunused;\n");
+	emit(1, "} out;\n");
+	emit(0, "};\n\n");
+}
+
+/* uuid text to its little endian wire form */
+static void emit_uuid(void)
+{
+	static const int order[16] = {
+		3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15
+	};
+	unsigned char bytes[16];
+	char hex[33];
+	int i, n = 0;
+
+	for (i = 0; iface_uuid[i]; i++) {
+		if (iface_uuid[i] == '-' || iface_uuid[i] == '"')
+			continue;
+		if (!isxdigit((unsigned char)iface_uuid[i]) || n == 32)
+			fatal(0, "bad uuid '%s'", iface_uuid);
+		hex[n++] = iface_uuid[i];
+	}
+	if (n != 32)
+		fatal(0, "bad uuid '%s'", iface_uuid);
+
+	for (i = 0; i < 16; i++) {
+		char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+
+		bytes[i] = strtoul(byte, NULL, 16);
+	}
+
+	emit(1, ".uuid\t\t= {");
+	for (i = 0; i < 16; i++)
+		fprintf(out, "0x%02x%s", bytes[order[i]],
+				i == 15 ? "},\n" : i == 7 ? ",\n\t\t\t   " :
+				", ");
+}
+
+static void upper(char *dst, const char *src)
+{
+	while (*src)
+		*dst++ = toupper((unsigned char)*src++);
+	*dst = '\0';
+}
+
+static FILE *open_out(const char *base, const char *ext)
+{
+	char path[4096];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s%s", base, ext);
+	fp = fopen(path, "w");
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+	return fp;
+}
+
+static const char *base_name(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	return p ? p + 1 : path;
+}
+
+static void emit_header(const char *base)
+{
+	char guard[NAME_LEN], name[NAME_LEN];
+	struct type *t;
+	struct call *c;
+	int i, j;
+
+	upper(guard, iface_name);
+	emit(0, "/* generated by ndrgen from %s, do not edit */\n\n",
+			base_name(idl_path));
+	emit(0, "#ifndef __CIFSD_NDR_%s_H\n", guard);
+	emit(0, "#define __CIFSD_NDR_%s_H\n\n", guard);
+	emit(0, "#include \"ndr.h\"\n\n");
+
+	for (i = 0; i < ncalls; i++) {
+		upper(name, calls[i].name);
+		emit(0, "#define NDR_%s\t0x%02x\n", name, calls[i].opnum);
+	}
+	emit(0, "\n");
+
+	for (i = 0; i < ntypes; i++) {
+		t = &types[i];
+		emit(0, "%s %s {\n", ctype_kind(t), t->name);
+		for (j = 0; j < t->nelems; j++)
+			if (!t->elems[j].empty)
+				emit_decl(1, &t->elems[j]);
+		emit(0, "};\n\n");
+	}
+
+	for (i = 0; i < ncalls; i++)
+		emit_call_struct(&calls[i]);
+
+	for (i = 0; i < ntypes; i++) {
+		t = &types[i];
+		if (t->is_union) {
+			emit(0, "int ndr_push_%s(struct ndr *ndr, int flags, __u32 level,\n\t\tconst union %s *r);\n",
+					t->name, t->name);
+			emit(0, "int ndr_pull_%s(struct ndr *ndr, int flags, __u32 level,\n\t\tunion %s *r);\n",
+					t->name, t->name);
+		} else {
+			emit(0, "int ndr_push_%s(struct ndr *ndr, int flags,\n\t\tconst struct %s *r);\n",
+					t->name, t->name);
+			emit(0, "int ndr_pull_%s(struct ndr *ndr, int flags,\n\t\tstruct %s *r);\n",
+					t->name, t->name);
+		}
+	}
+	for (i = 0; i < ncalls; i++) {
+		c = &calls[i];
+		emit(0, "int ndr_pull_%s_in(struct ndr *ndr, struct %s *r);\n",
+				c->name, c->name);
+		emit(0, "int ndr_push_%s_out(struct ndr *ndr,\n\t\tconst struct %s *r);\n",
+				c->name, c->name);
+	}
+	emit(0, "\nextern const struct ndr_interface ndr_table_%s;\n\n",
+			iface_name);
+	emit(0, "#endif /* __CIFSD_NDR_%s_H */\n", guard);
+}
+
+static void emit_source(const char *base)
+{
+	struct type *t;
+	struct call *c;
+	int i;
+
+	emit(0, "/* generated by ndrgen from %s, do not edit */\n\n",
+			base_name(idl_path));
+	emit(0, "#include <string.h>\n\n");
+	emit(0, "#include \"%s.h\"\n\n", base_name(base));
+
+	for (i = 0; i < ntypes; i++) {
+		t = &types[i];
+		if (t->is_union) {
+			emit_union(t, 0);
+			emit_union(t, 1);
+		} else {
+			emit_struct(t, 0);
+			emit_struct(t, 1);
+		}
+	}
+
+	for (i = 0; i < ncalls; i++) {
+		c = &calls[i];
+		emit_call_pull_in(c);
+		emit_call_push_out(c);
+		emit(0, "static int %s_pull_in(struct ndr *ndr, void *r)\n",
+				c->name);
+		emit(0, "{\n");
+		emit(1, "return ndr_pull_%s_in(ndr, r);\n", c->name);
+		emit(0, "}\n\n");
+		emit(0, "static int %s_push_out(struct ndr *ndr, const void *r)\n",
+				c->name);
+		emit(0, "{\n");
+		emit(1, "return ndr_push_%s_out(ndr, r);\n", c->name);
+		emit(0, "}\n\n");
+	}
+
+	emit(0, "static const struct ndr_call %s_calls[] = {\n", iface_name);
+	for (i = 0; i < ncalls; i++) {
+		c = &calls[i];
+		emit(1, "[%d] = {\n", c->opnum);
+		emit(2, ".name\t\t= \"%s\",\n", c->name);
+		emit(2, ".size\t\t= sizeof(struct %s),\n", c->name);
+		emit(2, ".pull_in\t= %s_pull_in,\n", c->name);
+		emit(2, ".push_out\t= %s_push_out,\n", c->name);
+		emit(1, "},\n");
+	}
+	emit(0, "};\n\n");
+
+	emit(0, "const struct ndr_interface ndr_table_%s = {\n", iface_name);
+	emit(1, ".name\t\t= \"%s\",\n", iface_name);
+	emit_uuid();
+	emit(1, ".version_major\t= %d,\n", iface_vmajor);
+	emit(1, ".version_minor\t= %d,\n", iface_vminor);
+	emit(1, ".nr_calls\t= %d,\n", ncalls ? calls[ncalls - 1].opnum + 1 : 0);
+	emit(1, ".calls\t\t= %s_calls,\n", iface_name);
+	emit(0, "};\n");
+}
+
+static char *read_file(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	char *buf;
+	long len;
+
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	buf = malloc(len + 1);
+	if (!buf || fread(buf, 1, len, fp) != len) {
+		fprintf(stderr, "%s: read failed\n", path);
+		exit(1);
+	}
+	buf[len] = '\0';
+	fclose(fp);
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: ndrgen <file.idl> <output basename>\n");
+		return 1;
+	}
+
+	idl_path = argv[1];
+	src = read_file(idl_path);
+	parse_file();
+	resolve();
+
+	out = open_out(argv[2], ".h");
+	emit_header(argv[2]);
+	if (fclose(out))
+		return 1;
+
+	out = open_out(argv[2], ".c");
+	emit_source(argv[2]);
+	if (fclose(out))
+		return 1;
+	return 0;
+}
@@ -18,6 +18,7 @@
  *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
  */
 
+#define _GNU_SOURCE	/* recvmmsg */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,72 +26,149 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
 
 #include "netlink.h"
+#include "workq.h"
+#include "trace.h"
+#include "stats.h"
 
-static char *nlsk_rcv_buf = NULL;
-static char *nlsk_send_buf = NULL;
+/* max messages pulled off the socket per recvmmsg() */
+#define NETLINK_CIFSD_RCV_BATCH	32
+
+static struct cifsd_work *nlsk_batch_work[NETLINK_CIFSD_RCV_BATCH];
+static struct mmsghdr nlsk_batch_msg[NETLINK_CIFSD_RCV_BATCH];
+static struct iovec nlsk_batch_iov[NETLINK_CIFSD_RCV_BATCH];
 static int nlsk_fd = -1;
+static int nlsk_epfd = -1;
+static pid_t nlsk_pid;
 static struct sockaddr_nl src_addr, dest_addr;
+/* netlink needs the kernel address on every send, a UNIX socket does not */
+static struct sockaddr_nl *nlsk_dest;
+
+char *cifsd_transport_path;
 
-extern int request_handler(void *msg);
 extern void initialize(void);
 
-static int cifsd_sendmsg(struct cifsd_uevent *eev, unsigned int dlen,
+/**
+ * cifsd_sendmsg() - send an event to the kernel
+ * @ev:		event to send
+ * @dlen:	payload length
+ * @data:	payload, sent from where the caller built it
+ *
+ * The message goes out as a three element iovec: netlink header, event
+ * and payload. The payload starts right at the end of the event, which
+ * is where the kernel expects ev->buffer.
+ *
+ * Return:	number of bytes sent, or -1 on error
+ */
+static int cifsd_sendmsg(struct cifsd_uevent *ev, unsigned int dlen,
 		char *data)
 {
-	struct nlmsghdr *nlh;
-	struct cifsd_uevent *ev;
+	struct nlmsghdr nlh;
 	struct msghdr msg;
-	struct iovec iov;
+	struct iovec iov[3];
+	__u64 start;
 	int len;
 
-	cifsd_debug("sending %u event\n", eev->type);
-	nlh = (struct nlmsghdr *)nlsk_send_buf;
-	memset(nlh, 0, NETLINK_CIFSD_MAX_BUF);
-	nlh->nlmsg_len = NLMSG_SPACE(sizeof(*ev));
-	nlh->nlmsg_type = eev->type;
-	nlh->nlmsg_pid = getpid();
-	memcpy(NLMSG_DATA(nlh), eev, sizeof(*ev));
-	ev = (struct cifsd_uevent *)NLMSG_DATA(nlh);
-
-	if (dlen) {
-		memcpy(ev->buffer, data, dlen);
-		nlh->nlmsg_len += dlen;
-	}
+	cifsd_debug("sending %u event\n", ev->type);
+	memset(&nlh, 0, sizeof(nlh));
+	nlh.nlmsg_len = NLMSG_SPACE(sizeof(*ev)) + dlen;
+	if (cifsd_replaying)
+		return nlh.nlmsg_len;
 
-	iov.iov_base = (void *)nlh;
-	iov.iov_len = nlh->nlmsg_len;
+	nlh.nlmsg_type = ev->type;
+	nlh.nlmsg_pid = nlsk_pid;
 
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_name= (void*)&dest_addr;
-	msg.msg_namelen = sizeof(dest_addr);
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
+	iov[0].iov_base = &nlh;
+	iov[0].iov_len = NLMSG_HDRLEN;
+	iov[1].iov_base = ev;
+	iov[1].iov_len = NLMSG_SPACE(sizeof(*ev)) - NLMSG_HDRLEN;
+	iov[2].iov_base = data;
+	iov[2].iov_len = dlen;
 
-	len = sendmsg(nlsk_fd, &msg, 0);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = nlsk_dest;
+	msg.msg_namelen = nlsk_dest ? sizeof(*nlsk_dest) : 0;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = dlen ? 3 : 2;
+
+	/* a stand-in kernel may go away, that is not worth a SIGPIPE */
+	start = cifsd_stats_start();
+	len = sendmsg(nlsk_fd, &msg, MSG_NOSIGNAL);
+	cifsd_stats_send(start);
 	if (len == -1)
 		perror("sendmsg");
-	else if (len != nlh->nlmsg_len)
+	else if (len != nlh.nlmsg_len)
 		cifsd_err("partial data send, expected %u, actual %u\n",
-				nlh->nlmsg_len, len);
+				nlh.nlmsg_len, len);
 	return len;
 }
 
+/**
+ * cifsd_common_sendmsg() - send an event and its payload to the kernel
+ * @ev:		event to send
+ * @buf:	payload
+ * @buflen:	payload length, up to NETLINK_CIFSD_MAX_RSP_PAYLOAD
+ *
+ * Payloads larger than NETLINK_CIFSD_MAX_PAYLOAD are split into chunks.
+ * Every chunk carries a copy of @ev with its own buflen. The counters in
+ * ev->u keep describing the whole response, and read and ioctl responses
+ * number their chunks in the chunk word, with CIFSD_UEVENT_F_MORE set on
+ * all but the last one.
+ *
+ * Return:	number of bytes sent by the last message, or -1 on error
+ */
 int cifsd_common_sendmsg(struct cifsd_uevent *ev, char *buf,
 		unsigned int buflen)
 {
+	struct cifsd_uevent chunk_ev;
+	unsigned int off = 0, len, seq = 0;
+	unsigned int *chunk = NULL;
 	int ret;
 
-	if (buflen > NETLINK_CIFSD_MAX_PAYLOAD) {
+	if (buflen > NETLINK_CIFSD_MAX_RSP_PAYLOAD) {
 		cifsd_err("too big(%u) buffer\n", buflen);
 		return -1;
 	}
 
-	ret = cifsd_sendmsg(ev, buflen, buf);
-	if (ret < 0)
-		cifsd_err("failed to send event %u\n", ev->type);
+	if (buflen <= NETLINK_CIFSD_MAX_PAYLOAD) {
+		ret = cifsd_sendmsg(ev, buflen, buf);
+		if (ret < 0)
+			cifsd_err("failed to send event %u\n", ev->type);
+		return ret;
+	}
+
+	memcpy(&chunk_ev, ev, sizeof(chunk_ev));
+	if (ev->type == CIFSD_UEVENT_READ_PIPE_RSP)
+		chunk = &chunk_ev.u.r_pipe_rsp.chunk;
+	else if (ev->type == CIFSD_UEVENT_IOCTL_PIPE_RSP)
+		chunk = &chunk_ev.u.i_pipe_rsp.chunk;
+
+	do {
+		len = buflen - off;
+		if (len > NETLINK_CIFSD_MAX_PAYLOAD)
+			len = NETLINK_CIFSD_MAX_PAYLOAD;
+
+		chunk_ev.buflen = len;
+		if (chunk)
+			*chunk = seq << 1 |
+				(off + len < buflen ? CIFSD_UEVENT_F_MORE : 0);
+
+		ret = cifsd_sendmsg(&chunk_ev, len, buf + off);
+		if (ret < 0) {
+			cifsd_err("failed to send event %u, chunk %u\n",
+					ev->type, seq);
+			return ret;
+		}
+
+		off += len;
+		seq++;
+	} while (off < buflen);
 
+	cifsd_debug("sent event %u in %u chunks, %u bytes\n", ev->type,
+			seq, buflen);
 	return ret;
 }
 
@@ -114,136 +192,330 @@ static int handle_exit_event(void)
 	return cifsd_common_sendmsg(&ev, NULL, 0);
 }
 
-static int cifsd_nl_read(char *buf, unsigned int buflen, int flags)
+/**
+ * cifsd_nl_valid() - sanity check a message read off the socket
+ * @msg:	message header used for the read
+ * @len:	number of bytes received
+ *
+ * Return:	1 if the message carries a complete event, otherwise 0
+ */
+static int cifsd_nl_valid(struct msghdr *msg, unsigned int len)
 {
-	int len;
-	struct iovec iov;
+	struct nlmsghdr *nlh = (struct nlmsghdr *)msg->msg_iov->iov_base;
+
+	if (msg->msg_flags & MSG_TRUNC ||
+		len < NLMSG_SPACE(sizeof(struct cifsd_uevent)) ||
+		nlh->nlmsg_len < NLMSG_SPACE(sizeof(struct cifsd_uevent)) ||
+		nlh->nlmsg_len > len) {
+		cifsd_err("dropping malformed event, len %u\n", len);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * cifsd_handle_event() - wait for and handle a single event
+ *
+ * The event is read straight into a work buffer large enough for any
+ * message, so one recvmsg() is all it takes.
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int cifsd_handle_event(void)
+{
+	struct cifsd_work *work;
 	struct msghdr msg;
+	struct iovec iov;
+	int len;
+
+	work = cifsd_work_alloc();
+	if (!work)
+		return -ENOMEM;
 
-	iov.iov_base = buf;
-	iov.iov_len = buflen;
+	iov.iov_base = work->nlh;
+	iov.iov_len = NETLINK_CIFSD_MAX_BUF;
 
 	memset(&msg, 0, sizeof(msg));
-	msg.msg_name= (void*)&src_addr;
-	msg.msg_namelen = sizeof(src_addr);
 	msg.msg_iov = &iov;
 	msg.msg_iovlen = 1;
 
-	len = recvmsg(nlsk_fd, &msg, flags);
-	if (len == -1)
+	len = recvmsg(nlsk_fd, &msg, 0);
+	if (len == -1) {
 		perror("recvmsg");
-	else if (len != buflen)
-		cifsd_err("partial data read, expected %u, actual %u\n",
-				buflen, len);
+		goto out;
+	}
 
-	return len;
+	if (!cifsd_nl_valid(&msg, len))
+		goto out;
+
+	work->rx_ns = cifsd_stats_start();
+	return cifsd_workq_dispatch(work);
+
+out:
+	cifsd_work_free(work);
+	return -1;
 }
 
-static int cifsd_handle_event(void)
+static void cifsd_nl_set_slot(int i, struct cifsd_work *work)
 {
-	int len;
-	struct cifsd_uevent *ev;
-	struct nlmsghdr *nlh;
+	nlsk_batch_work[i] = work;
+	nlsk_batch_iov[i].iov_base = work->nlh;
+	nlsk_batch_iov[i].iov_len = NETLINK_CIFSD_MAX_BUF;
+}
 
-	len = cifsd_nl_read(nlsk_rcv_buf,
-			NLMSG_SPACE(sizeof(struct cifsd_uevent)),
-			MSG_PEEK);
-	if (len != NLMSG_SPACE(sizeof(struct cifsd_uevent)))
-		return -1;
+/**
+ * cifsd_nl_drain() - handle every event queued on the netlink socket
+ *
+ * Events are pulled in batches with recvmmsg() until the socket runs
+ * dry. A short batch means the queue was empty at that point, there is
+ * no need to spend another syscall just to see EAGAIN.
+ *
+ * Every slot of the batch is a work buffer, so a received event is
+ * handed to its worker as is and the slot gets a recycled buffer. A
+ * slot left without buffer shortens the next batch, with no slot at
+ * all the events stay on the socket until the next wakeup. Events are
+ * never handled off the worker owning their client.
+ *
+ * Return:	number of handled events, or -1 on socket error
+ */
+static int cifsd_nl_drain(void)
+{
+	struct cifsd_work *work;
+	int i, nr, slots, handled = 0;
+	__u64 rx_ns;
+
+	for (;;) {
+		for (slots = 0; slots < NETLINK_CIFSD_RCV_BATCH; slots++) {
+			if (!nlsk_batch_work[slots]) {
+				work = cifsd_work_alloc();
+				if (!work)
+					break;
+				cifsd_nl_set_slot(slots, work);
+			}
+			nlsk_batch_msg[slots].msg_hdr.msg_name = NULL;
+			nlsk_batch_msg[slots].msg_hdr.msg_namelen = 0;
+			nlsk_batch_msg[slots].msg_hdr.msg_flags = 0;
+		}
+		if (!slots) {
+			cifsd_err("no buffer to receive events, retrying later\n");
+			return handled;
+		}
 
-	nlh = (struct nlmsghdr *)nlsk_rcv_buf;
-	ev = (struct cifsd_uevent *)NLMSG_DATA(nlsk_rcv_buf);
-	if (len != nlh->nlmsg_len && ev->buflen) {
-		len = cifsd_nl_read(nlsk_rcv_buf, nlh->nlmsg_len, MSG_PEEK);
-		if (len != nlh->nlmsg_len)
+		nr = recvmmsg(nlsk_fd, nlsk_batch_msg, slots, MSG_DONTWAIT,
+				NULL);
+		if (nr < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK ||
+					errno == EINTR)
+				return handled;
+			perror("recvmmsg");
 			return -1;
-	}
+		}
 
-	len = cifsd_nl_read(nlsk_rcv_buf, nlh->nlmsg_len, 0);
-	if (len != nlh->nlmsg_len)
-	{
-		cifsd_err("failed to remove data\n");
-		return -1;
-	}
+		/* one clock read covers the whole batch */
+		rx_ns = cifsd_stats_start();
+
+		for (i = 0; i < nr; i++) {
+			/* end of stream, a UNIX socket peer went away */
+			if (!nlsk_batch_msg[i].msg_len)
+				return handled;
+
+			if (!cifsd_nl_valid(&nlsk_batch_msg[i].msg_hdr,
+					nlsk_batch_msg[i].msg_len))
+				continue;
+
+			work = nlsk_batch_work[i];
+			work->rx_ns = rx_ns;
+			cifsd_trace_record(work->nlh);
+			/* refilled before the next batch */
+			nlsk_batch_work[i] = NULL;
+			cifsd_workq_dispatch(work);
+			handled++;
+		}
 
-	return request_handler(nlh);
+		if (nr < slots)
+			return handled;
+	}
 }
 
+/**
+ * cifsd_nl_loop() - handle kernel events until the transport goes away
+ *
+ * The netlink socket never hangs up, so with the kernel module this only
+ * ends on a signal. A UNIX socket peer closing its end stops the loop
+ * once the queued events are handled.
+ */
 static void cifsd_nl_loop(void)
 {
-	fd_set readfds;
+	struct epoll_event event;
+	/* wake up for the reaper of events handled on this thread */
+	int timeout = cifsd_client_idle ? 1000 : -1;
 	int ret;
 
 	for (;;) {
-		/* add cifsd netlink socket fd to read fd list*/
-		FD_ZERO(&readfds);
-		FD_SET(nlsk_fd, &readfds);
-
-		ret = select(nlsk_fd + 1, &readfds, NULL, NULL, NULL);
+		ret = epoll_wait(nlsk_epfd, &event, 1, timeout);
 		if (ret == -1) {
-			perror("select");
+			if (errno != EINTR)
+				perror("epoll_wait");
+			continue;
 		}
-		else {
-			if (FD_ISSET(nlsk_fd, &readfds)) {
-				cifsd_handle_event();
-			}
+
+		if (!ret) {
+			cifsd_reap_tick();
+			continue;
+		}
+
+		if (event.events & (EPOLLIN | EPOLLERR))
+			cifsd_nl_drain();
+
+		if (event.events & EPOLLHUP) {
+			cifsd_debug("transport closed by peer\n");
+			return;
 		}
 	}
 }
 
-int cifsd_nl_init(void)
+/**
+ * cifsd_nl_open() - open the netlink socket to the cifsd module
+ *
+ * Return:	socket fd, or -1 on error
+ */
+static int cifsd_nl_open(void)
 {
-	nlsk_rcv_buf = malloc(NETLINK_CIFSD_MAX_BUF);
-	if (!nlsk_rcv_buf) {
-		perror("can't alloc netlink buffer\n");
-		return -1;
-	}
-
-	nlsk_send_buf = malloc(NETLINK_CIFSD_MAX_BUF);
-	if (!nlsk_send_buf) {
-		perror("can't alloc netlink buffer\n");
-		goto free_rcv_buf;
-	}
+	int fd;
 
-	nlsk_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_CIFSD);
-	if (nlsk_fd < 0) {
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_CIFSD);
+	if (fd < 0) {
 		perror("Failed to create netlink socket\n");
-		goto free_send_buf;
+		return -1;
 	}
 
+	nlsk_pid = getpid();
 	memset(&src_addr, 0, sizeof(src_addr));
 	src_addr.nl_family = AF_NETLINK;
-	src_addr.nl_pid = getpid();
+	src_addr.nl_pid = nlsk_pid;
 
-	if (bind(nlsk_fd, (struct sockaddr *)&src_addr, sizeof(src_addr))) {
+	if (bind(fd, (struct sockaddr *)&src_addr, sizeof(src_addr))) {
 		perror("Failed to bind netlink socket\n");
-		goto close_sock;
+		close(fd);
+		return -1;
 	}
 
 	memset(&dest_addr, 0, sizeof(dest_addr));
 	dest_addr.nl_family = AF_NETLINK;
 	dest_addr.nl_pid = 0; /* kernel */
+	nlsk_dest = &dest_addr;
+	return fd;
+}
+
+/**
+ * cifsd_unix_open() - connect to a kernel stand-in over a UNIX socket
+ * @path:	socket path the stand-in listens on
+ *
+ * The peer speaks the netlink message format over SOCK_SEQPACKET, which
+ * keeps message boundaries just like the netlink socket does.
+ *
+ * Return:	socket fd, or -1 on error
+ */
+static int cifsd_unix_open(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		cifsd_err("socket path too long: %s\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Failed to create unix socket\n");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		cifsd_err("Failed to connect to %s, err %d\n", path, errno);
+		close(fd);
+		return -1;
+	}
+
+	nlsk_pid = getpid();
+	nlsk_dest = NULL;
+	return fd;
+}
+
+int cifsd_nl_init(void)
+{
+	struct epoll_event event;
+	struct cifsd_work *work;
+	int i;
+
+	memset(nlsk_batch_msg, 0, sizeof(nlsk_batch_msg));
+	for (i = 0; i < NETLINK_CIFSD_RCV_BATCH; i++) {
+		work = cifsd_work_alloc();
+		if (!work) {
+			perror("can't alloc netlink buffer\n");
+			goto free_batch_buf;
+		}
+		cifsd_nl_set_slot(i, work);
+		nlsk_batch_msg[i].msg_hdr.msg_iov = &nlsk_batch_iov[i];
+		nlsk_batch_msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (cifsd_transport_path)
+		nlsk_fd = cifsd_unix_open(cifsd_transport_path);
+	else
+		nlsk_fd = cifsd_nl_open();
+	if (nlsk_fd < 0)
+		goto free_batch_buf;
+
+	nlsk_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (nlsk_epfd < 0) {
+		perror("Failed to create epoll instance\n");
+		goto close_sock;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = nlsk_fd;
+	if (epoll_ctl(nlsk_epfd, EPOLL_CTL_ADD, nlsk_fd, &event)) {
+		perror("Failed to watch netlink socket\n");
+		goto close_epoll;
+	}
 	return 0;
 
+close_epoll:
+	close(nlsk_epfd);
+	nlsk_epfd = -1;
 close_sock:
 	close(nlsk_fd);
-free_send_buf:
-	free(nlsk_send_buf);
-free_rcv_buf:
-	free(nlsk_rcv_buf);
+	nlsk_fd = -1;
+free_batch_buf:
+	for (i = 0; i < NETLINK_CIFSD_RCV_BATCH; i++) {
+		free(nlsk_batch_work[i]);
+		nlsk_batch_work[i] = NULL;
+	}
 	return -1;
 }
 
 int cifsd_nl_exit(void)
 {
+	int i;
+
+	if (nlsk_epfd >= 0)
+		close(nlsk_epfd);
+
 	if (nlsk_fd >= 0)
 		close(nlsk_fd);
 
-	if (nlsk_send_buf)
-		free(nlsk_send_buf);
-
-	if (nlsk_rcv_buf)
-		free(nlsk_rcv_buf);
+	/* work buffers are plain malloc blocks */
+	for (i = 0; i < NETLINK_CIFSD_RCV_BATCH; i++) {
+		free(nlsk_batch_work[i]);
+		nlsk_batch_work[i] = NULL;
+	}
 	return 0;
 }
 
@@ -268,13 +540,9 @@ int cifsd_stop_smbport(void)
 static void termination_handler(int signum)
 {
 	int err = 0;
-	struct cifsd_client_info *client;
 
 	failed_connection = 0;
-
-	list_for_each_entry(client, &cifsd_clients, list) {
-		++connection;
-	}
+	connection += cifsd_nr_clients();
 	do {
 		connection += failed_connection;
 		failed_connection = 0;
@@ -311,6 +579,10 @@ int cifsd_netlink_setup(void)
 		return -1;
 
 	initialize();
+	if (cifsd_workq_init()) {
+		cifsd_nl_exit();
+		return -1;
+	}
 	handle_init_event();
 
 	cifsd_start_smbport();
@@ -318,6 +590,7 @@ int cifsd_netlink_setup(void)
 	cifsd_nl_loop();
 
 	cifsd_stop_smbport();
+	cifsd_workq_exit();
 	handle_exit_event();
 	cifsd_nl_exit();
 	return 0;
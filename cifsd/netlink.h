@@ -29,6 +29,20 @@
 #define NETLINK_CIFSD_MAX_BUF         (sizeof(struct nlmsghdr) +      \
 					sizeof(struct cifsd_uevent) + \
 					NETLINK_CIFSD_MAX_PAYLOAD)
+/*
+ * Largest pipe response handed back to the kernel. Anything above
+ * NETLINK_CIFSD_MAX_PAYLOAD is streamed in several messages, and the
+ * DCE/RPC max_rsize a client can negotiate is 16 bit.
+ */
+#define NETLINK_CIFSD_MAX_RSP_PAYLOAD	(64 * 1024)
+
+/*
+ * chunk word of streamed read and ioctl responses, seq << 1 | F_MORE.
+ * LANMAN responses have no room for it, their chunks add up to
+ * data_count.
+ */
+#define CIFSD_UEVENT_F_MORE	0x1	/* more chunks of this response follow */
+#define CIFSD_UEVENT_CHUNK_SEQ(chunk)	((chunk) >> 1)
 
 #define NETLINK_REQ_INIT        0x00
 #define NETLINK_REQ_SENT        0x01
@@ -76,12 +90,14 @@ struct cifsd_uevent {
 		} e_conn;
 		struct msg_read_pipe_response {
 			unsigned int	read_count;
+			unsigned int	chunk;
 		} r_pipe_rsp;
 		struct msg_write_pipe_response {
 			unsigned int	write_count;
 		} w_pipe_rsp;
 		struct msg_ioctl_pipe_response {
 			unsigned int	data_count;
+			unsigned int	chunk;
 		} i_pipe_rsp;
 		struct msg_lanman_pipe_response {
 			unsigned int    data_count;
@@ -118,14 +134,28 @@ struct cifsd_uevent {
 	char buffer[0];
 };
 
-/* List of connected clients */
-struct list_head cifsd_clients;
 int connection;
 int failed_connection;
+/* UNIX socket of a kernel stand-in, NULL talks netlink to the module */
+extern char *cifsd_transport_path;
 int cifsd_start_smbport(void);
 int cifsd_stop_smbport(void);
 int cifsd_common_sendmsg(struct cifsd_uevent *ev, char *buf,
 		unsigned int buflen);
 int cifsd_netlink_setup(void);
+int request_handler(struct nlmsghdr *nlh);
+
+/* client registry, pipecb.c */
+struct cifsd_client_info *lookup_client(__u64 clienthash);
+int cifsd_client_del(__u64 clienthash);
+int cifsd_nr_clients(void);
+
+/* idle seconds after which clients and pipes are reaped, 0 never */
+#define CIFSD_CLIENT_IDLE_DEFAULT	300
+#define CIFSD_PIPE_IDLE_DEFAULT		3600
+
+extern int cifsd_client_idle;
+extern int cifsd_pipe_idle;
+void cifsd_reap_tick(void);
 
 #endif /* __CIFSD_TOOLS_NETLINK_H */
@@ -18,10 +18,14 @@
  *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
  */
 
-#include <assert.h>
+#include <pthread.h>
+#include <time.h>
 #include "cifsd.h"
 #include "list.h"
 #include "netlink.h"
+#include "pool.h"
+#include "workq.h"
+#include "stats.h"
 
 #define CREATE	0x1
 #define REMOVE	0x2
@@ -29,87 +33,393 @@
 #define WRITE	0x8
 #define TRANS	0x10
 
+/*
+ * Client registry: open addressing with linear probing, keyed by the
+ * kernel's server handle. Growing moves a few slots of the old table
+ * on every operation rather than rehashing everything at once, so no
+ * single event pays for a resize. Lookups check the new table first,
+ * then whatever is left in the old one.
+ */
+#define CLIENT_TABLE_MIN	64
+#define CLIENT_MIGRATE_STEP	8
+#define CLIENT_TOMBSTONE	((struct cifsd_client_info *)1)
+
+struct client_table {
+	struct cifsd_client_info	**slots;
+	unsigned int			size;	/* power of two */
+	unsigned int			used;	/* live entries */
+	unsigned int			filled;	/* live entries and tombstones */
+};
+
+static struct client_table client_tab;
+/* table being drained into client_tab, slots below migrate_pos are done */
+static struct client_table client_old;
+static unsigned int migrate_pos;
+/* read without the lock by the termination handler */
+static int nr_clients;
+
+/*
+ * Protects the client registry. A client's pipes are only ever touched
+ * by the worker its server handle maps to, so they need no locking of
+ * their own.
+ */
+static pthread_mutex_t cifsd_clients_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int cifsd_client_idle = CIFSD_CLIENT_IDLE_DEFAULT;
+int cifsd_pipe_idle = CIFSD_PIPE_IDLE_DEFAULT;
+
+/*
+ * Idle reaper. Each thread handling pipe events keeps the clients it
+ * created on its own timer wheel with one second ticks, the same thread
+ * sees all events of a client so pipes can be freed without locking.
+ * Activity only stamps the client, a client coming due is checked and
+ * put back to the slot of its new expiry if it was used meanwhile.
+ */
+#define REAP_WHEEL_SLOTS	256
+
+static __thread struct list_head reap_wheel[REAP_WHEEL_SLOTS];
+/* last tick handled by this thread */
+static __thread __u64 reap_now;
+static __thread int reap_ready;
+
+static void cifsd_free_pipe(struct cifsd_client_info *client,
+		struct cifsd_pipe **slot);
+
 void initialize(void)
 {
-	INIT_LIST_HEAD(&cifsd_clients);
+	cifsd_pool_init(CIFSD_POOL_CLIENT, sizeof(struct cifsd_client_info));
+	cifsd_pool_init(CIFSD_POOL_PIPE, sizeof(struct cifsd_pipe));
+	cifsd_pool_init(CIFSD_POOL_REASM, CIFSD_REASM_BUF_SIZE);
+	dcerpc_init();
+}
+
+static unsigned int client_slot(__u64 clienthash, unsigned int size)
+{
+	__u64 h = clienthash;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h & (size - 1);
+}
+
+static int client_table_find(struct client_table *t, __u64 clienthash)
+{
+	struct cifsd_client_info *c;
+	unsigned int i;
+
+	if (!t->slots)
+		return -1;
+
+	for (i = client_slot(clienthash, t->size); (c = t->slots[i]);
+			i = (i + 1) & (t->size - 1)) {
+		if (c != CLIENT_TOMBSTONE && c->hash == clienthash)
+			return i;
+	}
+	return -1;
+}
+
+static void client_table_add(struct client_table *t,
+		struct cifsd_client_info *client)
+{
+	struct cifsd_client_info *c;
+	unsigned int i;
+
+	for (i = client_slot(client->hash, t->size); (c = t->slots[i]) &&
+			c != CLIENT_TOMBSTONE; i = (i + 1) & (t->size - 1))
+		;
+
+	if (!c)
+		t->filled++;
+	t->slots[i] = client;
+	t->used++;
+}
+
+static void client_table_del(struct client_table *t, int i)
+{
+	t->slots[i] = CLIENT_TOMBSTONE;
+	t->used--;
+}
+
+/* move a few slots of the old table over, free it once drained */
+static void client_migrate(void)
+{
+	struct cifsd_client_info *c;
+	unsigned int n;
+
+	if (!client_old.slots)
+		return;
+
+	for (n = 0; n < CLIENT_MIGRATE_STEP && migrate_pos < client_old.size;
+			n++, migrate_pos++) {
+		c = client_old.slots[migrate_pos];
+		if (!c || c == CLIENT_TOMBSTONE)
+			continue;
+		client_table_del(&client_old, migrate_pos);
+		client_table_add(&client_tab, c);
+	}
+
+	if (migrate_pos == client_old.size) {
+		free(client_old.slots);
+		memset(&client_old, 0, sizeof(client_old));
+	}
+}
+
+/**
+ * client_table_grow() - make room for another client
+ *
+ * Starts moving to a table twice the size once three quarters of the
+ * slots are taken, or to one of the same size when most of them are
+ * tombstones. Nothing is done while an earlier move is in progress, it
+ * finishes long before the new table fills up.
+ *
+ * Return:	0 on success, otherwise -ENOMEM
+ */
+static int client_table_grow(void)
+{
+	struct client_table t;
+
+	if (client_tab.slots && (client_old.slots ||
+			(client_tab.filled + 1) * 4 < client_tab.size * 3))
+		return 0;
+
+	memset(&t, 0, sizeof(t));
+	t.size = CLIENT_TABLE_MIN;
+	if (client_tab.slots) {
+		t.size = client_tab.size;
+		if (client_tab.used * 2 >= client_tab.size)
+			t.size *= 2;
+	}
+
+	t.slots = calloc(t.size, sizeof(*t.slots));
+	if (!t.slots)
+		return -ENOMEM;
+
+	if (client_tab.slots) {
+		client_old = client_tab;
+		migrate_pos = 0;
+	}
+	client_tab = t;
+	cifsd_debug("client table resized to %u slots\n", t.size);
+	return 0;
+}
+
+static struct cifsd_client_info *__find_client(__u64 clienthash,
+		struct client_table **table, int *slot)
+{
+	struct client_table *t = &client_tab;
+	int i;
+
+	i = client_table_find(t, clienthash);
+	if (i < 0) {
+		t = &client_old;
+		i = client_table_find(t, clienthash);
+		if (i < 0)
+			return NULL;
+	}
+
+	if (table)
+		*table = t;
+	if (slot)
+		*slot = i;
+	return t->slots[i];
 }
 
-struct cifsd_client_info *head;
+static __u64 reap_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec;
+}
 
+static void reap_arm(struct cifsd_client_info *client, __u64 expires)
+{
+	int i;
+
+	if (!cifsd_client_idle)
+		return;
+
+	if (!reap_ready) {
+		for (i = 0; i < REAP_WHEEL_SLOTS; i++)
+			INIT_LIST_HEAD(&reap_wheel[i]);
+		reap_now = reap_clock();
+		reap_ready = 1;
+	}
+
+	if (expires <= reap_now)
+		expires = reap_now + 1;
+	list_add_tail(&client->reap_list,
+			&reap_wheel[expires % REAP_WHEEL_SLOTS]);
+}
+
+/**
+ * lookup_client() - find a client by server handle, add it if new
+ * @clienthash:	server handle the kernel uses for the SMB session
+ *
+ * Return:	client, or NULL on allocation failure
+ */
 struct cifsd_client_info *lookup_client(__u64 clienthash)
 {
 	struct cifsd_client_info *client;
-	struct list_head *tmp;
-
-	if (!list_empty(&cifsd_clients)) {
-		list_for_each(tmp, &cifsd_clients) {
-			client = list_entry(tmp, struct cifsd_client_info, list);
-			if (client->hash == clienthash) {
-				cifsd_debug("found matching clienthash %llu, client %p\n", clienthash, client);
-				return client;
-			}
-		}
+
+	pthread_mutex_lock(&cifsd_clients_lock);
+	client_migrate();
+	client = __find_client(clienthash, NULL, NULL);
+	if (client) {
+		cifsd_debug("found matching clienthash %llu, client %p\n",
+				clienthash, client);
+		goto out;
 	}
 
-	client = calloc(1, sizeof(struct cifsd_client_info));
+	if (client_table_grow())
+		goto out;
+
+	client = cifsd_pool_alloc(CIFSD_POOL_CLIENT);
 	if (client) {
 		client->hash = clienthash;
-		INIT_LIST_HEAD(&client->list);
-		INIT_LIST_HEAD(&client->pipelist);
-		list_add(&client->list, &cifsd_clients);
+		INIT_LIST_HEAD(&client->reap_list);
+		client_table_add(&client_tab, client);
+		__atomic_add_fetch(&nr_clients, 1, __ATOMIC_RELAXED);
 		cifsd_debug("added clienthash %llu\n", clienthash);
 	}
+out:
+	pthread_mutex_unlock(&cifsd_clients_lock);
+
+	if (client) {
+		client->last_active = reap_clock();
+		if (list_empty(&client->reap_list))
+			reap_arm(client, client->last_active +
+					cifsd_client_idle);
+	}
 	return client;
 }
 
-struct cifsd_pipe *lookup_pipe(__u64 clienthash, int pipetype)
+/**
+ * cifsd_client_del() - forget a client that has no pipes left
+ * @clienthash:	server handle of the client
+ *
+ * Return:	0 on success, -ENOENT if unknown, -EBUSY if pipes are open
+ */
+int cifsd_client_del(__u64 clienthash)
 {
 	struct cifsd_client_info *client;
-	struct cifsd_pipe *pipe;
-	struct list_head *tmp;
+	struct client_table *t;
+	int i, ret = 0;
 
-	client = lookup_client(clienthash);
+	pthread_mutex_lock(&cifsd_clients_lock);
+	client_migrate();
+	client = __find_client(clienthash, &t, &i);
 	if (!client) {
-		cifsd_err("Failed to locate client (0x%llx)\n", clienthash);
+		ret = -ENOENT;
+	} else if (client->nr_pipes) {
+		ret = -EBUSY;
+	} else {
+		client_table_del(t, i);
+		__atomic_sub_fetch(&nr_clients, 1, __ATOMIC_RELAXED);
+		cifsd_pool_free(CIFSD_POOL_CLIENT, client);
+	}
+	pthread_mutex_unlock(&cifsd_clients_lock);
+	return ret;
+}
+
+/**
+ * cifsd_nr_clients() - number of known clients
+ *
+ * Lock free, so the termination handler can use it whatever the
+ * interrupted thread was holding.
+ */
+int cifsd_nr_clients(void)
+{
+	return __atomic_load_n(&nr_clients, __ATOMIC_RELAXED);
+}
+
+static struct cifsd_pipe **pipe_slot(struct cifsd_client_info *client,
+		unsigned int pipetype, __u64 id)
+{
+	int i;
+
+	for (i = 0; i < CIFSD_PIPE_INSTANCES; i++) {
+		if (client->pipes[pipetype][i] &&
+				client->pipes[pipetype][i]->id == id)
+			return &client->pipes[pipetype][i];
+	}
+	return NULL;
+}
+
+/**
+ * lookup_pipe() - find an open pipe of a client
+ * @clienthash:	server handle of the client
+ * @pipetype:	pipe type
+ * @id:		pipe id the kernel gave at CREATE time
+ *
+ * Return:	pipe, or NULL if not open
+ */
+struct cifsd_pipe *lookup_pipe(__u64 clienthash, unsigned int pipetype,
+		__u64 id)
+{
+	struct cifsd_client_info *client;
+	struct cifsd_pipe **slot;
+
+	if (pipetype >= MAX_PIPE) {
+		cifsd_err("invalid pipe type %u\n", pipetype);
 		return NULL;
 	}
 
-	if (list_empty(&client->pipelist)) {
-		cifsd_err("No pipe yet opened from the client(0x%llx)\n",
-				clienthash);
+	client = lookup_client(clienthash);
+	if (!client) {
+		cifsd_err("Failed to locate client (0x%llx)\n", clienthash);
 		return NULL;
 	}
 
-	list_for_each(tmp, &client->pipelist) {
-		pipe = list_entry(tmp, struct cifsd_pipe, list);
-		if (pipe->pipe_type == pipetype)
-			return pipe;
+	slot = pipe_slot(client, pipetype, id);
+	if (!slot) {
+		cifsd_err("No pipe %llu of type %u opened from the client(0x%llx)\n",
+				id, pipetype, clienthash);
+		return NULL;
 	}
 
-	return NULL;
+	(*slot)->last_used = client->last_active;
+	return *slot;
 }
 
-static struct cifsd_pipe *initpipe(int pipetype, char *codepage)
+static struct cifsd_pipe *initpipe(int pipetype, __u64 id, char *codepage)
 {
 	struct cifsd_pipe *pipe = NULL;
-	pipe = (struct cifsd_pipe*) calloc(1, sizeof(struct cifsd_pipe));
+	pipe = cifsd_pool_alloc(CIFSD_POOL_PIPE);
 	if (pipe) {
+		pipe->id = id;
+		pipe->refcount = 1;
 		pipe->pipe_type = pipetype;
 		strncpy(pipe->codepage, codepage, CIFSD_CODEPAGE_LEN - 1);
-		INIT_LIST_HEAD(&pipe->list);
 	}
 	return pipe;
 }
 
-static int cifsd_create_pipe(__u64 clienthash, int pipetype, char *codepage)
+/**
+ * cifsd_create_pipe() - open a pipe for a client
+ * @clienthash:	server handle of the client
+ * @pipetype:	pipe type
+ * @id:		pipe id
+ * @codepage:	client codepage
+ *
+ * A second CREATE of an already open pipe id takes another reference
+ * on the existing pipe, it stays open until as many DESTROYs arrived.
+ * Different ids of one type get their own pipes, up to
+ * CIFSD_PIPE_INSTANCES of them.
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int cifsd_create_pipe(__u64 clienthash, unsigned int pipetype,
+		__u64 id, char *codepage)
 {
-        struct cifsd_pipe *pipe;
+        struct cifsd_pipe *pipe, **slot;
 	struct cifsd_client_info *client;
+	int i;
 
-	pipe = initpipe(pipetype, codepage);
-	if (!pipe) {
-		cifsd_err("Failed to allocate memory for cifsd pipe\n");
-		return -ENOMEM;
+	if (pipetype >= MAX_PIPE) {
+		cifsd_err("invalid pipe type %u\n", pipetype);
+		return -EINVAL;
 	}
 
 	client = lookup_client(clienthash);
@@ -118,41 +428,191 @@ static int cifsd_create_pipe(__u64 clienthash, int pipetype, char *codepage)
 		return -ENOMEM;
 	}
 
+	slot = pipe_slot(client, pipetype, id);
+	if (slot) {
+		(*slot)->last_used = client->last_active;
+		(*slot)->refcount++;
+		cifsd_debug("pipe %llu of type %u reopened, refcount %d\n",
+				id, pipetype, (*slot)->refcount);
+		return 0;
+	}
+
+	for (i = 0; i < CIFSD_PIPE_INSTANCES; i++)
+		if (!client->pipes[pipetype][i])
+			break;
+	if (i == CIFSD_PIPE_INSTANCES) {
+		cifsd_err("too many pipes of type %u on client 0x%llx\n",
+				pipetype, clienthash);
+		return -EMFILE;
+	}
+
+	pipe = initpipe(pipetype, id, codepage);
+	if (!pipe) {
+		cifsd_err("Failed to allocate memory for cifsd pipe\n");
+		return -ENOMEM;
+	}
+
 	cifsd_debug("added pipe %p, in client 0x%llx, client %p\n",
 			pipe, clienthash, client);
-	list_add(&pipe->list, &client->pipelist);
+	pipe->last_used = client->last_active;
+	pipe->client = client;
+	client->pipes[pipetype][i] = pipe;
+	client->nr_pipes++;
 
 	return 0;
 }
 
-static int cifsd_remove_pipe(__u64 clienthash, int pipetype)
+static int cifsd_remove_pipe(__u64 clienthash, unsigned int pipetype,
+		__u64 id)
 {
-	struct cifsd_pipe *pipe;
+	struct cifsd_client_info *client;
+	struct cifsd_pipe *pipe, **slot;
 
-	pipe = lookup_pipe(clienthash, pipetype);
-	if (!pipe) {
+	if (pipetype >= MAX_PIPE) {
+		cifsd_err("invalid pipe type %u\n", pipetype);
+		return -EINVAL;
+	}
+
+	client = lookup_client(clienthash);
+	slot = client ? pipe_slot(client, pipetype, id) : NULL;
+	if (!slot) {
 		cifsd_err("dcerpc pipe of type (%d) not found \n", pipetype);
 		return -EINVAL;
 	}
 
+	pipe = *slot;
+	if (--pipe->refcount) {
+		cifsd_debug("pipe %llu of type %u still open, refcount %d\n",
+				id, pipetype, pipe->refcount);
+		return 0;
+	}
+
 	cifsd_debug("remove pipe %p from clienthash 0x%llx\n", pipe,
 			clienthash);
+	cifsd_free_pipe(client, slot);
+	return 0;
+}
+
+static void cifsd_free_pipe(struct cifsd_client_info *client,
+		struct cifsd_pipe **slot)
+{
 	/* If need to add logic about cleaning up pipe buffers, ADD HERE */
-	list_del(&pipe->list);
-	free(pipe);
+	dcerpc_pipe_close(*slot);
+	cifsd_pool_free(CIFSD_POOL_PIPE, *slot);
+	*slot = NULL;
+	client->nr_pipes--;
+}
+
+/* when the reaper has to look at a client next */
+static __u64 client_expiry(struct cifsd_client_info *client)
+{
+	__u64 expires = client->last_active + cifsd_client_idle;
+	struct cifsd_pipe *pipe;
+	int t, i;
+
+	if (!client->nr_pipes || !cifsd_pipe_idle)
+		return expires;
+
+	expires = ~0ULL;
+	for (t = 0; t < MAX_PIPE; t++) {
+		for (i = 0; i < CIFSD_PIPE_INSTANCES; i++) {
+			pipe = client->pipes[t][i];
+			if (pipe && pipe->last_used + cifsd_pipe_idle < expires)
+				expires = pipe->last_used + cifsd_pipe_idle;
+		}
+	}
+	return expires;
+}
+
+/**
+ * reap_client() - free what a client left unused for too long
+ * @client:	client that came due, already off the wheel
+ * @nr_pipes:	incremented for every pipe freed
+ *
+ * Return:	1 if the client itself was freed, otherwise 0
+ */
+static int reap_client(struct cifsd_client_info *client,
+		unsigned int *nr_pipes)
+{
+	struct cifsd_pipe **slot;
+	int t, i;
+
+	for (t = 0; cifsd_pipe_idle && t < MAX_PIPE; t++) {
+		for (i = 0; i < CIFSD_PIPE_INSTANCES; i++) {
+			slot = &client->pipes[t][i];
+			if (!*slot ||
+				(*slot)->last_used + cifsd_pipe_idle > reap_now)
+				continue;
+			cifsd_debug("reaping pipe %llu of type %d, client 0x%llx\n",
+					(*slot)->id, t, client->hash);
+			cifsd_free_pipe(client, slot);
+			(*nr_pipes)++;
+		}
+	}
+
+	if (!client->nr_pipes &&
+			client->last_active + cifsd_client_idle <= reap_now) {
+		cifsd_debug("reaping idle client 0x%llx\n", client->hash);
+		if (!cifsd_client_del(client->hash))
+			return 1;
+	}
+
+	reap_arm(client, client_expiry(client));
 	return 0;
 }
 
-static int handle_create_pipe_event(void *msg)
+/**
+ * cifsd_reap_tick() - run the reaper of the calling thread
+ *
+ * Cheap when no second has passed since the last call. Clients with no
+ * pipes go after cifsd_client_idle seconds, pipes nobody used for
+ * cifsd_pipe_idle seconds are taken to be abandoned without a DESTROY.
+ */
+void cifsd_reap_tick(void)
+{
+	struct cifsd_client_info *client, *tmp;
+	struct list_head due;
+	unsigned int nr_clients = 0, nr_pipes = 0;
+	__u64 now;
+
+	if (!reap_ready)
+		return;
+
+	now = reap_clock();
+	if (now - reap_now > REAP_WHEEL_SLOTS)
+		reap_now = now - REAP_WHEEL_SLOTS;
+
+	while (reap_now < now) {
+		reap_now++;
+
+		/* reaping may put clients right back to this slot */
+		INIT_LIST_HEAD(&due);
+		list_for_each_entry_safe(client, tmp,
+				&reap_wheel[reap_now % REAP_WHEEL_SLOTS],
+				reap_list)
+			list_move_tail(&client->reap_list, &due);
+
+		list_for_each_entry_safe(client, tmp, &due, reap_list) {
+			list_del_init(&client->reap_list);
+			if (client_expiry(client) > reap_now)
+				reap_arm(client, client_expiry(client));
+			else
+				nr_clients += reap_client(client, &nr_pipes);
+		}
+	}
+
+	if (nr_clients || nr_pipes)
+		cifsd_stats_reaped(nr_clients, nr_pipes);
+}
+
+static int handle_create_pipe_event(struct cifsd_uevent *ev)
 {
-	struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
-	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
 	int ret;
 
 	cifsd_debug("CREATE: on server handle 0x%llx, pipe type %u\n",
 			ev->server_handle, ev->pipe_type);
 	ret = cifsd_create_pipe(ev->server_handle, ev->pipe_type,
-			ev->k.c_pipe.codepage);
+			ev->k.c_pipe.id, ev->k.c_pipe.codepage);
 	if (ret) {
 		//TODO:	... prepare pipe create failure netlink msg ...
 		cifsd_debug("CREATE: pipe failed %d\n", ret);
@@ -161,15 +621,14 @@ static int handle_create_pipe_event(void *msg)
 	return ret;
 }
 
-static int handle_remove_pipe_event(void *msg)
+static int handle_remove_pipe_event(struct cifsd_uevent *ev)
 {
-	struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
-	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
 	int ret;
 
 	cifsd_debug("DESTROY: on server handle 0x%llx, pipe %u\n",
 			ev->server_handle, ev->pipe_type);
-	ret = cifsd_remove_pipe(ev->server_handle, ev->pipe_type);
+	ret = cifsd_remove_pipe(ev->server_handle, ev->pipe_type,
+			ev->k.d_pipe.id);
 	if (ret) {
 		//TODO:	... prepare pipe removal failure netlink msg...
 		cifsd_debug("DESTROY: pipe failed %d\n", ret);
@@ -178,10 +637,8 @@ static int handle_remove_pipe_event(void *msg)
 	return ret;
 }
 
-static int handle_read_pipe_event(void *msg)
+static int handle_read_pipe_event(struct cifsd_uevent *ev)
 {
-	struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
-	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
 	struct cifsd_uevent rsp_ev;
 	struct cifsd_pipe *pipe;
 	char *buf;
@@ -189,15 +646,12 @@ static int handle_read_pipe_event(void *msg)
 	int nbytes = 0;
 
 	cifsd_debug("READ: on server handle 0x%llx\n", ev->server_handle);
-	assert(ev->k.r_pipe.out_buflen < NETLINK_CIFSD_MAX_PAYLOAD);
-	buf = calloc(1, NETLINK_CIFSD_MAX_PAYLOAD);
-	if (!buf) {
-		cifsd_debug("failed to allocate memory\n");
-		ret = -ENOMEM;
-		goto out;
-	}
+	if (ev->k.r_pipe.out_buflen > NETLINK_CIFSD_MAX_RSP_PAYLOAD)
+		ev->k.r_pipe.out_buflen = NETLINK_CIFSD_MAX_RSP_PAYLOAD;
+	buf = cifsd_rsp_buf_get();
 
-	pipe = lookup_pipe(ev->server_handle, ev->pipe_type);
+	pipe = lookup_pipe(ev->server_handle, ev->pipe_type,
+			ev->k.r_pipe.id);
 	if (!pipe) {
 		cifsd_debug("READ: pipetype %u lookup failed for clienthash 0x%llx\n",
 				ev->pipe_type, ev->server_handle);
@@ -224,21 +678,19 @@ out:
 	ret = cifsd_common_sendmsg(&rsp_ev, buf, nbytes);
 	cifsd_debug("READ: response u->k send, on server handle 0x%llx, ret %d\n",
 			ev->server_handle, ret);
-	if (buf)
-		free(buf);
+	cifsd_rsp_buf_put(buf, ev->k.r_pipe.out_buflen);
 	return ret;
 }
 
-static int handle_write_pipe_event(void *msg)
+static int handle_write_pipe_event(struct cifsd_uevent *ev)
 {
-	struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
-	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
 	struct cifsd_uevent rsp_ev;
 	struct cifsd_pipe *pipe;
 	int ret;
 
 	cifsd_debug("WRITE: on server handle 0x%llx\n", ev->server_handle);
-	pipe = lookup_pipe(ev->server_handle, ev->pipe_type);
+	pipe = lookup_pipe(ev->server_handle, ev->pipe_type,
+			ev->k.w_pipe.id);
 	if (!pipe) {
 		cifsd_debug("WRITE: pipetype %u lookup failed for clienthash 0x%llx\n",
 				ev->pipe_type, ev->server_handle);
@@ -246,7 +698,7 @@ static int handle_write_pipe_event(void *msg)
 		goto out;
 	}
 
-	ret = process_rpc(pipe, ev->buffer);
+	ret = process_rpc(pipe, ev->buffer, ev->buflen);
 	if (ret)
 		cifsd_debug("process_rpc: failed ret %d\n", ret);
 
@@ -265,10 +717,8 @@ out:
 	return ret;
 }
 
-static int handle_ioctl_pipe_event(void *msg)
+static int handle_ioctl_pipe_event(struct cifsd_uevent *ev)
 {
-	struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
-	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
 	struct cifsd_uevent rsp_ev;
 	struct cifsd_pipe *pipe;
 	char *buf;
@@ -276,15 +726,12 @@ static int handle_ioctl_pipe_event(void *msg)
 	int nbytes = 0;
 
 	cifsd_debug("IOCTL: on server handle %llu\n", ev->server_handle);
-	assert(ev->k.i_pipe.out_buflen < NETLINK_CIFSD_MAX_PAYLOAD);
-	buf = calloc(1, NETLINK_CIFSD_MAX_PAYLOAD);
-	if (!buf) {
-		cifsd_debug("failed to allocate memory\n");
-		ret = -ENOMEM;
-		goto out;
-	}
+	if (ev->k.i_pipe.out_buflen > NETLINK_CIFSD_MAX_RSP_PAYLOAD)
+		ev->k.i_pipe.out_buflen = NETLINK_CIFSD_MAX_RSP_PAYLOAD;
+	buf = cifsd_rsp_buf_get();
 
-	pipe = lookup_pipe(ev->server_handle, ev->pipe_type);
+	pipe = lookup_pipe(ev->server_handle, ev->pipe_type,
+			ev->k.i_pipe.id);
 	if (!pipe) {
 		cifsd_debug("IOCTL: pipetype %u lookup failed for clienthash 0x%llx\n",
 				ev->pipe_type, ev->server_handle);
@@ -292,7 +739,7 @@ static int handle_ioctl_pipe_event(void *msg)
 		goto out;
 	}
 
-	ret = process_rpc(pipe, ev->buffer);
+	ret = process_rpc(pipe, ev->buffer, ev->buflen);
 	if (ret) {
 		cifsd_debug("process_rpc: failed %d\n", ret);
 		goto out;
@@ -316,56 +763,42 @@ out:
 	ret = cifsd_common_sendmsg(&rsp_ev, buf, nbytes);
 	cifsd_debug("IOCTL: response u->k send, on server handle 0x%llx, ret %d\n",
 			ev->server_handle, ret);
-	if (buf)
-		free(buf);
+	cifsd_rsp_buf_put(buf, ev->k.i_pipe.out_buflen);
 
 	return ret;
 }
 
-static int handle_lanman_pipe_event(void *msg)
+/*
+ * RAP calls are stateless, the pipe they run on only carries the
+ * codepage and user name of the request. It lives on the stack and the
+ * client registry is never touched.
+ */
+static int handle_lanman_pipe_event(struct cifsd_uevent *ev)
 {
-	struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
-	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
 	struct cifsd_uevent rsp_ev;
-	struct cifsd_pipe *pipe;
+	struct cifsd_pipe pipe;
 	char *buf;
-	int ret;
+	int ret = 0;
 	int nbytes = 0;
 	int param_len = 0;
 
 	cifsd_debug("LANMAN: on server handle 0x%llx\n", ev->server_handle);
-	assert(ev->k.l_pipe.out_buflen < NETLINK_CIFSD_MAX_PAYLOAD);
-	buf = calloc(1, NETLINK_CIFSD_MAX_PAYLOAD);
-	if (!buf) {
-		cifsd_debug("failed to allocate memory\n");
-		ret = -ENOMEM;
-		goto out;
-	}
-
-	ret = cifsd_create_pipe(ev->server_handle, ev->pipe_type,
-			ev->k.l_pipe.codepage);
-	if (ret) {
-		cifsd_debug("CREATE: pipe failed %d\n", ret);
-		goto out;
-	}
+	if (ev->k.l_pipe.out_buflen > NETLINK_CIFSD_MAX_RSP_PAYLOAD)
+		ev->k.l_pipe.out_buflen = NETLINK_CIFSD_MAX_RSP_PAYLOAD;
+	buf = cifsd_rsp_buf_get();
 
-	pipe = lookup_pipe(ev->server_handle, ev->pipe_type);
-	if (!pipe) {
-		cifsd_debug("LANMAN: pipetype %u lookup failed for clienthash 0x%llx\n",
-				ev->pipe_type, ev->server_handle);
-		ret = -ENOENT;
-		goto out;
-	}
+	/* the kernel's strings need not be terminated, the copies are */
+	memset(&pipe, 0, sizeof(pipe));
+	pipe.pipe_type = ev->pipe_type;
+	memcpy(pipe.codepage, ev->k.l_pipe.codepage, CIFSD_CODEPAGE_LEN - 1);
+	memcpy(pipe.username, ev->k.l_pipe.username, CIFSD_USERNAME_LEN - 1);
 
-	strncpy(pipe->username, ev->k.l_pipe.username,
-			CIFSD_USERNAME_LEN - 1);
-	nbytes = handle_lanman_pipe(pipe, ev->buffer, buf, &param_len);
+	nbytes = handle_lanman_pipe(&pipe, ev->buffer, buf, &param_len);
 	if (nbytes < 0) {
 		ret = nbytes;
 		nbytes = 0;
 	}
 
-out:
 	memset(&rsp_ev, 0, sizeof(rsp_ev));
 	rsp_ev.type = CIFSD_UEVENT_LANMAN_PIPE_RSP;
 	rsp_ev.server_handle = ev->server_handle;
@@ -378,12 +811,15 @@ out:
 	ret = cifsd_common_sendmsg(&rsp_ev, buf, nbytes);
 	cifsd_debug("IOCTL: response u->k send, on server handle 0x%llx, ret %d\n",
 			ev->server_handle, ret);
-	if (buf)
-		free(buf);
-
-	ret = cifsd_remove_pipe(ev->server_handle, ev->pipe_type);
-	if (ret)
-		cifsd_debug("DESTROY: pipe failed %d\n", ret);
+	/*
+	 * LANMAN encoders don't know the buffer length and may bail out
+	 * after writing some of it, clear all of it when they failed.
+	 */
+	if (rsp_ev.error)
+		nbytes = NETLINK_CIFSD_MAX_RSP_PAYLOAD;
+	else if (nbytes < ev->k.l_pipe.out_buflen)
+		nbytes = ev->k.l_pipe.out_buflen;
+	cifsd_rsp_buf_put(buf, nbytes);
 
 	return ret;
 }
@@ -392,38 +828,45 @@ out:
  * once the pipe is available, utilize the code from process_rpc/process_rpc_rsp
  * modify the rpc request/response to use the pipe from above methods
  */
-int request_handler(void *msg)
+int request_handler(struct nlmsghdr *nlh)
 {
-	struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
 	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
 	int ret = 0;
 
+	/* buflen is the kernel's word, the payload must really be there */
+	if (nlh->nlmsg_len < NLMSG_SPACE(sizeof(*ev)) ||
+			ev->buflen > nlh->nlmsg_len - NLMSG_SPACE(sizeof(*ev))) {
+		cifsd_err("dropping event %u, buflen %u past message len %u\n",
+				nlh->nlmsg_type, ev->buflen, nlh->nlmsg_len);
+		return -EINVAL;
+	}
+
 	cifsd_debug("got %u event, pipe type %u\n", nlh->nlmsg_type,
 			ev->pipe_type);
 
 	switch (nlh->nlmsg_type) {
 	case CIFSD_KEVENT_CREATE_PIPE:
-		ret = handle_create_pipe_event(msg);
+		ret = handle_create_pipe_event(ev);
 		break;
 
 	case CIFSD_KEVENT_DESTROY_PIPE:
-		ret = handle_remove_pipe_event(msg);
+		ret = handle_remove_pipe_event(ev);
 		break;
 
 	case CIFSD_KEVENT_READ_PIPE:
-		ret = handle_read_pipe_event(msg);
+		ret = handle_read_pipe_event(ev);
 		break;
 
 	case CIFSD_KEVENT_WRITE_PIPE:
-		ret = handle_write_pipe_event(msg);
+		ret = handle_write_pipe_event(ev);
 		break;
 
 	case CIFSD_KEVENT_IOCTL_PIPE:
-		ret = handle_ioctl_pipe_event(msg);
+		ret = handle_ioctl_pipe_event(ev);
 		break;
 
 	case CIFSD_KEVENT_LANMAN_PIPE:
-		ret = handle_lanman_pipe_event(msg);
+		ret = handle_lanman_pipe_event(ev);
 		break;
 
 	case CIFSD_KEVENT_SMBPORT_CLOSE_FAIL:
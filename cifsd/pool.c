@@ -0,0 +1,294 @@
+/*
+ *   cifsd-tools/cifsd/pool.c
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cifsd.h"
+#include "pool.h"
+#include "stats.h"
+
+struct pool_obj {
+	struct pool_obj		*next;
+};
+
+struct cifsd_pool {
+	size_t			size;
+	pthread_mutex_t		lock;
+	struct pool_obj		*free;
+	unsigned int		nr_free;
+	/* in the statistics file when there is one */
+	struct cifsd_pool_stats	*stats;
+};
+
+struct pool_cache {
+	struct pool_obj		*head;
+	unsigned int		count;
+};
+
+struct arena_block {
+	struct arena_block	*next;
+	size_t			size;
+	size_t			used;
+	long long		data[0];
+};
+
+struct cifsd_arena {
+	struct arena_block	*block;	/* allocated from, first one kept */
+	size_t			need;	/* bytes asked for since the reset */
+};
+
+static struct cifsd_pool cifsd_pools[CIFSD_POOL_NR];
+static struct cifsd_pool_stats cifsd_pool_counters[CIFSD_POOL_NR];
+static __thread struct pool_cache pool_caches[CIFSD_POOL_NR];
+static __thread struct cifsd_arena thread_arena;
+
+#define pool_count(pool, field, n)					\
+	__atomic_fetch_add(&(pool)->stats->field, (n), __ATOMIC_RELAXED)
+
+/**
+ * cifsd_pool_init() - set up an object pool
+ * @id:		CIFSD_POOL_CLIENT, CIFSD_POOL_PIPE or CIFSD_POOL_REASM
+ * @size:	object size
+ *
+ * Must run after cifsd_stats_init(), the pool counters go to the
+ * statistics file if it is mapped.
+ */
+void cifsd_pool_init(int id, size_t size)
+{
+	struct cifsd_pool *pool = &cifsd_pools[id];
+
+	if (size < sizeof(struct pool_obj))
+		size = sizeof(struct pool_obj);
+
+	pool->size = size;
+	pthread_mutex_init(&pool->lock, NULL);
+	if (cifsd_stats)
+		pool->stats = &cifsd_stats->pools[id];
+	else
+		pool->stats = &cifsd_pool_counters[id];
+}
+
+/* move up to @nr objects from the shared list to the thread cache */
+static void pool_refill(struct cifsd_pool *pool, struct pool_cache *cache,
+		unsigned int nr)
+{
+	struct pool_obj *obj;
+
+	pthread_mutex_lock(&pool->lock);
+	while (nr-- && (obj = pool->free)) {
+		pool->free = obj->next;
+		pool->nr_free--;
+		obj->next = cache->head;
+		cache->head = obj;
+		cache->count++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* give @nr objects of the thread cache back to the shared list */
+static void pool_drain(struct cifsd_pool *pool, struct pool_cache *cache,
+		unsigned int nr)
+{
+	struct pool_obj *obj;
+
+	pthread_mutex_lock(&pool->lock);
+	while (nr-- && (obj = cache->head)) {
+		cache->head = obj->next;
+		cache->count--;
+		obj->next = pool->free;
+		pool->free = obj;
+		pool->nr_free++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * cifsd_pool_alloc() - get a zeroed object from a pool
+ * @id:		pool
+ *
+ * Return:	object, or NULL on allocation failure
+ */
+void *cifsd_pool_alloc(int id)
+{
+	struct cifsd_pool *pool = &cifsd_pools[id];
+	struct pool_cache *cache = &pool_caches[id];
+	struct pool_obj *obj;
+
+	pool_count(pool, allocs, 1);
+
+	if (!cache->head)
+		pool_refill(pool, cache, CIFSD_POOL_BATCH);
+
+	obj = cache->head;
+	if (obj) {
+		cache->head = obj->next;
+		cache->count--;
+		pool_count(pool, hits, 1);
+		memset(obj, 0, pool->size);
+	} else {
+		obj = calloc(1, pool->size);
+		if (!obj)
+			return NULL;
+		pool_count(pool, objects, 1);
+	}
+
+	pool_count(pool, in_use, 1);
+	return obj;
+}
+
+/**
+ * cifsd_pool_free() - return an object to its pool
+ * @id:		pool the object came from
+ * @obj:	object, may be NULL
+ */
+void cifsd_pool_free(int id, void *obj)
+{
+	struct cifsd_pool *pool = &cifsd_pools[id];
+	struct pool_cache *cache = &pool_caches[id];
+	struct pool_obj *o = obj;
+
+	if (!o)
+		return;
+
+	o->next = cache->head;
+	cache->head = o;
+	cache->count++;
+	__atomic_fetch_sub(&pool->stats->in_use, 1, __ATOMIC_RELAXED);
+
+	if (cache->count > CIFSD_POOL_CACHE_MAX)
+		pool_drain(pool, cache, CIFSD_POOL_BATCH);
+}
+
+/**
+ * cifsd_pool_thread_exit() - hand the calling thread's cached objects back
+ *
+ * Called by threads that allocated from the pools before they exit, so
+ * the objects stay usable by the remaining threads. The arena of the
+ * thread is freed.
+ */
+void cifsd_pool_thread_exit(void)
+{
+	int i;
+
+	for (i = 0; i < CIFSD_POOL_NR; i++) {
+		if (cifsd_pools[i].size)
+			pool_drain(&cifsd_pools[i], &pool_caches[i],
+					pool_caches[i].count);
+	}
+
+	cifsd_arena_reset(&thread_arena);
+	free(thread_arena.block);
+	thread_arena.block = NULL;
+}
+
+/**
+ * cifsd_arena_get() - scratch arena of the calling thread
+ *
+ * A thread handles one request at a time, the arena is reset when the
+ * request is done.
+ *
+ * Return:	arena
+ */
+struct cifsd_arena *cifsd_arena_get(void)
+{
+	return &thread_arena;
+}
+
+static struct arena_block *arena_block_new(size_t size)
+{
+	struct arena_block *block;
+
+	block = malloc(sizeof(*block) + size);
+	if (!block)
+		return NULL;
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+/**
+ * cifsd_arena_alloc() - get zeroed memory that lives until the next reset
+ * @arena:	arena of the request
+ * @size:	object size
+ *
+ * Return:	object aligned for any scalar, or NULL on allocation failure
+ */
+void *cifsd_arena_alloc(struct cifsd_arena *arena, size_t size)
+{
+	struct arena_block *block = arena->block;
+	void *obj;
+
+	size = (size + sizeof(long long) - 1) & ~(sizeof(long long) - 1);
+	arena->need += size;
+
+	if (!block || block->size - block->used < size) {
+		block = arena_block_new(size > CIFSD_ARENA_BLOCK ?
+				size : CIFSD_ARENA_BLOCK);
+		if (!block)
+			return NULL;
+		/* the first block is kept last in the chain */
+		block->next = arena->block;
+		arena->block = block;
+	}
+
+	obj = (char *)block->data + block->used;
+	block->used += size;
+	memset(obj, 0, size);
+	return obj;
+}
+
+/**
+ * cifsd_arena_reset() - free everything allocated from an arena at once
+ * @arena:	arena of the request
+ *
+ * Only the first block is kept. If the request needed more, that block
+ * is replaced by one big enough for all of it, up to
+ * CIFSD_ARENA_BLOCK_MAX.
+ */
+void cifsd_arena_reset(struct cifsd_arena *arena)
+{
+	struct arena_block *block = arena->block, *next;
+	size_t need = arena->need;
+
+	arena->need = 0;
+	if (!block)
+		return;
+
+	while (block->next) {
+		next = block->next;
+		free(block);
+		block = next;
+	}
+	block->used = 0;
+	arena->block = block;
+
+	if (need <= block->size || block->size >= CIFSD_ARENA_BLOCK_MAX)
+		return;
+	if (need > CIFSD_ARENA_BLOCK_MAX)
+		need = CIFSD_ARENA_BLOCK_MAX;
+	next = arena_block_new(need);
+	if (!next)
+		return;
+	free(block);
+	arena->block = next;
+}
@@ -0,0 +1,64 @@
+/*
+ *   cifsd-tools/cifsd/pool.h
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef __CIFSD_TOOLS_POOL_H
+#define __CIFSD_TOOLS_POOL_H
+
+#include <stddef.h>
+#include "cifsd_stats.h"
+
+/*
+ * Free-list pools for the small objects every session allocates and
+ * frees. Objects are never given back to malloc, a freed object goes
+ * to a per-thread cache first and overflows into a shared list.
+ */
+enum {
+	CIFSD_POOL_CLIENT	= CIFSD_STAT_POOL_CLIENT,
+	CIFSD_POOL_PIPE		= CIFSD_STAT_POOL_PIPE,
+	CIFSD_POOL_REASM	= CIFSD_STAT_POOL_REASM,
+	CIFSD_POOL_NR		= CIFSD_STAT_NR_POOLS
+};
+
+/* objects moved between a thread cache and the shared list at once */
+#define CIFSD_POOL_BATCH	32
+/* objects a thread keeps before handing a batch back */
+#define CIFSD_POOL_CACHE_MAX	(2 * CIFSD_POOL_BATCH)
+
+void cifsd_pool_init(int id, size_t size);
+void *cifsd_pool_alloc(int id);
+void cifsd_pool_free(int id, void *obj);
+void cifsd_pool_thread_exit(void);
+
+/*
+ * Bump allocator for the scratch memory of one request. Every thread
+ * has its own arena, objects are never freed one by one but all at
+ * once when the request is done. A request that outgrows the arena
+ * block chains extra blocks and the block grows for the next one.
+ */
+#define CIFSD_ARENA_BLOCK	(16 * 1024)
+#define CIFSD_ARENA_BLOCK_MAX	(256 * 1024)
+
+struct cifsd_arena;
+
+struct cifsd_arena *cifsd_arena_get(void);
+void *cifsd_arena_alloc(struct cifsd_arena *arena, size_t size);
+void cifsd_arena_reset(struct cifsd_arena *arena);
+
+#endif /* __CIFSD_TOOLS_POOL_H */
@@ -0,0 +1,216 @@
+/*
+ *   cifsd-tools/cifsd/stats.c
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "cifsd.h"
+#include "netlink.h"
+#include "stats.h"
+
+struct cifsd_stats *cifsd_stats;
+char *cifsd_stats_path = PATH_CIFSD_EVSTATS;
+
+/* time the current event spent in cifsd_sendmsg() */
+static __thread __u64 stats_send_ns;
+
+/**
+ * cifsd_stats_init() - map the statistics file
+ *
+ * Statistics are optional, the daemon runs without them when the file
+ * can't be set up.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int cifsd_stats_init(void)
+{
+	struct cifsd_stats *stats;
+	int fd;
+
+	if (!cifsd_stats_path)
+		return 0;
+
+	fd = open(cifsd_stats_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644);
+	if (fd < 0) {
+		cifsd_err("can't open %s, err %d, statistics disabled\n",
+				cifsd_stats_path, errno);
+		return -errno;
+	}
+
+	if (ftruncate(fd, sizeof(struct cifsd_stats))) {
+		cifsd_err("can't size %s, err %d, statistics disabled\n",
+				cifsd_stats_path, errno);
+		close(fd);
+		return -errno;
+	}
+
+	stats = mmap(NULL, sizeof(struct cifsd_stats), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED) {
+		cifsd_err("can't map %s, err %d, statistics disabled\n",
+				cifsd_stats_path, errno);
+		return -errno;
+	}
+
+	stats->version = CIFSD_STATS_VERSION;
+	stats->size = sizeof(struct cifsd_stats);
+	stats->hist_buckets = CIFSD_HIST_BUCKETS;
+	stats->start_time = time(NULL);
+	__atomic_store_n(&stats->magic, CIFSD_STATS_MAGIC, __ATOMIC_RELEASE);
+
+	cifsd_stats = stats;
+	return 0;
+}
+
+void cifsd_stats_exit(void)
+{
+	if (!cifsd_stats)
+		return;
+
+	munmap(cifsd_stats, sizeof(struct cifsd_stats));
+	cifsd_stats = NULL;
+}
+
+__u64 cifsd_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Histograms are updated by all workers at once. Relaxed atomics are
+ * enough, readers only want a consistent enough snapshot.
+ */
+static void cifsd_hist_add(struct cifsd_hist *hist, __u64 ns)
+{
+	__u64 max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&hist->buckets[cifsd_hist_bucket(ns)], 1,
+			__ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+
+	while (ns > max && !__atomic_compare_exchange_n(&hist->max_ns, &max,
+				ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * cifsd_stats_send() - account a response sent for the current event
+ * @start_ns:	cifsd_stats_now() before sending
+ */
+void cifsd_stats_send(__u64 start_ns)
+{
+	if (!cifsd_stats)
+		return;
+
+	stats_send_ns += cifsd_stats_now() - start_ns;
+}
+
+/**
+ * cifsd_stats_event() - account a handled kernel event
+ * @type:	netlink message type of the event
+ * @rx_ns:	cifsd_stats_now() when the event was received
+ * @start_ns:	cifsd_stats_now() when the handler was called
+ * @ret:	handler return value
+ */
+void cifsd_stats_event(unsigned int type, __u64 rx_ns, __u64 start_ns,
+		int ret)
+{
+	struct cifsd_event_stats *ev;
+	__u64 now, send_ns = stats_send_ns;
+
+	stats_send_ns = 0;
+	if (!cifsd_stats || type < CIFSD_KEVENT_CREATE_PIPE ||
+			type >= CIFSD_KEVENT_CREATE_PIPE + CIFSD_STAT_NR_EVENTS)
+		return;
+
+	now = cifsd_stats_now();
+	ev = &cifsd_stats->events[type - CIFSD_KEVENT_CREATE_PIPE];
+	if (ret < 0)
+		__atomic_fetch_add(&ev->errors, 1, __ATOMIC_RELAXED);
+
+	if (rx_ns)
+		cifsd_hist_add(&ev->time[CIFSD_STAT_RX_TO_SEND], now - rx_ns);
+	cifsd_hist_add(&ev->time[CIFSD_STAT_HANDLER],
+			now - start_ns - send_ns);
+	if (send_ns)
+		cifsd_hist_add(&ev->time[CIFSD_STAT_SEND], send_ns);
+}
+
+/**
+ * cifsd_stats_opnum() - account an RPC request passed to its handler
+ * @iface:	CIFSD_STAT_SRVSVC, CIFSD_STAT_WKSSVC or CIFSD_STAT_WINREG
+ * @opnum:	RPC operation number
+ * @start_ns:	cifsd_stats_now() before dispatching the request
+ * @ret:	handler return value
+ */
+void cifsd_stats_opnum(int iface, unsigned int opnum, __u64 start_ns,
+		int ret)
+{
+	struct cifsd_opnum_stats *op;
+
+	if (!cifsd_stats || opnum >= CIFSD_STAT_MAX_OPNUM)
+		return;
+
+	op = &cifsd_stats->opnums[iface][opnum];
+	if (ret < 0)
+		__atomic_fetch_add(&op->errors, 1, __ATOMIC_RELAXED);
+	cifsd_hist_add(&op->time, cifsd_stats_now() - start_ns);
+}
+
+/**
+ * cifsd_stats_rejected() - account an RPC request refused unhandled
+ * @iface:	CIFSD_STAT_SRVSVC, CIFSD_STAT_WKSSVC or CIFSD_STAT_WINREG
+ * @opnum:	RPC operation number
+ */
+void cifsd_stats_rejected(int iface, unsigned int opnum)
+{
+	if (!cifsd_stats || opnum >= CIFSD_STAT_MAX_OPNUM)
+		return;
+
+	__atomic_fetch_add(&cifsd_stats->opnums[iface][opnum].rejected, 1,
+			__ATOMIC_RELAXED);
+}
+
+/**
+ * cifsd_stats_reaped() - account clients and pipes freed by the reaper
+ * @nr_clients:	idle clients freed
+ * @nr_pipes:	abandoned pipes freed
+ */
+void cifsd_stats_reaped(unsigned int nr_clients, unsigned int nr_pipes)
+{
+	if (!cifsd_stats)
+		return;
+
+	__atomic_fetch_add(&cifsd_stats->reaped_clients, nr_clients,
+			__ATOMIC_RELAXED);
+	__atomic_fetch_add(&cifsd_stats->reaped_pipes, nr_pipes,
+			__ATOMIC_RELAXED);
+}
@@ -0,0 +1,49 @@
+/*
+ *   cifsd-tools/cifsd/stats.h
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef __CIFSD_TOOLS_DAEMON_STATS_H
+#define __CIFSD_TOOLS_DAEMON_STATS_H
+
+#include "cifsd_stats.h"
+
+/* mapped statistics, NULL when they are disabled */
+extern struct cifsd_stats *cifsd_stats;
+/* statistics file, NULL disables statistics */
+extern char *cifsd_stats_path;
+
+int cifsd_stats_init(void);
+void cifsd_stats_exit(void);
+
+__u64 cifsd_stats_now(void);
+void cifsd_stats_send(__u64 start_ns);
+void cifsd_stats_event(unsigned int type, __u64 rx_ns, __u64 start_ns,
+		int ret);
+void cifsd_stats_opnum(int iface, unsigned int opnum, __u64 start_ns,
+		int ret);
+void cifsd_stats_rejected(int iface, unsigned int opnum);
+void cifsd_stats_reaped(unsigned int nr_clients, unsigned int nr_pipes);
+
+/* start of a timed section, free when statistics are off */
+static inline __u64 cifsd_stats_start(void)
+{
+	return cifsd_stats ? cifsd_stats_now() : 0;
+}
+
+#endif /* __CIFSD_TOOLS_DAEMON_STATS_H */
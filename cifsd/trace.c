@@ -0,0 +1,254 @@
+/*
+ *   cifsd-tools/cifsd/trace.c
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "trace.h"
+#include "workq.h"
+#include "stats.h"
+
+#define CIFSD_TRACE_BUF_SIZE	(256 * 1024)
+
+int cifsd_replaying;
+
+static int trace_fd = -1;
+static char *trace_buf;
+static unsigned int trace_used;
+static __u64 trace_start_ns;
+
+extern void initialize(void);
+
+static __u64 trace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int trace_flush(void)
+{
+	unsigned int off = 0;
+	int ret;
+
+	while (off < trace_used) {
+		ret = write(trace_fd, trace_buf + off, trace_used - off);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			cifsd_err("trace write failed, err %d\n", errno);
+			return -errno;
+		}
+		off += ret;
+	}
+
+	trace_used = 0;
+	return 0;
+}
+
+/**
+ * cifsd_trace_open() - start recording received kernel events
+ * @path:	trace file, truncated if it exists
+ *
+ * Return:	0 on success, otherwise error
+ */
+int cifsd_trace_open(const char *path)
+{
+	struct cifsd_trace_hdr hdr;
+
+	trace_buf = malloc(CIFSD_TRACE_BUF_SIZE);
+	if (!trace_buf)
+		return -ENOMEM;
+
+	trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (trace_fd < 0) {
+		cifsd_err("can't open trace %s, err %d\n", path, errno);
+		free(trace_buf);
+		trace_buf = NULL;
+		return -errno;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CIFSD_TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CIFSD_TRACE_VERSION;
+	hdr.uevent_size = sizeof(struct cifsd_uevent);
+	memcpy(trace_buf, &hdr, sizeof(hdr));
+	trace_used = sizeof(hdr);
+
+	trace_start_ns = trace_now_ns();
+	/* termination goes through exit(), keep what was buffered */
+	atexit(cifsd_trace_close);
+	return 0;
+}
+
+/**
+ * cifsd_trace_record() - append a received event to the trace
+ * @nlh:	netlink message as read off the socket
+ *
+ * Only called from the netlink thread. Records are buffered and the
+ * buffer length is bumped after the copy, so a flush from the exit path
+ * never writes half a record.
+ */
+void cifsd_trace_record(struct nlmsghdr *nlh)
+{
+	struct cifsd_trace_rec rec;
+
+	if (trace_fd < 0)
+		return;
+
+	if (trace_used + sizeof(rec) + nlh->nlmsg_len > CIFSD_TRACE_BUF_SIZE &&
+			trace_flush())
+		return;
+
+	rec.ts_ns = trace_now_ns() - trace_start_ns;
+	rec.len = nlh->nlmsg_len;
+	rec.reserved = 0;
+	memcpy(trace_buf + trace_used, &rec, sizeof(rec));
+	memcpy(trace_buf + trace_used + sizeof(rec), nlh, nlh->nlmsg_len);
+	trace_used += sizeof(rec) + nlh->nlmsg_len;
+}
+
+/**
+ * cifsd_trace_close() - flush and close the trace file
+ */
+void cifsd_trace_close(void)
+{
+	if (trace_fd < 0)
+		return;
+
+	trace_flush();
+	close(trace_fd);
+	trace_fd = -1;
+	free(trace_buf);
+	trace_buf = NULL;
+}
+
+static int trace_read_hdr(FILE *fp, const char *path)
+{
+	struct cifsd_trace_hdr hdr;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+			memcmp(hdr.magic, CIFSD_TRACE_MAGIC, sizeof(hdr.magic))) {
+		cifsd_err("%s is not a cifsd trace\n", path);
+		return -EINVAL;
+	}
+
+	if (hdr.version != CIFSD_TRACE_VERSION ||
+			hdr.uevent_size != sizeof(struct cifsd_uevent)) {
+		cifsd_err("%s: unsupported trace version %u, event size %u\n",
+				path, hdr.version, hdr.uevent_size);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void trace_wait_until(__u64 ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+			EINTR)
+		;
+}
+
+/**
+ * cifsd_trace_replay() - run a recorded trace through the event handlers
+ * @path:	trace file written by cifsd -R
+ * @paced:	keep the recorded gaps between events, otherwise replay
+ *		as fast as possible
+ *
+ * Events go through the regular dispatch path, workers included, and
+ * responses are dropped. Throughput is reported once every event has
+ * been handled.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int cifsd_trace_replay(const char *path, int paced)
+{
+	struct cifsd_trace_rec rec;
+	struct cifsd_work *work;
+	unsigned long nr = 0;
+	__u64 start, elapsed;
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		cifsd_err("can't open trace %s, err %d\n", path, errno);
+		return -errno;
+	}
+
+	ret = trace_read_hdr(fp, path);
+	if (ret)
+		goto out;
+
+	initialize();
+	cifsd_replaying = 1;
+	ret = cifsd_workq_init();
+	if (ret)
+		goto out;
+
+	start = trace_now_ns();
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		if (rec.len < NLMSG_SPACE(sizeof(struct cifsd_uevent)) ||
+				rec.len > NETLINK_CIFSD_MAX_BUF) {
+			cifsd_err("bad record %lu, len %u\n", nr, rec.len);
+			ret = -EINVAL;
+			break;
+		}
+
+		work = cifsd_work_alloc();
+		if (!work) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (fread(work->nlh, rec.len, 1, fp) != 1) {
+			cifsd_err("truncated record %lu\n", nr);
+			cifsd_work_free(work);
+			ret = -EINVAL;
+			break;
+		}
+
+		if (paced)
+			trace_wait_until(start + rec.ts_ns);
+		work->rx_ns = cifsd_stats_start();
+		cifsd_workq_dispatch(work);
+		nr++;
+	}
+
+	cifsd_workq_exit();
+	elapsed = trace_now_ns() - start;
+
+	printf("replayed %lu events in %.3f s, %.0f events/sec\n", nr,
+			elapsed / 1e9, elapsed ? nr / (elapsed / 1e9) : 0.0);
+out:
+	cifsd_replaying = 0;
+	fclose(fp);
+	return ret;
+}
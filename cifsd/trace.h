@@ -0,0 +1,54 @@
+/*
+ *   cifsd-tools/cifsd/trace.h
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef __CIFSD_TOOLS_TRACE_H
+#define __CIFSD_TOOLS_TRACE_H
+
+#include "netlink.h"
+
+/*
+ * Trace file: a header followed by one record per received kernel
+ * event, each record being a cifsd_trace_rec and the netlink message
+ * exactly as it was read off the socket.
+ */
+#define CIFSD_TRACE_MAGIC	"CIFSDTRC"
+#define CIFSD_TRACE_VERSION	1
+
+struct cifsd_trace_hdr {
+	char		magic[8];
+	__u32		version;
+	__u32		uevent_size;	/* sizeof(struct cifsd_uevent) */
+};
+
+struct cifsd_trace_rec {
+	__u64		ts_ns;		/* since the trace was opened */
+	__u32		len;		/* netlink message length */
+	__u32		reserved;
+};
+
+/* set while replaying, responses are dropped instead of sent */
+extern int cifsd_replaying;
+
+int cifsd_trace_open(const char *path);
+void cifsd_trace_record(struct nlmsghdr *nlh);
+void cifsd_trace_close(void);
+int cifsd_trace_replay(const char *path, int paced);
+
+#endif /* __CIFSD_TOOLS_TRACE_H */
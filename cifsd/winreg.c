@@ -20,6 +20,7 @@
  */
 
 #include "winreg.h"
+#include "ndr_winreg.h"
 
 struct registry_node *reg_openhkcr;
 struct registry_node *reg_openhkcu;
@@ -111,68 +112,255 @@ int init_predefined_registry(void)
 	return 0;
 }
 
-int winreg_open_root_key(struct cifsd_pipe *pipe, int opnum,
-				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
+/*
+ * A key handle carries the address of its registry node after the
+ * handle type, the rest is zero. Handles come back from the client, a
+ * node is only used after it was found in the registry.
+ */
+#define WINREG_HANDLE_KEY	4
+
+static int winreg_key_in(struct registry_node *node,
+		struct registry_node *key)
 {
-	RPC_REQUEST_RSP *rpc_request_rsp;
-	OPENHKEY_RSP *winreg_rsp = malloc(sizeof(OPENHKEY_RSP));
+	for (; node; node = node->neighbour)
+		if (node == key || winreg_key_in(node->child, key))
+			return 1;
+	return 0;
+}
 
-	if (!winreg_rsp)
-		return -ENOMEM;
+void winreg_handle_set(void *handle, struct registry_node *key)
+{
+	memset(handle, 0, sizeof(KEY_HANDLE));
+	memcpy((char *)handle + WINREG_HANDLE_KEY, &key, sizeof(key));
+}
 
-	pipe->data = (char *)winreg_rsp;
-	rpc_request_rsp = &winreg_rsp->rpc_request_rsp;
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
-	switch (opnum) {
-	case WINREG_OPENHKCR:
-		winreg_rsp->key_handle.addr = (__u32)reg_openhkcr;
-		reg_openhkcr->open_status = 1;
+struct registry_node *winreg_handle_key(const void *handle)
+{
+	struct registry_node *roots[] = {
+		reg_openhkcr, reg_openhkcu, reg_openhklm, reg_openhku
+	};
+	struct registry_node *key;
+	int i;
+
+	memcpy(&key, (const char *)handle + WINREG_HANDLE_KEY, sizeof(key));
+	if (!key)
+		return NULL;
+	for (i = 0; i < sizeof(roots) / sizeof(roots[0]); i++)
+		if (roots[i] && (roots[i] == key ||
+				winreg_key_in(roots[i]->child, key)))
+			return key;
+	cifsd_debug("stale or forged key handle\n");
+	return NULL;
+}
+
+/* handle of an open key, or NULL */
+static struct registry_node *winreg_open_handle(struct policy_handle *h)
+{
+	struct registry_node *key = winreg_handle_key(h);
+
+	if (!key || !key->open_status)
+		return NULL;
+	return key;
+}
+
+/**
+ * winreg_open_root_key() - open one of the predefined root keys
+ * @pipe:	pipe the request came in on
+ * @ndr:	reader positioned at the request stub
+ *
+ * OpenHKCR, OpenHKCU, OpenHKLM and OpenHKU only differ by their opnum.
+ *
+ * Return:	0 on success or error number
+ */
+int winreg_open_root_key(struct cifsd_pipe *pipe, struct ndr *ndr)
+{
+	const struct ndr_call *call = &ndr_table_winreg.calls[pipe->opnum];
+	struct registry_node *root;
+	struct winreg_OpenHKLM r;
+	int ret;
+
+	ret = call->pull_in(ndr, &r);
+	if (ret)
+		return ret;
+
+	switch (pipe->opnum) {
+	case NDR_WINREG_OPENHKCR:
+		root = reg_openhkcr;
 		break;
-	case WINREG_OPENHKCU:
-		winreg_rsp->key_handle.addr = (__u32)reg_openhkcu;
-		reg_openhkcu->open_status = 1;
+	case NDR_WINREG_OPENHKCU:
+		root = reg_openhkcu;
 		break;
-	case WINREG_OPENHKLM:
-		winreg_rsp->key_handle.addr = (__u32)reg_openhklm;
-		reg_openhklm->open_status = 1;
+	case NDR_WINREG_OPENHKU:
+		root = reg_openhku;
 		break;
-	case WINREG_OPENHKU:
-		winreg_rsp->key_handle.addr = (__u32)reg_openhku;
-		reg_openhku->open_status = 1;
+	default:
+		root = reg_openhklm;
 		break;
 	}
-	reg_openhkcr->open_status = 1;
-	winreg_rsp->key_handle.addr = (__u32)reg_openhkcr;
-	winreg_rsp->werror = cpu_to_le32(WERR_OK);
-	cifsd_debug("open_key ptr to handle = %x\n",
-					winreg_rsp->key_handle.addr);
-	return 0;
+	root->open_status = 1;
+	winreg_handle_set(r.out.handle, root);
+	r.out.result = WERR_OK;
+	cifsd_debug("open_root_key %s\n", root->key_name);
+	return dcerpc_reply(pipe, call, &r);
 }
 
-int winreg_get_version(struct cifsd_pipe *pipe,
-				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
+int winreg_get_version(struct cifsd_pipe *pipe, struct ndr *ndr)
 {
-	RPC_REQUEST_RSP *rpc_request_rsp;
-	GET_VERSION_RSP *winreg_rsp =
-				malloc(sizeof(GET_VERSION_RSP));
-	if (!winreg_rsp)
-		return -ENOMEM;
+	const struct ndr_call *call =
+		&ndr_table_winreg.calls[NDR_WINREG_GETVERSION];
+	struct winreg_GetVersion r;
+	int ret;
+
+	ret = ndr_pull_winreg_GetVersion_in(ndr, &r);
+	if (ret)
+		return ret;
+
+	*r.out.version = 5;
+	r.out.result = WERR_OK;
+	return dcerpc_reply(pipe, call, &r);
+}
 
-	pipe->data = (char *)winreg_rsp;
-	rpc_request_rsp = &winreg_rsp->rpc_request_rsp;
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
+/**
+ * winreg_open_key() - open a subkey of an open key
+ * @pipe:	pipe the request came in on
+ * @ndr:	reader positioned at the request stub
+ *
+ * Return:	0 on success or error number
+ */
+int winreg_open_key(struct cifsd_pipe *pipe, struct ndr *ndr)
+{
+	const struct ndr_call *call =
+		&ndr_table_winreg.calls[NDR_WINREG_OPENKEY];
+	struct registry_node *base_key, *key;
+	struct winreg_OpenKey r;
+	int ret;
+
+	ret = ndr_pull_winreg_OpenKey_in(ndr, &r);
+	if (ret)
+		return ret;
+
+	base_key = winreg_open_handle(r.in.parent_handle);
+	if (!base_key || !r.in.keyname.name) {
+		r.out.result = WERR_INVALID_PARAMETER;
+		return dcerpc_reply(pipe, call, &r);
+	}
 
-	winreg_rsp->version = cpu_to_le32(5);
-	winreg_rsp->werror = cpu_to_le32(WERR_OK);
-	cifsd_debug("get_version version = %d\n",
-					winreg_rsp->version);
-	return 0;
+	key = search_registry(r.in.keyname.name, base_key);
+	if (IS_ERR(key)) {
+		r.out.result = WERR_BAD_FILE;
+	} else {
+		key->open_status = 1;
+		winreg_handle_set(r.out.handle, key);
+		r.out.result = WERR_OK;
+	}
+	return dcerpc_reply(pipe, call, &r);
+}
+
+int winreg_close_key(struct cifsd_pipe *pipe, struct ndr *ndr)
+{
+	const struct ndr_call *call =
+		&ndr_table_winreg.calls[NDR_WINREG_CLOSEKEY];
+	struct registry_node *key;
+	struct winreg_CloseKey r;
+	int ret;
+
+	ret = ndr_pull_winreg_CloseKey_in(ndr, &r);
+	if (ret)
+		return ret;
+
+	/* a handle that is not open is sent back as it came */
+	key = winreg_open_handle(r.in.handle);
+	if (!key) {
+		r.out.result = WERR_INVALID_PARAMETER;
+	} else {
+		key->open_status = 0;
+		memset(r.out.handle, 0, sizeof(*r.out.handle));
+		r.out.result = WERR_OK;
+	}
+	return dcerpc_reply(pipe, call, &r);
+}
+
+/**
+ * winreg_query_value() - type and data of a value
+ * @pipe:	pipe the request came in on
+ * @ndr:	reader positioned at the request stub
+ *
+ * The sizes are always returned. The data is only when the client
+ * passed a buffer, WERR_MORE_DATA tells it the buffer is too small.
+ *
+ * Return:	0 on success or error number
+ */
+int winreg_query_value(struct cifsd_pipe *pipe, struct ndr *ndr)
+{
+	const struct ndr_call *call =
+		&ndr_table_winreg.calls[NDR_WINREG_QUERYVALUE];
+	struct registry_node *key;
+	struct registry_value *value;
+	struct winreg_QueryValue r;
+	char *name;
+	int ret;
+
+	ret = ndr_pull_winreg_QueryValue_in(ndr, &r);
+	if (ret)
+		return ret;
+
+	key = winreg_open_handle(r.in.handle);
+	name = r.in.value_name->name ? r.in.value_name->name : "";
+	if (!key || !r.in.type || !r.in.data_size || !r.in.data_length) {
+		r.out.result = WERR_INVALID_PARAMETER;
+		return dcerpc_reply(pipe, call, &r);
+	}
+
+	value = search_value(name, key);
+	if (IS_ERR(value)) {
+		if (!strcmp(name, "") || !strcmp(name, "Default"))
+			r.out.result = WERR_INVALID_PARAMETER;
+		else
+			r.out.result = WERR_BAD_FILE;
+		return dcerpc_reply(pipe, call, &r);
+	}
+
+	*r.out.type = value->value_type;
+	if (r.in.data && *r.in.data_size < value->value_size) {
+		*r.out.data_size = value->value_size;
+		*r.out.data_length = 0;
+		r.out.result = WERR_MORE_DATA;
+		return dcerpc_reply(pipe, call, &r);
+	}
+
+	*r.out.data_size = value->value_size;
+	*r.out.data_length = value->value_size;
+	if (r.in.data && value->value_size)
+		r.out.data = (__u8 *)value->value_buffer;
+	r.out.result = WERR_OK;
+	return dcerpc_reply(pipe, call, &r);
+}
+
+int winreg_set_value(struct cifsd_pipe *pipe, struct ndr *ndr)
+{
+	const struct ndr_call *call =
+		&ndr_table_winreg.calls[NDR_WINREG_SETVALUE];
+	struct registry_node *key;
+	struct registry_value *value;
+	struct winreg_SetValue r;
+	int ret;
+
+	ret = ndr_pull_winreg_SetValue_in(ndr, &r);
+	if (ret)
+		return ret;
+
+	key = winreg_open_handle(r.in.handle);
+	if (!key) {
+		r.out.result = WERR_INVALID_PARAMETER;
+		return dcerpc_reply(pipe, call, &r);
+	}
+
+	value = set_value(r.in.name.name ? r.in.name.name : "", r.in.type,
+			r.in.data, r.in.size, key);
+	if (PTR_ERR(value) == -ENOMEM)
+		return -ENOMEM;
+	r.out.result = IS_ERR(value) ? WERR_INVALID_PARAMETER : WERR_OK;
+	return dcerpc_reply(pipe, call, &r);
 }
 
 int winreg_delete_key(struct cifsd_pipe *pipe,
@@ -180,31 +368,32 @@ int winreg_delete_key(struct cifsd_pipe *pipe,
 {
 	RPC_REQUEST_RSP *rpc_request_rsp;
 	WINREG_COMMON_RSP *winreg_rsp;
-	struct registry_node *ret;
-	int key_addr;
+	struct registry_node *ret = ERR_PTR(-EINVAL);
 	char *relative_name;
 	struct registry_node *base_key;
 	struct registry_node *key;
 	struct registry_node *prev_key;
 	char *token;
-	char *name;
-	KEY_HANDLE *key_handle = (KEY_HANDLE *)in_data;
+	char *name, *kname;
 	NAME_INFO *name_info = (NAME_INFO *)(((char *)in_data) +
 							sizeof(KEY_HANDLE));
 
-	key_addr = key_handle->addr;
-	base_key = (struct registry_node *)key_addr;
+	base_key = winreg_handle_key(in_data);
 	relative_name = smb_strndup_from_utf16((char *)name_info->Buffer,
 			name_info->key_packet_len, 1, pipe->codepage);
 	if (IS_ERR(relative_name))
 		return PTR_ERR(relative_name);
-	name = malloc(sizeof(strlen(relative_name)));
-	strcpy(name, relative_name);
-	ret = search_registry(relative_name, (struct registry_node *)key_addr);
-	cifsd_debug("ret %x\n", (__u32)ret);
+	name = kname = strdup(relative_name);
+	if (!name) {
+		free(relative_name);
+		return -ENOMEM;
+	}
+	if (base_key)
+		ret = search_registry(relative_name, base_key);
 
 	winreg_rsp = malloc(sizeof(WINREG_COMMON_RSP) );
 	if (!winreg_rsp) {
+		free(kname);
 		free(relative_name);
 		return -ENOMEM;
 	}
@@ -245,6 +434,7 @@ int winreg_delete_key(struct cifsd_pipe *pipe,
 				rpc_request_req->hdr.call_id);
 	rpc_request_rsp->context_id = rpc_request_req->context_id;
 
+	free(kname);
 	free(relative_name);
 	cifsd_debug("delete_key\n");
 	return 0;
@@ -276,20 +466,24 @@ int winreg_create_key(struct cifsd_pipe *pipe,
 {
 	RPC_REQUEST_RSP *rpc_request_rsp;
 	CREATE_KEY_RSP *winreg_rsp;
-	struct registry_node *ret;
-	int key_addr;
+	struct registry_node *ret = ERR_PTR(-EINVAL);
+	struct registry_node *base_key;
 	char *relative_name;
 
-	KEY_HANDLE *key_handle = (KEY_HANDLE *)in_data;
 	NAME_INFO *name_info = (NAME_INFO *)(((char *)in_data) +
 						sizeof(KEY_HANDLE));
 
-	key_addr = key_handle->addr;
+	base_key = winreg_handle_key(in_data);
 	relative_name = smb_strndup_from_utf16((char *)name_info->Buffer,
 			name_info->key_packet_len, 1, pipe->codepage);
 	if (IS_ERR(relative_name))
 		return PTR_ERR(relative_name);
-	ret = create_key(relative_name, (struct registry_node *)key_addr);
+	if (base_key && base_key->open_status)
+		ret = create_key(relative_name, base_key);
+	if (PTR_ERR(ret) == -ENOMEM) {
+		free(relative_name);
+		return -ENOMEM;
+	}
 
 	winreg_rsp = malloc(sizeof(CREATE_KEY_RSP));
 	if (!winreg_rsp) {
@@ -299,109 +493,25 @@ int winreg_create_key(struct cifsd_pipe *pipe,
 
 	pipe->data = (char *)winreg_rsp;
 	rpc_request_rsp = &winreg_rsp->rpc_request_rsp;
-	winreg_rsp->key_handle.addr = (__u32)ret;
 	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
 				RPC_FLAG_FIRST | RPC_FLAG_LAST,
 				rpc_request_req->hdr.call_id);
 	rpc_request_rsp->context_id = rpc_request_req->context_id;
 	winreg_rsp->ref_id = cpu_to_le32(0x00020008);
-	winreg_rsp->action_taken = cpu_to_le32(REG_CREATED_NEW_KEY);
-	winreg_rsp->werror = cpu_to_le32(WERR_OK);
-	free(relative_name);
-	cifsd_debug("create_key ptr to handle = %x\n",
-					winreg_rsp->key_handle.addr);
-	return 0;
-}
-
-
-int winreg_open_key(struct cifsd_pipe *pipe,
-				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
-{
-	RPC_REQUEST_RSP *rpc_request_rsp;
-	OPENHKEY_RSP *winreg_rsp;
-	struct registry_node *ret;
-	int key_addr;
-	char *relative_name;
-	struct registry_node *base_key;
-
-	KEY_HANDLE *key_handle = (KEY_HANDLE *)in_data;
-	NAME_INFO *name_info = (NAME_INFO *)(((char *)in_data) +
-						sizeof(KEY_HANDLE));
-
-	key_addr = key_handle->addr;
-	base_key = (struct registry_node *)key_addr;
-	relative_name = smb_strndup_from_utf16((char *)name_info->Buffer,
-			name_info->key_packet_len, 1, pipe->codepage);
-	if (IS_ERR(relative_name))
-		return PTR_ERR(relative_name);
-	ret = search_registry(relative_name, (struct registry_node *)key_addr);
-
-	winreg_rsp = malloc(sizeof(OPENHKEY_RSP));
-	if (!winreg_rsp) {
-		free(relative_name);
-		return -ENOMEM;
-	}
-
-	pipe->data = (char *)winreg_rsp;
-
-	if (base_key == NULL || base_key->open_status == 0
-				|| relative_name == NULL) {
+	if (IS_ERR(ret)) {
+		winreg_handle_set(&winreg_rsp->key_handle, NULL);
+		winreg_rsp->action_taken = cpu_to_le32(REG_ACTION_NONE);
 		winreg_rsp->werror = cpu_to_le32(WERR_INVALID_PARAMETER);
-		winreg_rsp->key_handle.addr = 0;
-	} else if (IS_ERR(ret)) {
-		winreg_rsp->werror = cpu_to_le32(WERR_BAD_FILE);
-		winreg_rsp->key_handle.addr = 0;
 	} else {
-		ret->open_status = 1;
-		winreg_rsp->key_handle.addr = (__u32)ret;
+		winreg_handle_set(&winreg_rsp->key_handle, ret);
+		winreg_rsp->action_taken = cpu_to_le32(REG_CREATED_NEW_KEY);
 		winreg_rsp->werror = cpu_to_le32(WERR_OK);
 	}
-	rpc_request_rsp = &winreg_rsp->rpc_request_rsp;
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
 	free(relative_name);
-	cifsd_debug("open_key ptr to handle = %x\n",
-					winreg_rsp->key_handle.addr);
-
+	cifsd_debug("create_key %s\n", IS_ERR(ret) ? "failed" : "done");
 	return 0;
 }
 
-int winreg_close_key(struct cifsd_pipe *pipe,
-				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
-{
-	RPC_REQUEST_RSP *rpc_request_rsp;
-	OPENHKEY_RSP *winreg_rsp;
-	int key_addr;
-	KEY_HANDLE *key_handle = (KEY_HANDLE *)in_data;
-	struct registry_node *base_key;
-
-	key_addr = key_handle->addr;
-	base_key = (struct registry_node *)key_addr;
-
-	winreg_rsp = malloc(sizeof(OPENHKEY_RSP));
-	if (!winreg_rsp)
-		return -ENOMEM;
-
-	pipe->data = (char *)winreg_rsp;
-	rpc_request_rsp = &winreg_rsp->rpc_request_rsp;
-	if (base_key == NULL || base_key->open_status == 0) {
-		winreg_rsp->werror = cpu_to_le32(WERR_INVALID_PARAMETER);
-		winreg_rsp->key_handle.addr = key_handle->addr;
-	} else {
-		base_key->open_status = 0;
-		winreg_rsp->key_handle.addr = 0;
-		winreg_rsp->werror = cpu_to_le32(WERR_OK);
-	}
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
-	cifsd_debug("close_key ptr to handle = %x\n",
-					winreg_rsp->key_handle.addr);
-	return 0;
-}
 
 int winreg_enum_key(struct cifsd_pipe *pipe,
 				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
@@ -467,84 +577,23 @@ int winreg_notify_change_key_value(struct cifsd_pipe *pipe,
 	cifsd_debug("flush_key\n");
 	return 0;
 }
-int winreg_set_value(struct cifsd_pipe *pipe,
-				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
-{
-	RPC_REQUEST_RSP *rpc_request_rsp;
-	struct registry_value *ret;
-	int offset = 0;
-	int value_len = 0;
-	int key_addr;
-	struct registry_node *base_key;
-	char *value_name;
-	KEY_HANDLE *key_handle;
-	NAME_INFO *name_info;
-	VALUE_BUFFER *value_buffer;
-	WINREG_COMMON_RSP *winreg_rsp;
-
-	key_handle = (KEY_HANDLE *)in_data;
-	offset += sizeof(KEY_HANDLE);
-	name_info = (NAME_INFO *)(((char *)in_data) + offset);
-
-	key_addr = key_handle->addr;
-	base_key = (struct registry_node *)key_addr;
-
-	value_name = smb_strndup_from_utf16((char *)name_info->Buffer,
-			name_info->key_packet_len, 1, pipe->codepage);
-	if (IS_ERR(value_name))
-		return PTR_ERR(value_name);
-	value_len = name_info->key_packet_len;
-	value_len = ((value_len + 3) & ~3);
-	offset += (sizeof(NAME_INFO) + value_len);
-
-	value_buffer =  (VALUE_BUFFER *)(((char *)in_data) + offset);
-	offset += (sizeof(__u32)*2);
-	winreg_rsp = malloc(sizeof(WINREG_COMMON_RSP));
-	if (!winreg_rsp) {
-		free(value_name);
-		return -ENOMEM;
-	}
-
-	pipe->data = (char *)winreg_rsp;
-	rpc_request_rsp = &winreg_rsp->rpc_request_rsp;
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
-	if (base_key == NULL || base_key->open_status == 0) {
-		winreg_rsp->werror = cpu_to_le32(WERR_INVALID_PARAMETER);
-	} else {
-		ret = set_value(value_name, value_buffer,
-			(struct registry_node *)key_handle->addr);
-		if (IS_ERR(ret))
-			return -ENOMEM;
-		winreg_rsp->werror = cpu_to_le32(WERR_OK);
-	}
-	free(value_name);
-	return 0;
-}
-
 int winreg_delete_value(struct cifsd_pipe *pipe,
 				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
 {
 	RPC_REQUEST_RSP *rpc_request_rsp;
 	struct registry_value *ret;
 	int offset = 0;
-	int key_addr;
 	struct registry_node *base_key;
 	struct registry_value *value;
 	struct registry_value *prev_value;
 	char *value_name;
-	KEY_HANDLE *key_handle;
 	NAME_INFO *name_info;
 	WINREG_COMMON_RSP *winreg_rsp;
 
-	key_handle = (KEY_HANDLE *)in_data;
 	offset += sizeof(KEY_HANDLE);
 	name_info = (NAME_INFO *)(((char *)in_data) + offset);
 
-	key_addr = key_handle->addr;
-	base_key = (struct registry_node *)key_addr;
+	base_key = winreg_handle_key(in_data);
 
 	value_name = smb_strndup_from_utf16((char *)name_info->Buffer,
 			name_info->key_packet_len, 1, pipe->codepage);
@@ -565,8 +614,7 @@ int winreg_delete_value(struct cifsd_pipe *pipe,
 	if (base_key == NULL || base_key->open_status == 0) {
 		winreg_rsp->werror = cpu_to_le32(WERR_INVALID_PARAMETER);
 	} else {
-		ret = search_value(value_name,
-					(struct registry_node *)key_addr);
+		ret = search_value(value_name, base_key);
 		if (IS_ERR(ret))
 			winreg_rsp->werror = cpu_to_le32(WERR_OK);
 		else {
@@ -594,136 +642,6 @@ int winreg_delete_value(struct cifsd_pipe *pipe,
 	return 0;
 }
 
-int winreg_query_value(struct cifsd_pipe *pipe,
-				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
-{
-	RPC_REQUEST_RSP *rpc_request_rsp;
-	struct registry_value *ret;
-	int offset = 0;
-	int value_len = 0;
-	int key_addr;
-	struct registry_value *value;
-	char *value_name;
-	QUERY_VALUE_RSP *winreg_rsp;
-	KEY_HANDLE *key_handle;
-	NAME_INFO *name_info;
-	BUFFER_INFO *buffer_info;
-	__u32 *ptr_check;
-	QUERY_INFO *query_info;
-
-	winreg_rsp = malloc(sizeof(QUERY_VALUE_RSP));
-	if (!winreg_rsp)
-		return -ENOMEM;
-
-	pipe->data = (char *)winreg_rsp;
-	rpc_request_rsp = &winreg_rsp->rpc_request_rsp;
-	dcerpc_header_init(&rpc_request_rsp->hdr, RPC_RESPONSE,
-				RPC_FLAG_FIRST | RPC_FLAG_LAST,
-				rpc_request_req->hdr.call_id);
-	rpc_request_rsp->context_id = rpc_request_req->context_id;
-
-	key_handle = (KEY_HANDLE *)in_data;
-	offset += sizeof(KEY_HANDLE);
-	name_info = (NAME_INFO *)(((char *)in_data) + offset);
-
-	key_addr = key_handle->addr;
-
-	value_name = smb_strndup_from_utf16((char *)name_info->Buffer,
-			name_info->key_packet_len, 1, pipe->codepage);
-	if (IS_ERR(value_name))
-		return PTR_ERR(value_name);
-	cifsd_debug("base key addr %x, value name %s\n", key_addr,
-								value_name);
-
-	ret = search_value(value_name, (struct registry_node *)key_addr);
-	if (IS_ERR(ret)) {
-		if ((strcmp(value_name, "") == 0) ||
-			(strcmp(value_name, "Default") == 0))
-			goto err_invalid_param;
-		else
-			goto err_bad_file;
-	}
-	value = (struct registry_value *)ret;
-
-	value_len = name_info->key_packet_len;
-	value_len = ((value_len + 3) & ~3);
-	offset += (sizeof(NAME_INFO) + value_len);
-
-	ptr_check = (__u32 *)((in_data) + offset);
-	if (*ptr_check == 0)
-		goto err_invalid_param;
-
-	offset += (sizeof(DATA_INFO));
-
-	buffer_info = (BUFFER_INFO *)(in_data + offset);
-
-	if (buffer_info->ref_id != 0)
-		offset += (sizeof(__u32)*4);
-	else
-		offset += (sizeof(__u32));
-
-	ptr_check = (__u32 *)((in_data) + offset);
-	if (*ptr_check == 0)
-		goto err_invalid_param;
-
-	offset += (sizeof(DATA_INFO));
-
-	ptr_check = (__u32 *)((in_data) + offset);
-	if (*ptr_check == 0)
-		goto err_invalid_param;
-
-	offset += (sizeof(DATA_INFO));
-	query_info = malloc(sizeof(QUERY_INFO));
-	if (!winreg_rsp) {
-		free(value_name);
-		return -ENOMEM;
-	}
-
-	winreg_rsp->query_val_info = query_info;
-	query_info->type_info.info = value->value_type;
-	query_info->type_info.ref_id = cpu_to_le32(0x00020010);
-	query_info->size_info.info = value->value_size;
-	query_info->size_info.ref_id = cpu_to_le32(0x00020018);
-	query_info->length_info.info = value->value_size;
-	query_info->length_info.ref_id = cpu_to_le32(0x0002001c);
-	query_info->data_info.max_count = value->value_size;
-	query_info->data_info.actual_count = value->value_size;
-	query_info->data_info.offset = 0;
-	query_info->data_ref_id = cpu_to_le32(0x00020014);
-
-	if (query_info->size_info.info < sizeof(__u32))
-		query_info->Buffer = malloc(sizeof(__u32));
-	else
-		query_info->Buffer = malloc(value->value_size + 1);
-	if (!winreg_rsp)
-		return -ENOMEM;
-
-	memcpy(query_info->Buffer, value->value_buffer, value->value_size);
-	if (buffer_info->ref_id != 0) {
-		cifsd_debug("client buffer size %d value buffer size %d\n",
-			buffer_info->data_info.max_count, value->value_size);
-		if (buffer_info->data_info.max_count >= value->value_size)
-			winreg_rsp->werror = cpu_to_le32(WERR_OK);
-		else
-			winreg_rsp->werror = cpu_to_le32(WERR_MORE_DATA);
-	} else {
-		winreg_rsp->werror = cpu_to_le32(WERR_OK);
-	}
-	free(value_name);
-	return 0;
-
-err_invalid_param:
-	free(value_name);
-	winreg_rsp->werror = cpu_to_le32(WERR_INVALID_PARAMETER);
-	return 0;
-
-err_bad_file:
-	free(value_name);
-	winreg_rsp->werror = cpu_to_le32(WERR_BAD_FILE);
-	return 0;
-
-}
-
 int winreg_enum_value(struct cifsd_pipe *pipe,
 				RPC_REQUEST_REQ *rpc_request_req, char *in_data)
 {
@@ -754,7 +672,7 @@ struct registry_value *search_value(char *name, struct registry_node *key_addr)
 
 	cifsd_debug("value name %s\n", name);
 	if (strcmp(name, "") == 0)
-		strcpy(name, "Default");
+		name = "Default";
 	if (base_key_addr->value_list == NULL)
 		return ERR_PTR(-EINVAL);
 
@@ -768,61 +686,54 @@ struct registry_value *search_value(char *name, struct registry_node *key_addr)
 
 }
 
-struct registry_value *set_value(char *name, VALUE_BUFFER *buffer_info,
-					struct registry_node *key_addr)
+/**
+ * set_value() - add a value to a key or replace its data
+ * @name:	value name, "" is the default value
+ * @type:	REG_* type of the data
+ * @data:	value data
+ * @size:	bytes in @data
+ * @key_addr:	key the value belongs to
+ *
+ * Return:	the value, ERR_PTR(-EINVAL) for a name too long to be
+ *		stored or ERR_PTR(-ENOMEM)
+ */
+struct registry_value *set_value(char *name, __u32 type, __u8 *data,
+		__u32 size, struct registry_node *key_addr)
 {
-	struct registry_node *base_key_addr = (struct registry_node *)key_addr;
 	struct registry_value *value;
-	struct registry_value *ret = NULL;
+	char *buffer;
 
 	if (strcmp(name, "") == 0)
-		strcpy(name, "Default");
-	if (base_key_addr->value_list == NULL) {
+		name = "Default";
+	if (strlen(name) >= sizeof(value->value_name))
+		return ERR_PTR(-EINVAL);
+
+	buffer = malloc(size ? size : 1);
+	if (!buffer)
+		return ERR_PTR(-ENOMEM);
+	if (size)
+		memcpy(buffer, data, size);
+
+	value = search_value(name, key_addr);
+	if (IS_ERR(value)) {
 		value = malloc(sizeof(struct registry_value));
-		if (!value)
+		if (!value) {
+			free(buffer);
 			return ERR_PTR(-ENOMEM);
-
+		}
 		strcpy(value->value_name, name);
-		value->value_type = buffer_info->value_type;
-		value->value_size = buffer_info->buffer_count;
-		cifsd_debug("type %d, size %d, name %s\n",
-			value->value_type, value->value_size,
-				value->value_name);
-		value->value_buffer = malloc(value->value_size);
-		if (!value->value_buffer)
-			return ERR_PTR(-ENOMEM);
-
-		memcpy(value->value_buffer, buffer_info->Buffer,
-							value->value_size);
-		value->neighbour = NULL;
-		base_key_addr->value_list = value;
+		value->neighbour = key_addr->value_list;
+		key_addr->value_list = value;
 	} else {
-		ret = search_value(name, key_addr);
-		if (IS_ERR(ret)) {
-			value = malloc(sizeof(struct registry_value));
-			if (!value)
-				return ERR_PTR(-ENOMEM);
-
-			strcpy(value->value_name, name);
-			value->value_type = buffer_info->value_type;
-			value->value_size = buffer_info->buffer_count;
-			value->value_buffer = malloc(value->value_size);
-			if (!value->value_buffer)
-				return ERR_PTR(-ENOMEM);
-
-			memcpy(value->value_buffer, buffer_info->Buffer,
-							value->value_size);
-			value->neighbour = base_key_addr->value_list;
-			base_key_addr->value_list = value;
-		} else {
-			value = (struct registry_value *)ret;
-			value->value_size = buffer_info->buffer_count;
-			value->value_type = buffer_info->value_type;
-			memcpy(value->value_buffer, buffer_info->Buffer,
-							value->value_size);
-		}
+		free(value->value_buffer);
 	}
-	return ret;
+
+	value->value_type = type;
+	value->value_size = size;
+	value->value_buffer = buffer;
+	cifsd_debug("type %d, size %d, name %s\n",
+		value->value_type, value->value_size, value->value_name);
+	return value;
 }
 
 void free_registry(struct registry_node *key_addr)
@@ -834,16 +745,16 @@ void free_registry(struct registry_node *key_addr)
 	struct registry_value *prev_value;
 
 	if (base_key_addr->child == NULL) {
-		cifsd_debug("free address %x key name %s\n",
-			(__u32)base_key_addr, base_key_addr->key_name);
+		cifsd_debug("free address %p key name %s\n",
+			base_key_addr, base_key_addr->key_name);
 		if (base_key_addr->value_list != NULL) {
 			value = base_key_addr->value_list;
 			while (value != NULL) {
 				prev_value = value;
 				value = value->neighbour;
 				free(prev_value->value_buffer);
-				cifsd_debug("free address %x value name %s\n",
-					(__u32)prev_value,
+				cifsd_debug("free address %p value name %s\n",
+					prev_value,
 					prev_value->value_name);
 				free(prev_value);
 			}
@@ -856,15 +767,15 @@ void free_registry(struct registry_node *key_addr)
 			key = key->neighbour;
 			free_registry(prev_key);
 		}
-		cifsd_debug("free address %x key name%s\n",
-				(__u32)base_key_addr, base_key_addr->key_name);
+		cifsd_debug("free address %p key name%s\n",
+				base_key_addr, base_key_addr->key_name);
 		if (base_key_addr->value_list != NULL) {
 			value = base_key_addr->value_list;
 			while (value != NULL) {
 				prev_value = value;
 				value = value->neighbour;
-				cifsd_debug("free address %x value name %s\n",
-					(__u32)prev_value,
+				cifsd_debug("free address %p value name %s\n",
+					prev_value,
 					prev_value->value_name);
 				free(prev_value->value_buffer);
 				free(prev_value);
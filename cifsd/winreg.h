@@ -23,6 +23,7 @@
 #define __CIFSD_WINREG_H
 
 #include "dcerpc.h"
+#include "ndr.h"
 
 /* WINREG opnum values */
 #define WINREG_OPENHKCR			0x00
@@ -83,11 +84,6 @@ typedef struct data_info {
 	__u32 info;
 } __attribute__((packed)) DATA_INFO;
 
-typedef struct buffer_info {
-	__u32 ref_id;
-	UNISTR_INFO data_info;
-} __attribute__((packed)) BUFFER_INFO;
-
 typedef struct class_name {
 	__u16 len;
 	__u16 size;
@@ -105,21 +101,6 @@ typedef struct key_info {
 	__u64 last_changed_time;
 } __attribute__((packed)) KEY_INFO;
 
-typedef struct query_info {
-	DATA_INFO type_info;
-	__u32 data_ref_id;
-	UNISTR_INFO data_info;
-	__u8 *Buffer;
-	DATA_INFO size_info;
-	DATA_INFO length_info;
-} __attribute__((packed)) QUERY_INFO;
-
-typedef struct value_buffer {
-	__u32 value_type;
-	__u32 buffer_count;
-	__u8 Buffer[0];
-} __attribute__((packed)) VALUE_BUFFER;
-
 /* Winreg response structure */
 typedef struct enum_key_rsp {
 	RPC_REQUEST_RSP rpc_request_rsp;
@@ -145,12 +126,6 @@ typedef struct enum_value_rsp {
 	__u32 werror;
 } __attribute__((packed)) ENUM_VALUE_RSP;
 
-typedef struct query_value_rsp {
-	RPC_REQUEST_RSP rpc_request_rsp;
-	QUERY_INFO *query_val_info;
-	__u32 werror;
-} __attribute__((packed)) QUERY_VALUE_RSP;
-
 typedef struct query_info_key_rsp {
 	RPC_REQUEST_RSP rpc_request_rsp;
 	CLASSNAME_INFO class_info;
@@ -158,18 +133,6 @@ typedef struct query_info_key_rsp {
 	__u32 werror;
 } __attribute__((packed)) QUERY_INFO_KEY_RSP;
 
-typedef struct getversion_rsp {
-	RPC_REQUEST_RSP rpc_request_rsp;
-	__u32 version;
-	__u32 werror;
-} __attribute__((packed)) GET_VERSION_RSP;
-
-typedef struct openhkey_rsp {
-	RPC_REQUEST_RSP rpc_request_rsp;
-	KEY_HANDLE key_handle;
-	__u32 werror;
-} __attribute__((packed)) OPENHKEY_RSP;
-
 typedef struct winreg_common_rsp {
 	RPC_REQUEST_RSP rpc_request_rsp;
 	__u32	werror;
@@ -197,28 +160,22 @@ typedef struct create_key_rsp {
 #define WINREG_KEY_SET_VALUE		0x00000002
 #define WINREG_KEY_QUERY_VALUE		0x00000001
 
-int winreg_open_root_key(struct cifsd_pipe *pipe, int opnum,
-			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
-int winreg_open_key(struct cifsd_pipe *pipe,
-			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
-int winreg_get_version(struct cifsd_pipe *pipe,
-			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
+/* calls served from the generated table, see idl/winreg.idl */
+int winreg_open_root_key(struct cifsd_pipe *pipe, struct ndr *ndr);
+int winreg_get_version(struct cifsd_pipe *pipe, struct ndr *ndr);
+int winreg_open_key(struct cifsd_pipe *pipe, struct ndr *ndr);
+int winreg_close_key(struct cifsd_pipe *pipe, struct ndr *ndr);
+int winreg_query_value(struct cifsd_pipe *pipe, struct ndr *ndr);
+int winreg_set_value(struct cifsd_pipe *pipe, struct ndr *ndr);
+
 int winreg_delete_key(struct cifsd_pipe *pipe,
 			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
 int winreg_create_key(struct cifsd_pipe *pipe,
 			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
-int winreg_close_key(struct cifsd_pipe *pipe,
-			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
-int winreg_open_key(struct cifsd_pipe *pipe,
-			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
 int winreg_flush_key(struct cifsd_pipe *pipe,
 			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
-int winreg_set_value(struct cifsd_pipe *pipe,
-			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
 int winreg_delete_value(struct cifsd_pipe *pipe,
 			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
-int winreg_query_value(struct cifsd_pipe *pipe,
-			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
 int winreg_query_info_key(struct cifsd_pipe *pipe,
 			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
 int winreg_notify_change_key_value(struct cifsd_pipe *pipe,
@@ -228,6 +185,11 @@ int winreg_enum_key(struct cifsd_pipe *pipe,
 int winreg_enum_value(struct cifsd_pipe *pipe,
 			RPC_REQUEST_REQ *rpc_request_req, char *in_data);
 
+void winreg_handle_set(void *handle, struct registry_node *key);
+struct registry_node *winreg_handle_key(const void *handle);
+
+int cifsd_init_registry(void);
+void cifsd_free_registry(void);
 struct registry_node *init_root_key(char *name);
 int init_predefined_registry(void);
 void free_registry(struct registry_node *key_addr);
@@ -235,6 +197,6 @@ struct registry_node *search_registry(char *name,
 						struct registry_node *key_addr);
 struct registry_node *create_key(char *name, struct registry_node *key_addr);
 struct registry_value *search_value(char *name, struct registry_node *key_addr);
-struct registry_value *set_value(char *name, VALUE_BUFFER *buffer_info,
-					struct registry_node *key_addr);
+struct registry_value *set_value(char *name, __u32 type, __u8 *data,
+		__u32 size, struct registry_node *key_addr);
 #endif /* __CIFSD_WINREG_H  */
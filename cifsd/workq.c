@@ -0,0 +1,400 @@
+/*
+ *   cifsd-tools/cifsd/workq.c
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include "workq.h"
+#include "stats.h"
+#include "pool.h"
+
+int cifsd_nr_workers = CIFSD_WORKERS_DEFAULT;
+
+static struct cifsd_worker *cifsd_workers;
+static int nr_running;
+
+/* response buffer of the thread handling events inline */
+static char *cifsd_inline_rsp_buf;
+static __thread char *cifsd_worker_rsp_buf;
+
+static LIST_HEAD(cifsd_work_cache);
+static int cifsd_work_cached;
+static pthread_mutex_t cifsd_work_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * cifsd_work_alloc() - get a buffer able to hold any kernel event
+ *
+ * Return:	work buffer, or NULL on allocation failure
+ */
+struct cifsd_work *cifsd_work_alloc(void)
+{
+	struct cifsd_work *work = NULL;
+
+	pthread_mutex_lock(&cifsd_work_lock);
+	if (!list_empty(&cifsd_work_cache)) {
+		work = list_entry(cifsd_work_cache.next, struct cifsd_work,
+				list);
+		list_del(&work->list);
+		cifsd_work_cached--;
+	}
+	pthread_mutex_unlock(&cifsd_work_lock);
+
+	if (work)
+		return work;
+
+	work = malloc(sizeof(struct cifsd_work) + NETLINK_CIFSD_MAX_BUF);
+	if (work)
+		work->nlh = (struct nlmsghdr *)(work + 1);
+	return work;
+}
+
+/**
+ * cifsd_work_free() - recycle a work buffer
+ * @work:	buffer from cifsd_work_alloc()
+ */
+void cifsd_work_free(struct cifsd_work *work)
+{
+	pthread_mutex_lock(&cifsd_work_lock);
+	if (cifsd_work_cached < CIFSD_WORK_CACHE_MAX) {
+		list_add(&work->list, &cifsd_work_cache);
+		cifsd_work_cached++;
+		work = NULL;
+	}
+	pthread_mutex_unlock(&cifsd_work_lock);
+
+	free(work);
+}
+
+/**
+ * cifsd_work_handle() - run the handler of a received event
+ * @work:	buffer holding the event, still owned by the caller
+ *
+ * Return:	handler return value
+ */
+int cifsd_work_handle(struct cifsd_work *work)
+{
+	__u64 start = cifsd_stats_start();
+	int ret;
+
+	ret = request_handler(work->nlh);
+	cifsd_stats_event(work->nlh->nlmsg_type, work->rx_ns, start, ret);
+	return ret;
+}
+
+/**
+ * cifsd_rsp_buf_get() - response buffer of the calling thread
+ *
+ * Every worker owns one buffer of NETLINK_CIFSD_MAX_RSP_PAYLOAD bytes,
+ * events handled inline share another. Buffers are handed out zeroed
+ * and must be returned with cifsd_rsp_buf_put() before the next event.
+ *
+ * Return:	response buffer
+ */
+char *cifsd_rsp_buf_get(void)
+{
+	if (cifsd_worker_rsp_buf)
+		return cifsd_worker_rsp_buf;
+	return cifsd_inline_rsp_buf;
+}
+
+/**
+ * cifsd_rsp_buf_put() - done with the response buffer
+ * @buf:	buffer from cifsd_rsp_buf_get()
+ * @used:	bytes the response encoders may have written
+ *
+ * Only the part that was written to is cleared again.
+ */
+void cifsd_rsp_buf_put(char *buf, size_t used)
+{
+	if (used > NETLINK_CIFSD_MAX_RSP_PAYLOAD)
+		used = NETLINK_CIFSD_MAX_RSP_PAYLOAD;
+	memset(buf, 0, used);
+}
+
+/*
+ * Wait for work, waking up once a second for the reaper when it is on.
+ * Called and returns with the worker lock held.
+ */
+static void cifsd_worker_wait(struct cifsd_worker *worker)
+{
+	struct timespec ts;
+
+	if (!cifsd_client_idle) {
+		pthread_cond_wait(&worker->cond, &worker->lock);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec++;
+	pthread_cond_timedwait(&worker->cond, &worker->lock, &ts);
+
+	pthread_mutex_unlock(&worker->lock);
+	cifsd_reap_tick();
+	pthread_mutex_lock(&worker->lock);
+}
+
+/**
+ * cifsd_worker_fn() - worker thread main loop
+ * @arg:	worker this thread serves
+ *
+ * Handles queued events in arrival order and runs the idle reaper for
+ * the clients of this worker. On stop request the queue is drained
+ * before the thread exits.
+ */
+static void *cifsd_worker_fn(void *arg)
+{
+	struct cifsd_worker *worker = (struct cifsd_worker *)arg;
+	struct cifsd_work *work;
+
+	cifsd_worker_rsp_buf = worker->rsp_buf;
+
+	pthread_mutex_lock(&worker->lock);
+	for (;;) {
+		if (list_empty(&worker->queue)) {
+			if (worker->stop)
+				break;
+			cifsd_worker_wait(worker);
+			continue;
+		}
+
+		work = list_entry(worker->queue.next, struct cifsd_work, list);
+		list_del(&work->list);
+		pthread_mutex_unlock(&worker->lock);
+
+		cifsd_work_handle(work);
+		cifsd_work_free(work);
+		cifsd_reap_tick();
+
+		pthread_mutex_lock(&worker->lock);
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	cifsd_pool_thread_exit();
+	return NULL;
+}
+
+/**
+ * cifsd_pick_worker() - map a client to its worker
+ * @server_handle:	client identifier from the kernel event
+ *
+ * All events of one client land on the same worker, which keeps them
+ * in order, while different clients spread over all workers.
+ *
+ * Return:	worker serving this client
+ */
+static struct cifsd_worker *cifsd_pick_worker(__u64 server_handle)
+{
+	__u64 h = server_handle;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return &cifsd_workers[h % nr_running];
+}
+
+static int is_pipe_event(unsigned int type)
+{
+	return type >= CIFSD_KEVENT_CREATE_PIPE &&
+		type <= CIFSD_KEVENT_DESTROY_PIPE;
+}
+
+/**
+ * cifsd_workq_dispatch() - hand a received kernel event to a worker
+ * @work:	buffer holding the event, ownership passes to the callee
+ *
+ * Pipe events are queued on the worker owning the client. Port control
+ * events only touch the connection counters of the netlink thread and
+ * are handled inline, as is everything when no workers are running.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int cifsd_workq_dispatch(struct cifsd_work *work)
+{
+	struct nlmsghdr *nlh = work->nlh;
+	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
+	struct cifsd_worker *worker;
+	int ret;
+
+	if (!nr_running || !is_pipe_event(nlh->nlmsg_type)) {
+		ret = cifsd_work_handle(work);
+		cifsd_work_free(work);
+		cifsd_reap_tick();
+		return ret;
+	}
+
+	worker = cifsd_pick_worker(ev->server_handle);
+	pthread_mutex_lock(&worker->lock);
+	list_add_tail(&work->list, &worker->queue);
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+	return 0;
+}
+
+/* release what cifsd_workq_init() set up for a worker that has stopped */
+static void cifsd_worker_destroy(struct cifsd_worker *worker)
+{
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->lock);
+	free(worker->rsp_buf);
+	worker->rsp_buf = NULL;
+}
+
+/**
+ * cifsd_workq_init() - start the event dispatch workers
+ *
+ * Workers never take signals, termination is handled by the netlink
+ * thread.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int cifsd_workq_init(void)
+{
+	struct cifsd_worker *worker;
+	pthread_condattr_t condattr;
+	sigset_t mask, oldmask;
+	int nr = cifsd_nr_workers;
+	int i, ret;
+
+	if (nr < 0) {
+		nr = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nr < 1)
+			nr = 1;
+	}
+
+	cifsd_inline_rsp_buf = calloc(1, NETLINK_CIFSD_MAX_RSP_PAYLOAD);
+	if (!cifsd_inline_rsp_buf) {
+		cifsd_err("failed to allocate response buffer\n");
+		return -ENOMEM;
+	}
+
+	if (!nr) {
+		cifsd_debug("handling events on netlink thread\n");
+		return 0;
+	}
+
+	cifsd_workers = calloc(nr, sizeof(struct cifsd_worker));
+	if (!cifsd_workers) {
+		cifsd_err("failed to allocate %d workers\n", nr);
+		ret = -ENOMEM;
+		goto out_inline;
+	}
+
+	/* reaper ticks are timed on the monotonic clock */
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+
+	for (i = 0; i < nr; i++) {
+		worker = &cifsd_workers[i];
+		worker->id = i;
+		INIT_LIST_HEAD(&worker->queue);
+		pthread_mutex_init(&worker->lock, NULL);
+		pthread_cond_init(&worker->cond, &condattr);
+
+		worker->rsp_buf = calloc(1, NETLINK_CIFSD_MAX_RSP_PAYLOAD);
+		if (!worker->rsp_buf) {
+			cifsd_err("failed to allocate worker %d buffer\n", i);
+			cifsd_worker_destroy(worker);
+			break;
+		}
+
+		ret = pthread_create(&worker->thread, NULL, cifsd_worker_fn,
+				worker);
+		if (ret) {
+			cifsd_err("failed to start worker %d, err %d\n",
+					i, ret);
+			cifsd_worker_destroy(worker);
+			break;
+		}
+		nr_running++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+	pthread_condattr_destroy(&condattr);
+
+	if (!nr_running) {
+		ret = -EAGAIN;
+		goto out_workers;
+	}
+
+	cifsd_debug("started %d event workers\n", nr_running);
+	return 0;
+
+out_workers:
+	/* the worker that failed released its buffer, the rest never had one */
+	free(cifsd_workers);
+	cifsd_workers = NULL;
+out_inline:
+	free(cifsd_inline_rsp_buf);
+	cifsd_inline_rsp_buf = NULL;
+	return ret;
+}
+
+/**
+ * cifsd_workq_exit() - finish queued events and stop the workers
+ */
+void cifsd_workq_exit(void)
+{
+	struct cifsd_worker *worker;
+	int i, nr = nr_running;
+
+	/* dispatch inline from here on */
+	nr_running = 0;
+
+	for (i = 0; i < nr; i++) {
+		worker = &cifsd_workers[i];
+		pthread_mutex_lock(&worker->lock);
+		worker->stop = 1;
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->lock);
+	}
+
+	for (i = 0; i < nr; i++) {
+		worker = &cifsd_workers[i];
+		pthread_join(worker->thread, NULL);
+		cifsd_worker_destroy(worker);
+	}
+
+	free(cifsd_workers);
+	cifsd_workers = NULL;
+
+	free(cifsd_inline_rsp_buf);
+	cifsd_inline_rsp_buf = NULL;
+
+	pthread_mutex_lock(&cifsd_work_lock);
+	while (!list_empty(&cifsd_work_cache)) {
+		struct cifsd_work *work;
+
+		work = list_entry(cifsd_work_cache.next, struct cifsd_work,
+				list);
+		list_del(&work->list);
+		free(work);
+	}
+	cifsd_work_cached = 0;
+	pthread_mutex_unlock(&cifsd_work_lock);
+}
@@ -0,0 +1,67 @@
+/*
+ *   cifsd-tools/cifsd/workq.h
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef __CIFSD_TOOLS_WORKQ_H
+#define __CIFSD_TOOLS_WORKQ_H
+
+#include <pthread.h>
+#include "netlink.h"
+
+/* use one worker per online cpu unless told otherwise */
+#define CIFSD_WORKERS_DEFAULT	-1
+
+/* recycled work buffers kept around for the receive path */
+#define CIFSD_WORK_CACHE_MAX	256
+
+/*
+ * Kernel event buffer. The netlink message is received right after the
+ * header and the same buffer travels to the worker handling the event.
+ */
+struct cifsd_work {
+	struct list_head	list;
+	__u64			rx_ns;	/* receive time, for statistics */
+	struct nlmsghdr		*nlh;
+};
+
+struct cifsd_worker {
+	int			id;
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct list_head	queue;
+	int			stop;
+	char			*rsp_buf;	/* response buffer */
+};
+
+/* number of dispatch threads, 0 handles events on the netlink thread */
+extern int cifsd_nr_workers;
+
+struct cifsd_work *cifsd_work_alloc(void);
+void cifsd_work_free(struct cifsd_work *work);
+
+int cifsd_workq_init(void);
+void cifsd_workq_exit(void);
+int cifsd_workq_dispatch(struct cifsd_work *work);
+int cifsd_work_handle(struct cifsd_work *work);
+
+char *cifsd_rsp_buf_get(void);
+void cifsd_rsp_buf_put(char *buf, size_t used);
+
+#endif /* __CIFSD_TOOLS_WORKQ_H */
@@ -28,6 +28,10 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "cifsd_stats.h"
 
 /* global definitions */
 #define PATH_STATS "/sys/fs/cifsd/stat"
@@ -44,6 +48,24 @@
 
 #define O_SERVER 1
 #define O_CLIENT 2
+#define O_LATENCY 4
+
+static const char *event_names[CIFSD_STAT_NR_EVENTS] = {
+	"create_pipe", "read_pipe", "write_pipe", "ioctl_pipe",
+	"lanman_pipe", "destroy_pipe", "close_fail", "close_pass",
+};
+
+static const char *time_names[CIFSD_STAT_NR_TIMES] = {
+	"rx-to-send", "handler", "send",
+};
+
+static const char *iface_names[CIFSD_STAT_NR_IFACES] = {
+	"srvsvc", "wkssvc", "winreg",
+};
+
+static const char *pool_names[CIFSD_STAT_NR_POOLS] = {
+	"client", "pipe", "reasm",
+};
 
 /**
  * readstat() - reads data from cifsd statistics control interface
@@ -138,6 +160,140 @@ int getstats(char *node)
 	return 0;
 }
 
+/**
+ * hist_percentile() - latency below which a share of samples falls
+ * @hist:	histogram
+ * @count:	number of samples in @hist
+ * @pct:	share, 0.5 for the median
+ *
+ * Return:	latency in usec
+ */
+static double hist_percentile(struct cifsd_hist *hist, __u64 count,
+		double pct)
+{
+	__u64 want = pct * count, seen = 0;
+	int i;
+
+	if (want < pct * count)
+		want++;
+	if (!want)
+		want = 1;
+
+	for (i = 0; i < CIFSD_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= want)
+			return cifsd_hist_value(i) / 1000.0;
+	}
+	return hist->max_ns / 1000.0;
+}
+
+static void print_hist(const char *name, const char *stage,
+		struct cifsd_hist *hist)
+{
+	__u64 count = 0;
+	int i;
+
+	/* buckets are updated live, count what is there */
+	for (i = 0; i < CIFSD_HIST_BUCKETS; i++)
+		count += hist->buckets[i];
+	if (!count)
+		return;
+
+	fprintf(stdout, "%-14s %-11s %10llu %9.1f %9.1f %9.1f %9.1f\n",
+			name, stage, count,
+			hist_percentile(hist, count, 0.5),
+			hist_percentile(hist, count, 0.99),
+			hist_percentile(hist, count, 0.999),
+			hist->max_ns / 1000.0);
+}
+
+/**
+ * getlatency() - print cifsd event latency statistics
+ * @path:	statistics file of the cifsd daemon
+ *
+ * Return:	0 on success and -1 on failure
+ */
+int getlatency(char *path)
+{
+	struct cifsd_stats *stats;
+	struct stat st;
+	char name[32];
+	time_t start;
+	int fd, i, j;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stdout, "Not able to open (%s) for read, err(%d)\n",
+				path, errno);
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < sizeof(struct cifsd_stats)) {
+		fprintf(stdout, "(%s) is not a cifsd statistics file\n", path);
+		close(fd);
+		return -1;
+	}
+
+	stats = mmap(NULL, sizeof(*stats), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED) {
+		fprintf(stdout, "Failed to map (%s), err(%d)\n", path, errno);
+		return -1;
+	}
+
+	if (stats->magic != CIFSD_STATS_MAGIC ||
+			stats->version != CIFSD_STATS_VERSION ||
+			stats->size != sizeof(*stats) ||
+			stats->hist_buckets != CIFSD_HIST_BUCKETS) {
+		fprintf(stdout, "(%s) has an unsupported layout\n", path);
+		munmap(stats, sizeof(*stats));
+		return -1;
+	}
+
+	start = stats->start_time;
+	fprintf(stdout, "cifsd event latency (usec) since %s", ctime(&start));
+	fprintf(stdout, "%-14s %-11s %10s %9s %9s %9s %9s\n", "event",
+			"stage", "count", "p50", "p99", "p999", "max");
+	for (i = 0; i < CIFSD_STAT_NR_EVENTS; i++) {
+		for (j = 0; j < CIFSD_STAT_NR_TIMES; j++)
+			print_hist(event_names[i], time_names[j],
+					&stats->events[i].time[j]);
+		if (stats->events[i].errors)
+			fprintf(stdout, "%-14s %-11s %10llu\n",
+					event_names[i], "errors",
+					stats->events[i].errors);
+	}
+
+	for (i = 0; i < CIFSD_STAT_NR_IFACES; i++) {
+		for (j = 0; j < CIFSD_STAT_MAX_OPNUM; j++) {
+			struct cifsd_opnum_stats *op = &stats->opnums[i][j];
+
+			snprintf(name, sizeof(name), "%s/%d", iface_names[i], j);
+			print_hist(name, "opnum", &op->time);
+			if (op->errors)
+				fprintf(stdout, "%-14s %-11s %10llu\n", name,
+						"errors", op->errors);
+			if (op->rejected)
+				fprintf(stdout, "%-14s %-11s %10llu\n", name,
+						"rejected", op->rejected);
+		}
+	}
+
+	fprintf(stdout, "\n%-14s %10s %10s %12s %12s\n", "pool", "objects",
+			"in use", "allocs", "hits");
+	for (i = 0; i < CIFSD_STAT_NR_POOLS; i++)
+		fprintf(stdout, "%-14s %10llu %10llu %12llu %12llu\n",
+				pool_names[i], stats->pools[i].objects,
+				stats->pools[i].in_use, stats->pools[i].allocs,
+				stats->pools[i].hits);
+
+	fprintf(stdout, "\nreaped %llu idle clients, %llu abandoned pipes\n",
+			stats->reaped_clients, stats->reaped_pipes);
+
+	munmap(stats, sizeof(*stats));
+	return 0;
+}
+
 /**
  * is_validIP() - utility function to validate IP address
  * @ipaddr:	source buffer containing IP to verify
@@ -165,7 +321,7 @@ int is_validIP(char *ipaddr)
  *
  * Return:	success: 0; fail: -1
  */
-int process_args(int flags, char *client, int size)
+int process_args(int flags, char *client, int size, char *statfile)
 {
 	if (flags & O_SERVER) {
 		if (setstatopt(OPT_SERVER, strlen(OPT_SERVER)))
@@ -183,6 +339,12 @@ int process_args(int flags, char *client, int size)
 		flags &= ~O_CLIENT;
 	}
 
+	if (flags & O_LATENCY) {
+		if (getlatency(statfile))
+			return -1;
+		flags &= ~O_LATENCY;
+	}
+
 	return 0;
 }
 
@@ -195,7 +357,10 @@ void usage(void)
 			"options:\n"
 			"	-h help\n"
 			"	-s show server stat\n"
-			"	-c <client IP> show client stat\n");
+			"	-c <client IP> show client stat\n"
+			"	-l show cifsd event latency\n"
+			"	-f <file> cifsd statistics file (default "
+			PATH_CIFSD_EVSTATS ")\n");
 }
 
 /**
@@ -208,11 +373,12 @@ void usage(void)
 int main(int argc, char *argv[])
 {
 	char client[MAX_IPLEN];
+	char *statfile = PATH_CIFSD_EVSTATS;
 	int flags = 0, opt;
 
 	memset(client, 0, MAX_IPLEN);
 
-	while ((opt = getopt(argc, argv, "hsc:")) != -1) {
+	while ((opt = getopt(argc, argv, "hsc:lf:")) != -1) {
 		switch (opt) {
 			case 's':
 				flags |= O_SERVER;
@@ -227,13 +393,19 @@ int main(int argc, char *argv[])
 					exit(EXIT_FAILURE);
 				}
 				break;
+			case 'l':
+				flags |= O_LATENCY;
+				break;
+			case 'f':
+				statfile = optarg;
+				break;
 			case 'h':
 			default: /* '?' */
 				usage();
 				exit(EXIT_FAILURE);
 		}
 	}
-	if (process_args(flags, client, strlen(client)))
+	if (process_args(flags, client, strlen(client), statfile))
 		fprintf(stdout, "Unable to process request, try again\n");
 
 	return 0;
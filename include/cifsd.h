@@ -52,9 +52,10 @@
 #define PATH_PWDDB "/etc/cifs/cifspwd.db"
 #define PATH_SHARECONF "/etc/cifs/smb.conf"
 
-#define PATH_CIFSD_CONFIG "/sys/fs/cifsd/config"
-#define PATH_CIFSD_SHARE "/sys/fs/cifsd/share"
-#define PATH_CIFSD_USR "/sys/fs/cifsd/user"
+#define PATH_CIFSD_SYSFS "/sys/fs/cifsd"
+#define PATH_CIFSD_CONFIG PATH_CIFSD_SYSFS "/config"
+#define PATH_CIFSD_SHARE PATH_CIFSD_SYSFS "/share"
+#define PATH_CIFSD_USR PATH_CIFSD_SYSFS "/user"
 
 #define UNICODE_LEN(x) (x * 2)
 
@@ -89,30 +90,102 @@ struct cifsd_pipe_table {
 
 #define INVALID_PIPE   0xFFFFFFFF
 
+/* concurrent opens of one pipe type per client */
+#define CIFSD_PIPE_INSTANCES	4
+
+/* presentation contexts a pipe can have bound at once */
+#define CIFSD_PIPE_CONTEXTS	8
+
+struct cifsd_pipe_context {
+	__u16 id; /* context_id chosen by the client */
+	__u16 iface; /* index in the dcerpc interface table */
+};
+
+/* contexts a bind may propose, binds with more are refused */
+#define CIFSD_BIND_RESULTS	16
+
+/*
+ * Reply queued on a pipe until the client reads it. Requests may be
+ * written back to back, their replies are read in the same order.
+ */
+struct cifsd_rpc_rsp {
+	__u32 call_id;
+	__u16 context_id;
+	__u8 pkt_type; /* RPC_RESPONSE or the bind reply type */
+	int opnum;
+	char *buf; /* marshalled reply PDU */
+	int datasize;
+	int sent; /* stub bytes of buf handed out in earlier fragments */
+	void *rsp_cache; /* shared reply that buf points into */
+};
+
+/* replies a pipe holds before further requests are refused */
+#define CIFSD_PIPE_RSP_MAX	8
+
 struct cifsd_pipe {
-        struct list_head list;
-        int id;
-        char *data;
-        int pkt_type;
+        __u64 id;
+        int refcount; /* CREATEs of the same pipe id not yet destroyed */
+	__u64 last_used; /* reaper clock, seconds */
+        char *data; /* winreg reply of the request being handled */
         unsigned int pipe_type;
         int opnum;
-        char *buf;
-        int datasize;
-        int sent;
+	__u32 call_id; /* of the request being handled */
+	__u16 context_id;
+	__u16 max_frag; /* negotiated response fragment size, 0 if unbound */
+	__u16 max_recv; /* request fragment size granted to the client */
+	struct cifsd_client_info *client; /* NULL for LANMAN stack pipes */
+	char *reasm; /* request fragments received so far */
+	int reasm_len;
+	int reasm_size;
+	__u32 assoc_gid; /* association group, 0 until bound */
+	int nr_contexts;
+	struct cifsd_pipe_context contexts[CIFSD_PIPE_CONTEXTS];
+	/* bind reply for the next read, built from a template */
+	__u8 bind_rsp; /* its packet type, 0 if none is pending */
+	__u8 bind_auth; /* answer the NTLMSSP negotiate of the bind */
+	__s8 bind_iface; /* interface named in the ack, -1 for none */
+	__u8 nr_results;
+	__u8 results[CIFSD_BIND_RESULTS]; /* RPC_REASON_NONE if accepted */
+	/* replies not read yet, oldest at rsp_head */
+	struct cifsd_rpc_rsp rsp[CIFSD_PIPE_RSP_MAX];
+	int rsp_head;
+	int nr_rsp;
 	char codepage[CIFSD_CODEPAGE_LEN];
 	char username[CIFSD_USERNAME_LEN];
 };
 
+/*
+ * DCE/RPC association group. A bind either starts a new group or joins
+ * one of the same client by id, a group lives as long as pipes use it.
+ */
+struct cifsd_assoc_group {
+	__u32 id; /* 0 for a free slot */
+	int refcount; /* pipes bound to the group */
+};
+
+/* every pipe of a client is in at most one group */
+#define CIFSD_ASSOC_GROUPS	(MAX_PIPE * CIFSD_PIPE_INSTANCES)
+
 struct cifsd_client_info {
-        struct list_head list;
         __u64 hash;
 	void *local_nls; // To be replaced with actual encoding logic
-        struct list_head pipelist;
+	int nr_pipes;
+	struct cifsd_pipe *pipes[MAX_PIPE][CIFSD_PIPE_INSTANCES];
+	__u64 last_active; /* reaper clock, seconds */
+	struct list_head reap_list; /* on the reaper wheel of its thread */
+	int reasm_bytes; /* reassembly buffers held by its pipes */
+	struct cifsd_assoc_group assoc_groups[CIFSD_ASSOC_GROUPS];
 };
 
+/*
+ * Fragmented requests are reassembled in pooled buffers of
+ * CIFSD_REASM_BUF_SIZE, bigger ones grow on the heap. All pipes of a
+ * client together hold at most CIFSD_REASM_CLIENT_MAX bytes.
+ */
+#define CIFSD_REASM_BUF_SIZE	(16 * 1024)
+#define CIFSD_REASM_CLIENT_MAX	(1024 * 1024)
+
 /* max string size for share and parameters */
-#define SHARE_MAX_NAME_LEN      100
-#define SHARE_MAX_COMMENT_LEN   100
 
 #define MAX_SERVER_NAME_LEN	100
 #define MAX_SERVER_WRKGRP_LEN	100
@@ -145,6 +218,8 @@ struct cifsd_share {
 
 extern struct list_head cifsd_share_list;
 extern int cifsd_num_shares;
+/* bumped on every change of the share list */
+extern unsigned int cifsd_share_generation;
 
 char *guestAccountName;
 //char *server_string;
@@ -190,12 +265,17 @@ int get_entry(int fd, char **buf, int *isEOF);
 void tlws(char *src, char *dst, int *sz);
 
 int process_rpc_rsp(struct cifsd_pipe *pipe, char *data_buf, int size);
-int process_rpc(struct cifsd_pipe *pipe, char *data);
+int process_rpc(struct cifsd_pipe *pipe, char *data, int len);
+void dcerpc_pipe_release(struct cifsd_pipe *pipe);
+void dcerpc_pipe_close(struct cifsd_pipe *pipe);
+void dcerpc_init(void);
 int handle_lanman_pipe(struct cifsd_pipe *pipe, char *in_data,
 		char *out_data, int *param_len);
 
 int smbConvertToUTF16(__le16 *target, char *source, int slen,
                 int targetlen, const char *codepage);
+int smbConvertFromUTF16(char *target, char *source, int slen,
+		int targetlen, const char *codepage);
 char *smb_strndup_from_utf16(char *src, const int maxlen,
                 const int is_unicode, const char *codepage);
 
@@ -214,8 +294,10 @@ char *smb_strndup_from_utf16(char *src, const int maxlen,
 #define __cpu_to_be16(x) (__swab16((x)))
 #define __be16_to_cpu(x) __swab16((__be16)(x))
 
+#define cpu_to_le64(x)	__cpu_to_le64(x)
 #define cpu_to_le32(x)	__cpu_to_le32(x)
 #define cpu_to_le16(x)	__cpu_to_le16(x)
+#define le64_to_cpu(x)	__le64_to_cpu(x)
 #define le32_to_cpu(x)	__le32_to_cpu(x)
 #define le16_to_cpu(x)	__le16_to_cpu(x)
 
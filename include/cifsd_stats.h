@@ -0,0 +1,140 @@
+/*
+ *   cifsd-tools/include/cifsd_stats.h
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef __CIFSD_TOOLS_CIFSD_STATS_H
+#define __CIFSD_TOOLS_CIFSD_STATS_H
+
+#include <linux/types.h>
+
+/*
+ * Event latency statistics of the cifsd daemon. The daemon keeps them
+ * in a shared file mapping which cifsstat -l maps read-only.
+ */
+#define PATH_CIFSD_EVSTATS	"/var/run/cifsd.stats"
+
+#define CIFSD_STATS_MAGIC	0x43534454	/* "CSDT" */
+#define CIFSD_STATS_VERSION	5
+
+/*
+ * Log-linear histogram in nanoseconds: values below CIFSD_HIST_SUB get
+ * a bucket each, every power of two above that is split into
+ * CIFSD_HIST_SUB buckets, which bounds the error to about 6%.
+ */
+#define CIFSD_HIST_SUB_BITS	4
+#define CIFSD_HIST_SUB		(1 << CIFSD_HIST_SUB_BITS)
+#define CIFSD_HIST_MAX_SHIFT	36	/* up to ~18 minutes */
+#define CIFSD_HIST_BUCKETS	((CIFSD_HIST_MAX_SHIFT + 2) * CIFSD_HIST_SUB)
+
+struct cifsd_hist {
+	__u64		count;
+	__u64		sum_ns;
+	__u64		max_ns;
+	__u32		buckets[CIFSD_HIST_BUCKETS];
+};
+
+/* what is timed for each kernel event */
+enum {
+	CIFSD_STAT_RX_TO_SEND,	/* received until handled and answered */
+	CIFSD_STAT_HANDLER,	/* handler time, sending excluded */
+	CIFSD_STAT_SEND,	/* time spent sending the response */
+	CIFSD_STAT_NR_TIMES
+};
+
+/* CIFSD_KEVENT_CREATE_PIPE .. CIFSD_KEVENT_SMBPORT_CLOSE_PASS */
+#define CIFSD_STAT_NR_EVENTS	8
+
+/* RPC interfaces with per opnum statistics */
+enum {
+	CIFSD_STAT_SRVSVC,
+	CIFSD_STAT_WKSSVC,
+	CIFSD_STAT_WINREG,
+	CIFSD_STAT_NR_IFACES
+};
+
+#define CIFSD_STAT_MAX_OPNUM	64
+
+struct cifsd_opnum_stats {
+	__u64			errors;		/* handler failed */
+	__u64			rejected;	/* not implemented or bad size */
+	struct cifsd_hist	time;		/* calls that were handled */
+};
+
+/* object pools of the daemon */
+enum {
+	CIFSD_STAT_POOL_CLIENT,
+	CIFSD_STAT_POOL_PIPE,
+	CIFSD_STAT_POOL_REASM,
+	CIFSD_STAT_NR_POOLS
+};
+
+struct cifsd_pool_stats {
+	__u64		objects;	/* allocated from malloc, pool size */
+	__u64		in_use;
+	__u64		allocs;
+	__u64		hits;		/* allocs served from a free list */
+};
+
+struct cifsd_event_stats {
+	__u64			errors;
+	struct cifsd_hist	time[CIFSD_STAT_NR_TIMES];
+};
+
+struct cifsd_stats {
+	__u32			magic;
+	__u32			version;
+	__u32			size;		/* sizeof(struct cifsd_stats) */
+	__u32			hist_buckets;
+	__u64			start_time;	/* time(2) of daemon start */
+	struct cifsd_event_stats events[CIFSD_STAT_NR_EVENTS];
+	struct cifsd_opnum_stats opnums[CIFSD_STAT_NR_IFACES][CIFSD_STAT_MAX_OPNUM];
+	struct cifsd_pool_stats	pools[CIFSD_STAT_NR_POOLS];
+	__u64			reaped_clients;	/* freed after being idle */
+	__u64			reaped_pipes;	/* abandoned without DESTROY */
+};
+
+static inline unsigned int cifsd_hist_bucket(__u64 ns)
+{
+	unsigned int shift;
+
+	if (ns < CIFSD_HIST_SUB)
+		return ns;
+
+	shift = 63 - __builtin_clzll(ns) - CIFSD_HIST_SUB_BITS;
+	if (shift > CIFSD_HIST_MAX_SHIFT)
+		return CIFSD_HIST_BUCKETS - 1;
+
+	return (shift + 1) * CIFSD_HIST_SUB + (ns >> shift) - CIFSD_HIST_SUB;
+}
+
+/* middle of the range covered by a bucket */
+static inline __u64 cifsd_hist_value(unsigned int bucket)
+{
+	unsigned int shift;
+	__u64 low;
+
+	if (bucket < CIFSD_HIST_SUB)
+		return bucket;
+
+	shift = bucket / CIFSD_HIST_SUB - 1;
+	low = (__u64)(CIFSD_HIST_SUB + bucket % CIFSD_HIST_SUB) << shift;
+	return low + ((1ULL << shift) >> 1);
+}
+
+#endif /* __CIFSD_TOOLS_CIFSD_STATS_H */
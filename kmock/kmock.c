@@ -0,0 +1,699 @@
+/*
+ *   cifsd-tools/kmock/kmock.c
+ *
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * cifsd-kmock stands in for the cifsd kernel module. It creates the
+ * sysfs control files the daemon writes to, listens on a UNIX socket
+ * the daemon connects to with -u, and drives it with the same events
+ * the module sends for SMB clients browsing shares.
+ */
+
+#include <poll.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cifsd.h"
+#include "netlink.h"
+#include "dcerpc.h"
+
+#define KMOCK_SOCK_PATH		"/tmp/cifsd-kmock.sock"
+#define KMOCK_SYSFS_ROOT	"/tmp/cifsd-kmock"
+#define KMOCK_CLIENTS		64
+#define KMOCK_SESSIONS		1000
+#define KMOCK_OUT_BUFLEN	4280
+#define KMOCK_CODEPAGE		"UTF-8"
+
+/*
+ * Steps of one simulated session, the way an SMB client lists shares:
+ * open srvsvc, bind, read the bind ack, NetShareEnumAll over a pipe
+ * transceive, pipe reads for the remaining reply fragments if any, a RAP
+ * NetShareEnum and close the pipe.
+ */
+enum kmock_step {
+	KMOCK_CREATE,
+	KMOCK_BIND,
+	KMOCK_BIND_ACK,
+	KMOCK_ENUM_ALL,
+	KMOCK_ENUM_READ,
+	KMOCK_RAP_ENUM,
+	KMOCK_DESTROY,
+	KMOCK_NR_STEPS
+};
+
+static const struct kmock_step_info {
+	const char	*name;
+	unsigned int	kevent;
+	unsigned int	rsp;	/* response event, 0 when there is none */
+} kmock_steps[KMOCK_NR_STEPS] = {
+	{"create", CIFSD_KEVENT_CREATE_PIPE, 0},
+	{"bind", CIFSD_KEVENT_WRITE_PIPE, CIFSD_UEVENT_WRITE_PIPE_RSP},
+	{"bind-ack", CIFSD_KEVENT_READ_PIPE, CIFSD_UEVENT_READ_PIPE_RSP},
+	{"enum-all", CIFSD_KEVENT_IOCTL_PIPE, CIFSD_UEVENT_IOCTL_PIPE_RSP},
+	{"enum-read", CIFSD_KEVENT_READ_PIPE, CIFSD_UEVENT_READ_PIPE_RSP},
+	{"rap-enum", CIFSD_KEVENT_LANMAN_PIPE, CIFSD_UEVENT_LANMAN_PIPE_RSP},
+	{"destroy", CIFSD_KEVENT_DESTROY_PIPE, 0},
+};
+
+struct kmock_client {
+	__u64		handle;
+	int		step;
+	int		sessions;
+	int		more;	/* reply fragments left to read */
+	unsigned int	rsp_got; /* bytes of the current response so far */
+	__u64		sent_ns;
+};
+
+/* request payloads, built once */
+static char bind_req[sizeof(RPC_BIND_REQ) + sizeof(RPC_CONTEXT) +
+		sizeof(RPC_IFACE)];
+static char enum_req[128];
+static unsigned int enum_req_len;
+static char rap_req[64];
+static unsigned int rap_req_len;
+
+static struct kmock_client *clients;
+static int nr_clients = KMOCK_CLIENTS;
+static int nr_sessions = KMOCK_SESSIONS;
+static int frag_size = KMOCK_OUT_BUFLEN;	/* max_rsize of the bind */
+
+/* clients with a request to send, in order */
+static int *ready;
+static int ready_head, ready_count;
+
+static __u64 *lat_ns;
+static unsigned long nr_lat, max_lat;
+static unsigned long nr_events, nr_errors;
+static int nr_done;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: cifsd-kmock [-h] [-v] [-u socket] [-s sysfs-dir]\n"
+		"       [-c clients] [-n sessions per client] [-f fragment size]\n"
+		"Then start: cifsd -s sysfs-dir -u socket\n");
+	exit(1);
+}
+
+static __u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const struct GUID srvsvc_uuid = {
+	0x4b324fc8, 0x1670, 0x01d3,
+	{0x12, 0x78}, {0x5a, 0x47, 0xbf, 0x6e, 0xe1, 0x88}
+};
+
+static const struct GUID ndr_uuid = {
+	0x8a885d04, 0x1ceb, 0x11c9,
+	{0x9f, 0xe8}, {0x08, 0x00, 0x2b, 0x10, 0x48, 0x60}
+};
+
+static void rpc_hdr_init(RPC_HDR *hdr, int type, int len, int call_id)
+{
+	hdr->major = RPC_MAJOR_VER;
+	hdr->minor = RPC_MINOR_VER;
+	hdr->pkt_type = type;
+	hdr->flags = RPC_FLAG_FIRST | RPC_FLAG_LAST;
+	hdr->pack_type[0] = 0x10;
+	hdr->frag_len = len;
+	hdr->auth_len = 0;
+	hdr->call_id = call_id;
+}
+
+/**
+ * build_requests() - encode the request payloads sent by every session
+ */
+static void build_requests(void)
+{
+	RPC_BIND_REQ *bind = (RPC_BIND_REQ *)bind_req;
+	RPC_CONTEXT *ctx = (RPC_CONTEXT *)(bind + 1);
+	RPC_IFACE *transfer = (RPC_IFACE *)(ctx + 1);
+	RPC_REQUEST_REQ *req = (RPC_REQUEST_REQ *)enum_req;
+	SERVER_HANDLE *handle;
+	LANMAN_PARAMS *params;
+	const char *unc = "\\\\kmock";
+	char *p;
+	__u32 *u32;
+	int i, len = strlen(unc) + 1;
+
+	rpc_hdr_init(&bind->hdr, RPC_BIND, sizeof(bind_req), 1);
+	bind->max_tsize = KMOCK_OUT_BUFLEN;
+	bind->max_rsize = frag_size;
+	bind->num_contexts = 1;
+	ctx->context_id = 0;
+	ctx->num_transfer_syntaxes = 1;
+	memcpy(&ctx->abstract.uuid, &srvsvc_uuid, sizeof(struct GUID));
+	ctx->abstract.version_maj = 3;
+	memcpy(&transfer->uuid, &ndr_uuid, sizeof(struct GUID));
+	transfer->version_maj = 2;
+
+	/* srvsvc_NetShareEnumAll(\\kmock, level 1, prefmaxlen -1) */
+	handle = (SERVER_HANDLE *)(req + 1);
+	handle->ref_id = 0x20000;
+	handle->handle_info.max_count = len;
+	handle->handle_info.actual_count = len;
+	p = (char *)(handle + 1);
+	for (i = 0; i < len; i++, p += 2) {
+		p[0] = unc[i];
+		p[1] = 0;
+	}
+	p += (4 - (len * 2) % 4) % 4;
+	u32 = (__u32 *)p;
+	*u32++ = 1;		/* level */
+	*u32++ = 1;		/* ctr switch */
+	*u32++ = 0x20004;	/* ctr1 pointer */
+	*u32++ = 0;		/* count */
+	*u32++ = 0;		/* array pointer */
+	*u32++ = 0xffffffff;	/* prefmaxlen */
+	*u32++ = 0x20008;	/* resume handle pointer */
+	*u32++ = 0;		/* resume handle */
+	enum_req_len = (char *)u32 - enum_req;
+	rpc_hdr_init(&req->hdr, RPC_REQUEST, enum_req_len, 2);
+	req->alloc_hint = enum_req_len - sizeof(RPC_REQUEST_REQ);
+	req->opnum = SRV_NET_SHARE_ENUM_ALL;
+
+	/* RAP NetShareEnum, level 1 */
+	p = rap_req + 2;
+	rap_req[0] = RAP_NetshareEnum;
+	strcpy(p, "WrLeh");
+	p += strlen("WrLeh") + 1;
+	strcpy(p, "B13BWz");
+	p += strlen("B13BWz") + 1;
+	params = (LANMAN_PARAMS *)p;
+	params->InfoLevel = 1;
+	params->ReceiveBufferSize = KMOCK_OUT_BUFLEN;
+	rap_req_len = (char *)(params + 1) - rap_req;
+}
+
+/**
+ * create_sysfs() - create the control files the daemon writes to
+ * @root:	directory passed to cifsd -s
+ *
+ * Return:	0 on success, otherwise -1
+ */
+static int create_sysfs(const char *root)
+{
+	static const char *files[] = {"config", "share", "user", "stat"};
+	char path[PATH_MAX];
+	unsigned int i;
+	int fd;
+
+	if (mkdir(root, 0700) && errno != EEXIST) {
+		cifsd_err("can't create %s, err %d\n", root, errno);
+		return -1;
+	}
+
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0) {
+			cifsd_err("can't create %s, err %d\n", path, errno);
+			return -1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+/**
+ * kmock_send() - send one event to the daemon
+ * @fd:		connected socket
+ * @ev:		event, ev->type selects the netlink message type
+ * @data:	payload
+ * @len:	payload length
+ *
+ * Return:	0 on success, -EAGAIN when the daemon is not reading,
+ *		otherwise error
+ */
+static int kmock_send(int fd, struct cifsd_uevent *ev, void *data,
+		unsigned int len)
+{
+	struct nlmsghdr nlh;
+	struct msghdr msg;
+	struct iovec iov[3];
+
+	memset(&nlh, 0, sizeof(nlh));
+	nlh.nlmsg_len = NLMSG_SPACE(sizeof(*ev)) + len;
+	nlh.nlmsg_type = ev->type;
+	ev->buflen = len;
+
+	iov[0].iov_base = &nlh;
+	iov[0].iov_len = NLMSG_HDRLEN;
+	iov[1].iov_base = ev;
+	iov[1].iov_len = NLMSG_SPACE(sizeof(*ev)) - NLMSG_HDRLEN;
+	iov[2].iov_base = data;
+	iov[2].iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 3;
+
+	if (sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return -EAGAIN;
+		cifsd_err("sendmsg failed, err %d\n", errno);
+		return -errno;
+	}
+
+	nr_events++;
+	return 0;
+}
+
+/**
+ * send_step() - send the event for the current step of a client
+ * @fd:		connected socket
+ * @c:		client
+ *
+ * Return:	0 on success, otherwise error from kmock_send()
+ */
+static int send_step(int fd, struct kmock_client *c)
+{
+	struct cifsd_uevent ev;
+	void *data = NULL;
+	unsigned int len = 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = kmock_steps[c->step].kevent;
+	ev.server_handle = c->handle;
+	ev.pipe_type = SRVSVC;
+
+	switch (c->step) {
+	case KMOCK_CREATE:
+		ev.k.c_pipe.id = c->handle;
+		strcpy(ev.k.c_pipe.codepage, KMOCK_CODEPAGE);
+		break;
+	case KMOCK_BIND:
+		ev.k.w_pipe.id = c->handle;
+		data = bind_req;
+		len = sizeof(bind_req);
+		break;
+	case KMOCK_BIND_ACK:
+		ev.k.r_pipe.id = c->handle;
+		ev.k.r_pipe.out_buflen = KMOCK_OUT_BUFLEN;
+		break;
+	case KMOCK_ENUM_ALL:
+		ev.k.i_pipe.id = c->handle;
+		ev.k.i_pipe.out_buflen = KMOCK_OUT_BUFLEN;
+		data = enum_req;
+		len = enum_req_len;
+		break;
+	case KMOCK_ENUM_READ:
+		ev.k.r_pipe.id = c->handle;
+		ev.k.r_pipe.out_buflen = KMOCK_OUT_BUFLEN;
+		break;
+	case KMOCK_RAP_ENUM:
+		ev.pipe_type = LANMAN;
+		ev.k.l_pipe.out_buflen = KMOCK_OUT_BUFLEN;
+		strcpy(ev.k.l_pipe.codepage, KMOCK_CODEPAGE);
+		strcpy(ev.k.l_pipe.username, "kmock");
+		data = rap_req;
+		len = rap_req_len;
+		break;
+	case KMOCK_DESTROY:
+		ev.k.d_pipe.id = c->handle;
+		break;
+	}
+
+	c->sent_ns = now_ns();
+	return kmock_send(fd, &ev, data, len);
+}
+
+static void ready_push(int idx)
+{
+	ready[(ready_head + ready_count) % nr_clients] = idx;
+	ready_count++;
+}
+
+/**
+ * flush_ready() - send pending requests until the socket fills up
+ * @fd:		connected socket
+ *
+ * Steps without a response are followed right away by the next one,
+ * a client waiting for a response leaves the ready ring.
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int flush_ready(int fd)
+{
+	struct kmock_client *c;
+	int ret;
+
+	while (ready_count) {
+		c = &clients[ready[ready_head]];
+		ret = send_step(fd, c);
+		if (ret == -EAGAIN)
+			return 0;
+		if (ret)
+			return ret;
+
+		if (kmock_steps[c->step].rsp) {
+			ready_head = (ready_head + 1) % nr_clients;
+			ready_count--;
+			continue;
+		}
+
+		if (c->step == KMOCK_DESTROY) {
+			c->step = KMOCK_CREATE;
+			if (++c->sessions == nr_sessions) {
+				nr_done++;
+				ready_head = (ready_head + 1) % nr_clients;
+				ready_count--;
+			}
+			continue;
+		}
+		c->step++;
+	}
+	return 0;
+}
+
+/* size of the whole response, which may come in several chunks */
+static unsigned int rsp_count(struct nlmsghdr *nlh)
+{
+	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
+
+	switch (nlh->nlmsg_type) {
+	case CIFSD_UEVENT_READ_PIPE_RSP:
+		return ev->u.r_pipe_rsp.read_count;
+	case CIFSD_UEVENT_IOCTL_PIPE_RSP:
+		return ev->u.i_pipe_rsp.data_count;
+	case CIFSD_UEVENT_LANMAN_PIPE_RSP:
+		return ev->u.l_pipe_rsp.data_count;
+	}
+	return 0;
+}
+
+/* chunk word a read or ioctl response chunk should carry */
+static int rsp_chunk_ok(struct nlmsghdr *nlh, unsigned int got,
+		unsigned int count)
+{
+	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
+	unsigned int chunk, seq;
+
+	if (nlh->nlmsg_type == CIFSD_UEVENT_READ_PIPE_RSP)
+		chunk = ev->u.r_pipe_rsp.chunk;
+	else if (nlh->nlmsg_type == CIFSD_UEVENT_IOCTL_PIPE_RSP)
+		chunk = ev->u.i_pipe_rsp.chunk;
+	else
+		return 1;
+
+	seq = (got - ev->buflen) / NETLINK_CIFSD_MAX_PAYLOAD;
+	return CIFSD_UEVENT_CHUNK_SEQ(chunk) == seq &&
+		!(chunk & CIFSD_UEVENT_F_MORE) == !(got < count);
+}
+
+/**
+ * handle_rsp() - account a daemon response and move its client on
+ * @fd:		connected socket
+ * @nlh:	received message
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int handle_rsp(int fd, struct nlmsghdr *nlh)
+{
+	struct cifsd_uevent *ev = NLMSG_DATA(nlh);
+	struct cifsd_uevent close_ev;
+	struct kmock_client *c;
+	int i;
+
+	switch (nlh->nlmsg_type) {
+	case CIFSD_UEVENT_STOP_SMBPORT:
+		/* the daemon waits for every connection to close */
+		memset(&close_ev, 0, sizeof(close_ev));
+		close_ev.type = CIFSD_KEVENT_SMBPORT_CLOSE_PASS;
+		for (i = 0; i < nr_clients; i++)
+			kmock_send(fd, &close_ev, NULL, 0);
+		return 0;
+	case CIFSD_UEVENT_INIT_CONNECTION:
+	case CIFSD_UEVENT_START_SMBPORT:
+	case CIFSD_UEVENT_EXIT_CONNECTION:
+		return 0;
+	}
+
+	if (ev->server_handle < 1 || ev->server_handle > nr_clients) {
+		cifsd_err("response %u for unknown handle %llu\n",
+				nlh->nlmsg_type, ev->server_handle);
+		return -EINVAL;
+	}
+
+	c = &clients[ev->server_handle - 1];
+	if (nlh->nlmsg_type != kmock_steps[c->step].rsp) {
+		cifsd_err("client %llu: got %u, expected %s response\n",
+				c->handle, nlh->nlmsg_type,
+				kmock_steps[c->step].name);
+		return -EINVAL;
+	}
+
+	/* the first chunk of a reply fragment tells if more follow */
+	if ((c->step == KMOCK_ENUM_ALL || c->step == KMOCK_ENUM_READ) &&
+			!c->rsp_got) {
+		RPC_HDR *hdr = (RPC_HDR *)ev->buffer;
+
+		c->more = !ev->error && ev->buflen >= sizeof(*hdr) &&
+			!(hdr->flags & RPC_FLAG_LAST);
+	}
+
+	c->rsp_got += ev->buflen;
+	if (!rsp_chunk_ok(nlh, c->rsp_got, rsp_count(nlh))) {
+		cifsd_err("client %llu: %s chunk out of order\n", c->handle,
+				kmock_steps[c->step].name);
+		nr_errors++;
+	}
+	if (c->rsp_got < rsp_count(nlh))
+		return 0;
+	c->rsp_got = 0;
+
+	if (ev->error) {
+		nr_errors++;
+		cifsd_debug("client %llu: %s failed, err %d\n", c->handle,
+				kmock_steps[c->step].name, ev->error);
+	}
+
+	if (nr_lat < max_lat)
+		lat_ns[nr_lat++] = now_ns() - c->sent_ns;
+	if (c->more)
+		c->step = KMOCK_ENUM_READ;
+	else if (c->step == KMOCK_ENUM_ALL)
+		c->step = KMOCK_RAP_ENUM;
+	else
+		c->step++;
+	ready_push(c - clients);
+	return 0;
+}
+
+/**
+ * wait_for_start() - wait until the daemon opened the SMB port
+ * @fd:		connected socket
+ * @buf:	receive buffer
+ *
+ * Return:	0 on success, otherwise -1
+ */
+static int wait_for_start(int fd, struct nlmsghdr *buf)
+{
+	int len;
+
+	for (;;) {
+		len = recv(fd, buf, NETLINK_CIFSD_MAX_BUF, 0);
+		if (len <= 0) {
+			cifsd_err("daemon went away before starting\n");
+			return -1;
+		}
+		if (buf->nlmsg_type == CIFSD_UEVENT_START_SMBPORT)
+			return 0;
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static __u64 percentile(double p)
+{
+	unsigned long i = (unsigned long)(p * (nr_lat - 1));
+
+	return lat_ns[i] / 1000;
+}
+
+static void report(__u64 elapsed_ns)
+{
+	double secs = elapsed_ns / 1e9;
+
+	qsort(lat_ns, nr_lat, sizeof(*lat_ns), cmp_u64);
+	printf("cifsd-kmock: %d clients, %d sessions each, %lu events, "
+		"%lu errors in %.3f s\n", nr_clients, nr_sessions, nr_events,
+		nr_errors, secs);
+	printf("  events/sec %.0f, responses/sec %.0f\n",
+		nr_events / secs, nr_lat / secs);
+	if (nr_lat)
+		printf("  latency usec: p50 %llu p99 %llu p999 %llu max %llu\n",
+			percentile(0.5), percentile(0.99),
+			percentile(0.999), lat_ns[nr_lat - 1] / 1000);
+}
+
+/**
+ * run() - drive all clients through their sessions
+ * @fd:		connected socket
+ *
+ * Return:	0 on success, otherwise -1
+ */
+static int run(int fd)
+{
+	struct nlmsghdr *buf;
+	struct pollfd pfd;
+	__u64 start;
+	int i, len, ret = -1;
+
+	buf = malloc(NETLINK_CIFSD_MAX_BUF);
+	if (!buf)
+		return -1;
+
+	if (wait_for_start(fd, buf))
+		goto out;
+
+	for (i = 0; i < nr_clients; i++) {
+		clients[i].handle = i + 1;
+		ready_push(i);
+	}
+
+	start = now_ns();
+	for (;;) {
+		if (flush_ready(fd))
+			goto out;
+		if (nr_done == nr_clients)
+			break;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN | (ready_count ? POLLOUT : 0);
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			goto out;
+
+		while ((len = recv(fd, buf, NETLINK_CIFSD_MAX_BUF,
+						MSG_DONTWAIT)) > 0) {
+			if (len < NLMSG_SPACE(sizeof(struct cifsd_uevent))) {
+				cifsd_err("short message, len %d\n", len);
+				goto out;
+			}
+			if (handle_rsp(fd, buf))
+				goto out;
+		}
+
+		if (!len || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			cifsd_err("daemon went away, err %d\n", errno);
+			goto out;
+		}
+	}
+
+	report(now_ns() - start);
+	ret = 0;
+out:
+	free(buf);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	char *sock_path = KMOCK_SOCK_PATH;
+	char *sysfs_root = KMOCK_SYSFS_ROOT;
+	struct sockaddr_un addr;
+	int c, lfd, fd, ret;
+
+	while ((c = getopt(argc, argv, "u:s:c:n:f:vh")) != EOF)
+		switch (c) {
+		case 'u':
+			sock_path = optarg;
+			break;
+		case 's':
+			sysfs_root = optarg;
+			break;
+		case 'c':
+			nr_clients = atoi(optarg);
+			break;
+		case 'n':
+			nr_sessions = atoi(optarg);
+			break;
+		case 'f':
+			frag_size = atoi(optarg);
+			break;
+		case 'v':
+			vflags |= F_VERBOSE;
+			break;
+		default:
+			usage();
+		}
+
+	if (nr_clients < 1 || nr_sessions < 1 ||
+			frag_size < 1 || frag_size > 0xFFFF ||
+			strlen(sock_path) >= sizeof(addr.sun_path))
+		usage();
+
+	clients = calloc(nr_clients, sizeof(*clients));
+	ready = calloc(nr_clients, sizeof(*ready));
+	/* latencies of the fixed steps, fragment reads beyond are dropped */
+	max_lat = (unsigned long)nr_clients * nr_sessions * 4;
+	lat_ns = calloc(max_lat, sizeof(*lat_ns));
+	if (!clients || !ready || !lat_ns) {
+		cifsd_err("out of memory\n");
+		return 1;
+	}
+
+	build_requests();
+	if (create_sysfs(sysfs_root))
+		return 1;
+
+	lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (lfd < 0) {
+		cifsd_err("can't create socket, err %d\n", errno);
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sock_path);
+	unlink(sock_path);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+			listen(lfd, SOMAXCONN)) {
+		cifsd_err("can't listen on %s, err %d\n", sock_path, errno);
+		return 1;
+	}
+
+	printf("cifsd-kmock: waiting for cifsd -s %s -u %s\n",
+			sysfs_root, sock_path);
+	fflush(stdout);
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0) {
+		cifsd_err("accept failed, err %d\n", errno);
+		return 1;
+	}
+
+	ret = run(fd);
+	close(fd);
+	close(lfd);
+	unlink(sock_path);
+	return ret ? 1 : 0;
+}